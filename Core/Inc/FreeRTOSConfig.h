@@ -34,12 +34,40 @@
 #define configTOTAL_HEAP_SIZE                   10240
 
 /* Hook function related definitions. */
-#define configUSE_IDLE_HOOK                     0
+#define configUSE_IDLE_HOOK                     1
 #define configUSE_TICK_HOOK                     0
 #define configCHECK_FOR_STACK_OVERFLOW          0
 #define configUSE_MALLOC_FAILED_HOOK            0
 #define configUSE_DAEMON_TASK_STARTUP_HOOK      0
 
+/* Run time stats, counted by TIM5 at 1 MHz (sys_stats.c). */
+#define configGENERATE_RUN_TIME_STATS           1
+#define configUSE_TRACE_FACILITY                1
+#define configUSE_STATS_FORMATTING_FUNCTIONS    0
+
+#ifdef __STDC__
+    void sys_stats_timer_init(void);
+    uint32_t sys_stats_timer_get(void);
+#endif
+
+#define portCONFIGURE_TIMER_FOR_RUN_TIME_STATS()    sys_stats_timer_init()
+#define portGET_RUN_TIME_COUNTER_VALUE()            sys_stats_timer_get()
+
+/* Trace recorder hooks (trace_rec.c), queues are recorded once numbered. */
+#ifdef __STDC__
+    #include "trace_rec.h"
+#endif
+
+#if CFG_TRACE_REC_EN
+#define traceTASK_SWITCHED_IN()                 trace_rec_task_switch(pxCurrentTCB->uxTCBNumber)
+#define traceQUEUE_SEND(pxQueue)                do { if ((pxQueue)->uxQueueNumber) trace_rec_event(TRACE_EV_QUEUE_SEND, (pxQueue)->uxQueueNumber, (pxQueue)->uxMessagesWaiting); } while (0)
+#define traceQUEUE_SEND_FROM_ISR(pxQueue)       traceQUEUE_SEND(pxQueue)
+#define traceQUEUE_SEND_FAILED(pxQueue)         do { if ((pxQueue)->uxQueueNumber) trace_rec_event(TRACE_EV_QUEUE_SEND_FAILED, (pxQueue)->uxQueueNumber, (pxQueue)->uxMessagesWaiting); } while (0)
+#define traceQUEUE_RECEIVE(pxQueue)             do { if ((pxQueue)->uxQueueNumber) trace_rec_event(TRACE_EV_QUEUE_RECEIVE, (pxQueue)->uxQueueNumber, (pxQueue)->uxMessagesWaiting); } while (0)
+#define traceBLOCKING_ON_QUEUE_SEND(pxQueue)    do { if ((pxQueue)->uxQueueNumber) trace_rec_event(TRACE_EV_QUEUE_BLOCK_SEND, (pxQueue)->uxQueueNumber, (pxQueue)->uxMessagesWaiting); } while (0)
+#define traceBLOCKING_ON_QUEUE_RECEIVE(pxQueue) do { if ((pxQueue)->uxQueueNumber) trace_rec_event(TRACE_EV_QUEUE_BLOCK_RECEIVE, (pxQueue)->uxQueueNumber, 0); } while (0)
+#endif
+
 /* Co-routine related definitions. */
 #define configUSE_CO_ROUTINES                   0
 #define configMAX_CO_ROUTINE_PRIORITIES         2
@@ -91,8 +119,8 @@ header file. */
 #define INCLUDE_vTaskDelay                      1
 #define INCLUDE_xTaskGetSchedulerState          1
 #define INCLUDE_xTaskGetCurrentTaskHandle       1
-#define INCLUDE_uxTaskGetStackHighWaterMark     0
-#define INCLUDE_xTaskGetIdleTaskHandle          0
+#define INCLUDE_uxTaskGetStackHighWaterMark     1
+#define INCLUDE_xTaskGetIdleTaskHandle          1
 #define INCLUDE_eTaskGetState                   0
 #define INCLUDE_xEventGroupSetBitFromISR        1
 #define INCLUDE_xTimerPendFunctionCall          0
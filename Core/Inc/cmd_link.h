@@ -0,0 +1,64 @@
+/**
+ *  @file   cmd_link.h
+ *  @brief  Binary command link over the debug UART.
+ */
+
+//--------------------------------------------------------------------------------
+
+#ifndef _CMD_LINK_H_
+#define _CMD_LINK_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//--------------------------------------------------------------------------------
+
+/* Includes */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+//--------------------------------------------------------------------------------
+
+/* Defines */
+#define CMD_LINK_PAYLOAD_MAX        128
+
+/* Frame types, responses have the top bit set */
+#define CMD_LINK_PING               0x01
+#define CMD_LINK_HISTORY_INFO       0x02
+#define CMD_LINK_HISTORY_READ       0x03
+#define CMD_LINK_SET_TIME           0x05
+#define CMD_LINK_STREAM_START       0x10
+#define CMD_LINK_STREAM_STOP        0x11
+#define CMD_LINK_SYS_STATS          0x20
+#define CMD_LINK_TRACE_DUMP         0x21
+#define CMD_LINK_OLED_STATS         0x24
+#define CMD_LINK_BOOT_TIMES         0x25
+#define CMD_LINK_OLED_FRAME         0x26
+#define CMD_LINK_METRICS            0x27
+
+#define CMD_LINK_RSP                0x80
+#define CMD_LINK_RSP_HISTORY_DATA   0x83
+#define CMD_LINK_RSP_HISTORY_END    0x84
+#define CMD_LINK_RSP_STREAM_DATA    0x92
+#define CMD_LINK_RSP_TRACE_DATA     0xA2
+#define CMD_LINK_RSP_TRACE_END      0xA3
+#define CMD_LINK_RSP_ERROR          0xFF
+
+/* Types */
+typedef void (*cmd_link_handler_t)(const uint8_t *payload, size_t len);
+
+//--------------------------------------------------------------------------------
+
+bool cmd_link_task_create(void);
+bool cmd_link_register(uint8_t type, cmd_link_handler_t handler);
+bool cmd_link_send(uint8_t type, const void *data, size_t len);
+
+//--------------------------------------------------------------------------------
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _CMD_LINK_H_ */
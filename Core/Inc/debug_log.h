@@ -17,15 +17,23 @@ extern "C" {
 /* Includes */
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 //--------------------------------------------------------------------------------
 
 
 //--------------------------------------------------------------------------------
 
+typedef void (*debug_log_rx_cb_t)(uint8_t byte);
+
 void debug_log_init(void);
 bool debug_log_send(const char data[], size_t len);
 bool debug_log(const char format[], ...);
+bool debug_log_write_dma(const uint8_t data[], size_t len);
+void debug_log_flush(void);
+void debug_log_set_rx_callback(debug_log_rx_cb_t cb);
+void debug_log_irq_handler(void);
+void debug_log_dma_irq_handler(void);
 
 //--------------------------------------------------------------------------------
 
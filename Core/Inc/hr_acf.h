@@ -0,0 +1,42 @@
+/**
+ *  @file   hr_acf.h
+ *  @brief  Autocorrelation heart rate estimator.
+ */
+
+//--------------------------------------------------------------------------------
+
+#ifndef _HR_ACF_H_
+#define _HR_ACF_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//--------------------------------------------------------------------------------
+
+/* Includes */
+#include <stdint.h>
+#include <stdbool.h>
+
+//--------------------------------------------------------------------------------
+
+/* Types */
+struct hr_acf_result
+{
+    uint8_t bpm;
+    uint16_t confidence;    /* Normalized autocorrelation peak, Q15 */
+    uint32_t cycles;        /* Estimator cost, only with CFG_HR_ACF_PROFILE */
+};
+
+//--------------------------------------------------------------------------------
+
+void hr_acf_reset(void);
+bool hr_acf_add_sample(int16_t ac, struct hr_acf_result *result);
+
+//--------------------------------------------------------------------------------
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _HR_ACF_H_ */
@@ -20,16 +20,17 @@ extern "C" {
 
 #include "FreeRTOS.h"
 
-//--------------------------------------------------------------------------------
+/* Defines */
+#define HR_APP_STREAM_RATE      1000    /* Raw streaming sample rate, Hz */
 
 //--------------------------------------------------------------------------------
 
 bool hr_app_task_create(void);
 void hr_app_task(void* params);
-void hr_app_switch_on_off(void);
 bool hr_app_create_timer(void);
 bool hr_app_start_timer(void);
 void hr_app_stop_timer(void);
+void hr_app_stream(bool enable);
 
 //--------------------------------------------------------------------------------
 
@@ -0,0 +1,31 @@
+/**
+ *  @file   hr_export.h
+ *  @brief  HR history export over the command link.
+ */
+
+//--------------------------------------------------------------------------------
+
+#ifndef _HR_EXPORT_H_
+#define _HR_EXPORT_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//--------------------------------------------------------------------------------
+
+/* Includes */
+#include <stdint.h>
+#include <stdbool.h>
+
+//--------------------------------------------------------------------------------
+
+bool hr_export_init(void);
+
+//--------------------------------------------------------------------------------
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _HR_EXPORT_H_ */
@@ -0,0 +1,55 @@
+/**
+ *  @file   hr_history.h
+ *  @brief  Persistent HR history log in the data EEPROM.
+ */
+
+//--------------------------------------------------------------------------------
+
+#ifndef _HR_HISTORY_H_
+#define _HR_HISTORY_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//--------------------------------------------------------------------------------
+
+/* Includes */
+#include <stdint.h>
+#include <stdbool.h>
+
+//--------------------------------------------------------------------------------
+
+/* Types */
+enum hr_history_quality
+{
+    HR_HISTORY_POOR = 1,
+    HR_HISTORY_FAIR,
+    HR_HISTORY_GOOD
+};
+
+struct hr_history_record
+{
+    uint32_t timestamp;     /* Unix time */
+    uint8_t bpm;
+    uint8_t spo2;           /* %, 0 if not measured */
+    enum hr_history_quality quality;
+};
+
+//--------------------------------------------------------------------------------
+
+void hr_history_init(void);
+bool hr_history_append(const struct hr_history_record *rec);
+uint32_t hr_history_first_index(void);
+uint32_t hr_history_next_index(void);
+bool hr_history_read(uint32_t index, struct hr_history_record *rec);
+bool hr_history_read_last(uint32_t n, struct hr_history_record *rec);
+uint32_t hr_history_get_writes(void);
+
+//--------------------------------------------------------------------------------
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _HR_HISTORY_H_ */
@@ -0,0 +1,45 @@
+/**
+ *  @file   hr_hrv.h
+ *  @brief  Incremental heart rate variability metrics.
+ */
+
+//--------------------------------------------------------------------------------
+
+#ifndef _HR_HRV_H_
+#define _HR_HRV_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//--------------------------------------------------------------------------------
+
+/* Includes */
+#include <stdint.h>
+#include <stdbool.h>
+
+//--------------------------------------------------------------------------------
+
+/* Types */
+struct hr_hrv_result
+{
+    uint16_t rmssd;     /* ms */
+    uint16_t sdnn;      /* ms */
+    uint8_t pnn50;      /* % */
+    uint8_t ibi_cnt;    /* Accepted IBIs in the window */
+    uint16_t rejected;  /* Artefact beats since reset */
+};
+
+//--------------------------------------------------------------------------------
+
+void hr_hrv_reset(void);
+bool hr_hrv_add_beat(uint32_t timestamp_us);
+bool hr_hrv_get(struct hr_hrv_result *result);
+
+//--------------------------------------------------------------------------------
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _HR_HRV_H_ */
@@ -0,0 +1,59 @@
+/**
+ *  @file   hr_sqi.h
+ *  @brief  Signal quality index of the IR PPG channel.
+ */
+
+//--------------------------------------------------------------------------------
+
+#ifndef _HR_SQI_H_
+#define _HR_SQI_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//--------------------------------------------------------------------------------
+
+/* Includes */
+#include <stdint.h>
+#include <stdbool.h>
+
+//--------------------------------------------------------------------------------
+
+/* Defines */
+#ifndef CFG_HR_SQI_WINDOW
+#define CFG_HR_SQI_WINDOW           100     /* samples, ~1 s at 100 Hz */
+#endif
+
+//--------------------------------------------------------------------------------
+
+/* Types */
+enum hr_sqi_status
+{
+    HR_SQI_GOOD,
+    HR_SQI_WEAK,
+    HR_SQI_NO_FINGER,
+    HR_SQI_MOTION
+};
+
+struct hr_sqi_result
+{
+    enum hr_sqi_status status;
+    uint16_t dc;            /* Mean raw IR level */
+    uint16_t perfusion;     /* AC p-p / DC in 0.01 % units */
+    uint8_t crossings;      /* Positive zero crossings of the AC signal */
+    uint8_t clipped;        /* Samples at ADC full scale */
+};
+
+//--------------------------------------------------------------------------------
+
+void hr_sqi_reset(void);
+bool hr_sqi_add_sample(uint16_t raw, int16_t ac, struct hr_sqi_result *result);
+
+//--------------------------------------------------------------------------------
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _HR_SQI_H_ */
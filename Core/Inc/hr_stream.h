@@ -0,0 +1,34 @@
+/**
+ *  @file   hr_stream.h
+ *  @brief  Raw IR/RED sample streaming over the command link.
+ */
+
+//--------------------------------------------------------------------------------
+
+#ifndef _HR_STREAM_H_
+#define _HR_STREAM_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//--------------------------------------------------------------------------------
+
+/* Includes */
+#include <stdint.h>
+#include <stdbool.h>
+
+//--------------------------------------------------------------------------------
+
+bool hr_stream_init(void);
+void hr_stream_begin(void);
+void hr_stream_push(const uint16_t ir[], const uint16_t red[], uint8_t n, uint8_t lost);
+void hr_stream_end(void);
+
+//--------------------------------------------------------------------------------
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _HR_STREAM_H_ */
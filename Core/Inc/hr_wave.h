@@ -0,0 +1,40 @@
+/**
+ *  @file   hr_wave.h
+ *  @brief  Decimated PPG waveform from the HR task to the display.
+ */
+
+//--------------------------------------------------------------------------------
+
+#ifndef _HR_WAVE_H_
+#define _HR_WAVE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//--------------------------------------------------------------------------------
+
+/* Includes */
+#include <stdint.h>
+#include <stdbool.h>
+
+//--------------------------------------------------------------------------------
+
+/* Defines */
+#ifndef CFG_HR_WAVE_DECIM
+#define CFG_HR_WAVE_DECIM       4       /* Sensor samples per plotted column, 100 Hz -> 25 Hz */
+#endif
+
+//--------------------------------------------------------------------------------
+
+void hr_wave_reset(void);
+bool hr_wave_push(int16_t ac);
+bool hr_wave_pop(int16_t *val);
+
+//--------------------------------------------------------------------------------
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _HR_WAVE_H_ */
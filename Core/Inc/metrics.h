@@ -0,0 +1,133 @@
+/**
+ *  @file   metrics.h
+ *  @brief  Statically registered counters, gauges and latency histograms.
+ */
+
+//--------------------------------------------------------------------------------
+
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//--------------------------------------------------------------------------------
+
+/* Includes */
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "stm32l1xx_hal.h"
+
+//--------------------------------------------------------------------------------
+
+/* Defines */
+#define METRICS_HIST_BUCKETS        16      /* Bucket b >= 1 holds [2^(b-1), 2^b) us, the last one is open */
+
+/* Types */
+//  The host tool keeps the names in the same order, append only
+enum metrics_counter
+{
+    METRICS_SENSOR_SAMPLES,     /* Samples read from the sensor FIFO */
+    METRICS_SENSOR_LOST,        /* Samples dropped by the full FIFO */
+    METRICS_SENSOR_I2C_ERRORS,
+    METRICS_HR_BEATS,
+    METRICS_OLED_DROPS,         /* Clock ticks and wakes not queued */
+    METRICS_OLED_FLUSHES,
+    METRICS_OLED_BYTES,
+    METRICS_OLED_I2C_ERRORS,
+    METRICS_LOG_LINES,          /* Lines sent */
+    METRICS_LOG_DROPS,          /* Lines logged from an interrupt while the UART was busy */
+    METRICS_COUNTERS
+};
+
+enum metrics_gauge
+{
+    METRICS_SENSOR_FIFO,        /* Samples per FIFO read */
+    METRICS_OLED_QUEUE,         /* Messages waiting behind the one taken */
+    METRICS_GAUGES
+};
+
+enum metrics_hist
+{
+    METRICS_SENSOR_READ_US,     /* FIFO read over I2C */
+    METRICS_HR_DSP_US,          /* Beat, ACF and SQI pipeline per batch */
+    METRICS_OLED_RENDER_US,     /* One display message drawn */
+    METRICS_OLED_FLUSH_US,      /* Flush start to the last DMA transfer */
+    METRICS_HISTS
+};
+
+struct metrics_gauge_value
+{
+    volatile int32_t value;
+    volatile int32_t peak;
+};
+
+struct metrics_context
+{
+    volatile uint32_t counters[METRICS_COUNTERS];
+    struct metrics_gauge_value gauges[METRICS_GAUGES];
+    volatile uint32_t hists[METRICS_HISTS][METRICS_HIST_BUCKETS];
+};
+
+extern struct metrics_context metrics;
+
+//--------------------------------------------------------------------------------
+
+bool metrics_init(void);
+
+//--------------------------------------------------------------------------------
+
+//  Exclusive load/store, safe from tasks and interrupts without masking them
+static inline void metrics_atomic_add(volatile uint32_t *p, uint32_t n)
+{
+    uint32_t v;
+
+    do
+    {
+        v = __LDREXW(p) + n;
+    } while (__STREXW(v, p) != 0);
+}
+
+static inline void metrics_add(enum metrics_counter id, uint32_t n)
+{
+    metrics_atomic_add(&metrics.counters[id], n);
+}
+
+static inline void metrics_inc(enum metrics_counter id)
+{
+    metrics_atomic_add(&metrics.counters[id], 1);
+}
+
+static inline void metrics_gauge_set(enum metrics_gauge id, int32_t val)
+{
+    volatile uint32_t *peak = (volatile uint32_t *)&metrics.gauges[id].peak;
+
+    metrics.gauges[id].value = val;
+
+    do
+    {
+        if ((int32_t)__LDREXW(peak) >= val)
+        {
+            __CLREX();
+            break;
+        }
+    } while (__STREXW(val, peak) != 0);
+}
+
+static inline void metrics_hist_add(enum metrics_hist id, uint32_t us)
+{
+    //  Bit length, __CLZ is __builtin_clz here and undefined for zero
+    uint32_t b = (us != 0) ? (32 - __CLZ(us)) : 0;
+
+    metrics_atomic_add(&metrics.hists[id][(b < METRICS_HIST_BUCKETS) ? b : (METRICS_HIST_BUCKETS - 1)], 1);
+}
+
+//--------------------------------------------------------------------------------
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _METRICS_H_ */
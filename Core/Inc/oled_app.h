@@ -27,7 +27,14 @@ enum oled_state
     OLED_TIME_DISPLAY = 99,
     OLED_HR_MEASURMENT = 2,
     OLED_HR_DISPLAY,
-    OLED_SHUTDOWN
+    OLED_SHUTDOWN,
+    OLED_NO_FINGER,
+    OLED_MOTION,
+    OLED_CLOCK_TICK,        /* Refresh the clock of the current screen, no state change */
+    OLED_WAKE,              /* Button press, restarts the idle timeout */
+    OLED_WAVE,              /* New waveform points, no state change */
+    OLED_BEAT,              /* Beat detected, pulses the heart icon */
+    OLED_CAPTURE            /* Framebuffer requested over the command link */
 };
 
 struct oled_queue_msg
@@ -35,6 +42,8 @@ struct oled_queue_msg
     enum oled_state new_state;
     uint8_t heart_rate;
     uint8_t sp02;
+    bool hr_uncertain;
+    uint16_t rmssd;     /* HRV in ms, 0 if not available */
 };
 
 //--------------------------------------------------------------------------------
@@ -44,6 +53,8 @@ bool oled_app_queue_add(struct oled_queue_msg *msg);
 
 bool oled_app_task_create(void);
 void oled_app_task(void* params);
+void oled_app_set_low_power(bool enable);
+bool oled_app_wake(void);
 
 //--------------------------------------------------------------------------------
 
@@ -0,0 +1,39 @@
+/**
+ *  @file   ramfunc.h
+ *  @brief  Hot code placement in SRAM.
+ *
+ *  Functions tagged RAMFUNC go to the .RamFunc input section, which the linker
+ *  scripts place in .data. The startup code copies them to SRAM together with
+ *  the initialized data, so they execute without flash wait states. Calls
+ *  between flash and SRAM are out of BL range and go through linker veneers.
+ */
+
+//--------------------------------------------------------------------------------
+
+#ifndef _RAMFUNC_H_
+#define _RAMFUNC_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//--------------------------------------------------------------------------------
+
+/* Defines */
+#ifndef CFG_RAMFUNC_EN
+#define CFG_RAMFUNC_EN              1
+#endif
+
+#if CFG_RAMFUNC_EN
+#define RAMFUNC                     __attribute__((section(".RamFunc"), noinline))
+#else
+#define RAMFUNC
+#endif
+
+//--------------------------------------------------------------------------------
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _RAMFUNC_H_ */
@@ -18,12 +18,33 @@ extern "C" {
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "stm32l1xx_hal.h"
+
 //--------------------------------------------------------------------------------
 
+/* Defines */
+#ifndef CFG_RTC_WAKEUP_S
+#define CFG_RTC_WAKEUP_S        1       /* Periodic wakeup interval, drives the watch face */
+#endif
+
+#ifndef CFG_RTC_DEFAULT_TIME
+#define CFG_RTC_DEFAULT_TIME    1591272000UL    /* 2020-06-04 12:00, used when the backup domain was lost */
+#endif
+
+/* Types */
+typedef void (*rtc_wakeup_cb_t)(void);
+
 //--------------------------------------------------------------------------------
 
 void rtc_init(void);
-void rtc_get_time(void);
+void rtc_get_time(RTC_TimeTypeDef *time, RTC_DateTypeDef *date);
+uint32_t rtc_get_timestamp(void);
+uint8_t rtc_get_seconds(void);
+uint32_t rtc_get_mono_us(void);
+void rtc_set_timestamp(uint32_t timestamp);
+void rtc_time_from_timestamp(uint32_t timestamp, RTC_TimeTypeDef *time, RTC_DateTypeDef *date);
+bool rtc_register_wakeup_callback(rtc_wakeup_cb_t cb);
+void rtc_wakeup_irq_handler(void);
 
 //--------------------------------------------------------------------------------
 
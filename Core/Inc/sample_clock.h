@@ -0,0 +1,53 @@
+/**
+ *  @file   sample_clock.h
+ *  @brief  Per-sample timestamps for FIFO batches.
+ */
+
+//--------------------------------------------------------------------------------
+
+#ifndef _SAMPLE_CLOCK_H_
+#define _SAMPLE_CLOCK_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//--------------------------------------------------------------------------------
+
+/* Includes */
+#include <stdint.h>
+#include <stdbool.h>
+
+//--------------------------------------------------------------------------------
+
+/* Types */
+struct sample_clock
+{
+    uint32_t last_us;       /* Newest sample of the previous batch */
+    uint32_t period_q8;     /* Estimated sample period, 1/256 us */
+    uint32_t nominal_q8;
+    uint8_t frac;           /* Sub-microsecond remainder of last_us */
+    bool synced;
+    uint32_t ref_us;        /* Start of the period measurement window */
+    uint32_t ref_steps;
+    uint8_t creep_shift;
+
+    uint32_t samples;
+    uint32_t dropped;       /* Overflowed in the sensor or missed in time */
+    uint16_t resyncs;
+};
+
+//--------------------------------------------------------------------------------
+
+void sample_clock_init(struct sample_clock *clk, uint16_t rate_hz);
+uint32_t sample_clock_batch(struct sample_clock *clk, uint32_t read_us, uint8_t n, uint8_t lost);
+uint32_t sample_clock_at(const struct sample_clock *clk, uint32_t first_us, uint8_t i);
+uint32_t sample_clock_period_us(const struct sample_clock *clk);
+
+//--------------------------------------------------------------------------------
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SAMPLE_CLOCK_H_ */
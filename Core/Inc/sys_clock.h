@@ -0,0 +1,65 @@
+/**
+ *  @file   sys_clock.h
+ *  @brief  System clock profiles, PLL on demand and MSI otherwise.
+ */
+
+//--------------------------------------------------------------------------------
+
+#ifndef _SYS_CLOCK_H_
+#define _SYS_CLOCK_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//--------------------------------------------------------------------------------
+
+/* Includes */
+#include <stdint.h>
+#include <stdbool.h>
+
+//--------------------------------------------------------------------------------
+
+/* Defines */
+#ifndef CFG_SYS_CLOCK_DYNAMIC_EN
+#define CFG_SYS_CLOCK_DYNAMIC_EN    1       /* 0 keeps the full profile all the time */
+#endif
+
+/* Types */
+enum sys_clock_profile
+{
+    SYS_CLOCK_LOW,          /* MSI 4.194 MHz, range 3 */
+    SYS_CLOCK_FULL          /* HSI PLL 32 MHz, range 1 */
+};
+
+enum sys_clock_event
+{
+    SYS_CLOCK_PRE_SWITCH,
+    SYS_CLOCK_POST_SWITCH
+};
+
+typedef void (*sys_clock_cb_t)(enum sys_clock_event evt);
+
+struct sys_clock_stats
+{
+    uint32_t switches;
+    uint32_t last_us;       /* Duration of the last switch */
+    uint32_t max_us;
+};
+
+//--------------------------------------------------------------------------------
+
+void sys_clock_init(void);
+bool sys_clock_register_callback(sys_clock_cb_t cb);
+void sys_clock_request(void);
+void sys_clock_release(void);
+enum sys_clock_profile sys_clock_get_profile(void);
+void sys_clock_get_stats(struct sys_clock_stats *stats);
+
+//--------------------------------------------------------------------------------
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SYS_CLOCK_H_ */
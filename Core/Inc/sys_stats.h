@@ -0,0 +1,47 @@
+/**
+ *  @file   sys_stats.h
+ *  @brief  Per-task CPU load and stack usage statistics.
+ */
+
+//--------------------------------------------------------------------------------
+
+#ifndef _SYS_STATS_H_
+#define _SYS_STATS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//--------------------------------------------------------------------------------
+
+/* Includes */
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Defines */
+#define SYS_STATS_TIMER_HZ          1000000     /* Run time counter rate */
+
+/* Types */
+enum sys_stats_boot
+{
+    SYS_STATS_BOOT_RTC,         /* Calendar running, includes the LSE start after a cold boot */
+    SYS_STATS_BOOT_SCHEDULER,   /* Peripherals and tasks created */
+    SYS_STATS_BOOT_PANEL,       /* Display controller configured */
+    SYS_STATS_BOOT_FRAME,       /* First frame on the panel */
+    SYS_STATS_BOOT_MARKS
+};
+
+//--------------------------------------------------------------------------------
+
+bool sys_stats_init(void);
+void sys_stats_timer_init(void);
+uint32_t sys_stats_timer_get(void);
+void sys_stats_boot_mark(enum sys_stats_boot mark);
+
+//--------------------------------------------------------------------------------
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SYS_STATS_H_ */
@@ -0,0 +1,42 @@
+/**
+ *  @file   text_fmt.h
+ *  @brief  Allocation free integer formatting for the display.
+ */
+
+//--------------------------------------------------------------------------------
+
+#ifndef _TEXT_FMT_H_
+#define _TEXT_FMT_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//--------------------------------------------------------------------------------
+
+/* Includes */
+#include <stdint.h>
+
+//--------------------------------------------------------------------------------
+
+/* Defines */
+#define TEXT_FMT_HHMMSS_LEN     9       /* "23:59:59" and the terminator */
+#define TEXT_FMT_DATE_LEN       11      /* "31/12/2099" and the terminator */
+
+//--------------------------------------------------------------------------------
+
+char *text_fmt_str(char *dst, const char *str);
+char *text_fmt_uint(char *dst, uint32_t val);
+char *text_fmt_u2(char *dst, uint8_t val);
+char *text_fmt_hhmm(char *dst, uint8_t hours, uint8_t minutes);
+char *text_fmt_hhmmss(char *dst, uint8_t hours, uint8_t minutes, uint8_t seconds);
+char *text_fmt_date(char *dst, uint8_t day, uint8_t month, uint8_t year);
+char *text_fmt_value(char *dst, const char *prefix, uint32_t val, const char *unit);
+
+//--------------------------------------------------------------------------------
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _TEXT_FMT_H_ */
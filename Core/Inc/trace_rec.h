@@ -0,0 +1,78 @@
+/**
+ *  @file   trace_rec.h
+ *  @brief  Scheduler and interrupt trace recorder.
+ *
+ *  Included from FreeRTOSConfig.h, keep it free of FreeRTOS includes.
+ */
+
+//--------------------------------------------------------------------------------
+
+#ifndef _TRACE_REC_H_
+#define _TRACE_REC_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//--------------------------------------------------------------------------------
+
+/* Includes */
+#include <stdint.h>
+#include <stdbool.h>
+
+//--------------------------------------------------------------------------------
+
+/* Defines */
+#ifndef CFG_TRACE_REC_EN
+#define CFG_TRACE_REC_EN            1
+#endif
+
+#if CFG_TRACE_REC_EN
+#define TRACE_ISR_ENTER()           trace_rec_event(TRACE_EV_ISR_ENTER, __get_IPSR(), 0)
+#define TRACE_ISR_EXIT()            trace_rec_event(TRACE_EV_ISR_EXIT, __get_IPSR(), 0)
+#define TRACE_SPAN_BEGIN(span)      trace_rec_event(TRACE_EV_SPAN_BEGIN, (span), 0)
+#define TRACE_SPAN_END(span)        trace_rec_event(TRACE_EV_SPAN_END, (span), 0)
+#else
+#define TRACE_ISR_ENTER()           do { } while (0)
+#define TRACE_ISR_EXIT()            do { } while (0)
+#define TRACE_SPAN_BEGIN(span)      do { } while (0)
+#define TRACE_SPAN_END(span)        do { } while (0)
+#endif
+
+/* Types */
+enum trace_rec_event_type
+{
+    TRACE_EV_TASK_SWITCH = 1,   /* id: task number */
+    TRACE_EV_QUEUE_SEND,        /* id: queue number, arg: items before the send */
+    TRACE_EV_QUEUE_SEND_FAILED,
+    TRACE_EV_QUEUE_RECEIVE,
+    TRACE_EV_QUEUE_BLOCK_SEND,
+    TRACE_EV_QUEUE_BLOCK_RECEIVE,
+    TRACE_EV_ISR_ENTER,         /* id: exception number */
+    TRACE_EV_ISR_EXIT,
+    TRACE_EV_SPAN_BEGIN,        /* id: enum trace_rec_span */
+    TRACE_EV_SPAN_END
+};
+
+enum trace_rec_span
+{
+    TRACE_SPAN_MAX30100_I2C = 1,
+    TRACE_SPAN_SSD1306_I2C,
+    TRACE_SPAN_HR_DSP,
+    TRACE_SPAN_OLED_DRAW
+};
+
+//--------------------------------------------------------------------------------
+
+bool trace_rec_init(void);
+void trace_rec_event(uint8_t type, uint8_t id, uint16_t arg);
+void trace_rec_task_switch(uint8_t task);
+void trace_rec_name_queue(void *queue, const char *name);
+
+//--------------------------------------------------------------------------------
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _TRACE_REC_H_ */
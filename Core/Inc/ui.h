@@ -18,12 +18,24 @@ extern "C" {
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "FreeRTOS.h"
+#include "task.h"
+
 //--------------------------------------------------------------------------------
 
+/* Defines */
+#define BUTTON_EVT_SHORT        (1UL << 0)
+#define BUTTON_EVT_LONG         (1UL << 1)
+#define BUTTON_EVT_DOUBLE       (1UL << 2)
+
 //--------------------------------------------------------------------------------
 
 void led_init(void);
 void led_change_state(bool state);
+void button_init(void);
+bool button_polling_readstate(void);
+void button_interrupt_init(void);
+bool button_subscribe(TaskHandle_t task, uint8_t shift);
 
 //--------------------------------------------------------------------------------
 
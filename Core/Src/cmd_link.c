@@ -0,0 +1,308 @@
+/**
+ *  @file   cmd_link.c
+ *  @brief  Binary command link over the debug UART.
+ *
+ *  Frames are COBS encoded and delimited by 0x00 on both sides, so they can
+ *  share the wire with text log lines (which never contain a zero byte):
+ *
+ *      0x00 | COBS(type | payload | CRC-16/CCITT-FALSE LE) | 0x00
+ *
+ *  Received frames are dispatched to the handler registered for their type.
+ *  Responses are encoded into one of two buffers while the other one is still
+ *  being sent by the UART TX DMA. debug_log lets a text line and a frame take
+ *  turns on the wire, neither is dropped because the other one is going out.
+ */
+
+//--------------------------------------------------------------------------------
+
+/* Includes */
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+#include "stream_buffer.h"
+
+#include "cmd_link.h"
+#include "debug_log.h"
+
+//--------------------------------------------------------------------------------
+
+/* Defines */
+#define CMD_LINK_PROTO_VERSION      1
+
+#define CMD_LINK_RX_MAX             64
+#define CMD_LINK_RX_STREAM_LEN      64
+#define CMD_LINK_HANDLERS_MAX       16
+
+#define CMD_LINK_RAW_MAX            (1 + CMD_LINK_PAYLOAD_MAX + 2)
+#define CMD_LINK_FRAME_MAX          (CMD_LINK_RAW_MAX + (CMD_LINK_RAW_MAX / 254) + 1 + 2)
+
+#define CMD_LINK_TASK_PRIORITY      (tskIDLE_PRIORITY + 2)
+
+//--------------------------------------------------------------------------------
+
+/* Static */
+struct cmd_link_handler
+{
+    uint8_t type;
+    cmd_link_handler_t handler;
+};
+
+struct cmd_link_context
+{
+    StreamBufferHandle_t rx_stream;
+    SemaphoreHandle_t tx_lock;
+
+    struct cmd_link_handler handlers[CMD_LINK_HANDLERS_MAX];
+    uint8_t handler_cnt;
+
+    uint8_t rx_frame[CMD_LINK_RX_MAX];
+    uint8_t rx_len;
+    bool rx_overflow;
+
+    uint8_t raw[CMD_LINK_RAW_MAX];
+    uint8_t tx_buf[2][CMD_LINK_FRAME_MAX];
+    uint8_t tx_sel;
+};
+
+static struct cmd_link_context ctx;
+
+//--------------------------------------------------------------------------------
+
+/* Static function declarations */
+static uint16_t crc16_ccitt(const uint8_t *data, size_t len);
+static size_t cobs_encode(const uint8_t *src, size_t len, uint8_t *dst);
+static size_t cobs_decode(uint8_t *buf, size_t len);
+static void cmd_link_rx_isr(uint8_t byte);
+static void cmd_link_process(void);
+static void cmd_link_ping(const uint8_t *payload, size_t len);
+static void cmd_link_task(void *params);
+
+//--------------------------------------------------------------------------------
+
+/* Static functions */
+static uint16_t crc16_ccitt(const uint8_t *data, size_t len)
+{
+    uint16_t crc = 0xFFFF;
+
+    while (len--)
+    {
+        crc ^= (uint16_t)(*data++) << 8;
+
+        for (uint8_t i = 0; i < 8; i++)
+        {
+            crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1);
+        }
+    }
+
+    return crc;
+}
+
+static size_t cobs_encode(const uint8_t *src, size_t len, uint8_t *dst)
+{
+    size_t code_pos = 0;
+    size_t out = 1;
+    uint8_t code = 1;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        if (src[i] == 0)
+        {
+            dst[code_pos] = code;
+            code_pos = out++;
+            code = 1;
+            continue;
+        }
+
+        dst[out++] = src[i];
+
+        if (++code == 0xFF)
+        {
+            dst[code_pos] = code;
+            code_pos = out++;
+            code = 1;
+        }
+    }
+
+    dst[code_pos] = code;
+
+    return out;
+}
+
+//  In place, returns the decoded length or 0 on a malformed frame
+static size_t cobs_decode(uint8_t *buf, size_t len)
+{
+    size_t in = 0;
+    size_t out = 0;
+
+    while (in < len)
+    {
+        uint8_t code = buf[in++];
+
+        if ((code == 0) || (in + code - 1 > len))
+        {
+            return 0;
+        }
+
+        for (uint8_t i = 1; i < code; i++)
+        {
+            buf[out++] = buf[in++];
+        }
+
+        if ((code != 0xFF) && (in < len))
+        {
+            buf[out++] = 0;
+        }
+    }
+
+    return out;
+}
+
+static void cmd_link_rx_isr(uint8_t byte)
+{
+    BaseType_t woken = pdFALSE;
+
+    xStreamBufferSendFromISR(ctx.rx_stream, &byte, 1, &woken);
+    portYIELD_FROM_ISR(woken);
+}
+
+static void cmd_link_process(void)
+{
+    size_t len = cobs_decode(ctx.rx_frame, ctx.rx_len);
+
+    if (len < 3)
+    {
+        return;
+    }
+
+    len -= 2;
+    if (crc16_ccitt(ctx.rx_frame, len) != (ctx.rx_frame[len] | (ctx.rx_frame[len + 1] << 8)))
+    {
+        return;
+    }
+
+    for (uint8_t i = 0; i < ctx.handler_cnt; i++)
+    {
+        if (ctx.handlers[i].type == ctx.rx_frame[0])
+        {
+            ctx.handlers[i].handler(&ctx.rx_frame[1], len - 1);
+            return;
+        }
+    }
+
+    cmd_link_send(CMD_LINK_RSP_ERROR, &ctx.rx_frame[0], 1);
+}
+
+static void cmd_link_ping(const uint8_t *payload, size_t len)
+{
+    uint8_t version = CMD_LINK_PROTO_VERSION;
+
+    cmd_link_send(CMD_LINK_PING | CMD_LINK_RSP, &version, sizeof(version));
+}
+
+static void cmd_link_task(void *params)
+{
+    uint8_t chunk[16];
+
+    debug_log_set_rx_callback(cmd_link_rx_isr);
+
+    while (1)
+    {
+        size_t n = xStreamBufferReceive(ctx.rx_stream, chunk, sizeof(chunk), portMAX_DELAY);
+
+        for (size_t i = 0; i < n; i++)
+        {
+            if (chunk[i] == 0)
+            {
+                if (ctx.rx_len && !ctx.rx_overflow)
+                {
+                    cmd_link_process();
+                }
+
+                ctx.rx_len = 0;
+                ctx.rx_overflow = false;
+            }
+            else if (ctx.rx_len < CMD_LINK_RX_MAX)
+            {
+                ctx.rx_frame[ctx.rx_len++] = chunk[i];
+            }
+            else
+            {
+                ctx.rx_overflow = true;
+            }
+        }
+    }
+}
+
+//--------------------------------------------------------------------------------
+
+/* Global functions */
+bool cmd_link_task_create(void)
+{
+    ctx.rx_stream = xStreamBufferCreate(CMD_LINK_RX_STREAM_LEN, 1);
+    ctx.tx_lock = xSemaphoreCreateMutex();
+
+    if ((ctx.rx_stream == NULL) || (ctx.tx_lock == NULL))
+    {
+        return false;
+    }
+
+    cmd_link_register(CMD_LINK_PING, cmd_link_ping);
+
+    if (xTaskCreate(cmd_link_task, "link", configMINIMAL_STACK_SIZE*2, NULL, CMD_LINK_TASK_PRIORITY, NULL) != pdPASS)
+    {
+        return false;
+    }
+
+    return true;
+}
+
+//  Handlers run in the link task
+bool cmd_link_register(uint8_t type, cmd_link_handler_t handler)
+{
+    if (ctx.handler_cnt >= CMD_LINK_HANDLERS_MAX)
+    {
+        return false;
+    }
+
+    ctx.handlers[ctx.handler_cnt].type = type;
+    ctx.handlers[ctx.handler_cnt].handler = handler;
+    ctx.handler_cnt++;
+
+    return true;
+}
+
+bool cmd_link_send(uint8_t type, const void *data, size_t len)
+{
+    bool ret;
+
+    if (len > CMD_LINK_PAYLOAD_MAX)
+    {
+        return false;
+    }
+
+    xSemaphoreTake(ctx.tx_lock, portMAX_DELAY);
+
+    ctx.raw[0] = type;
+    memcpy(&ctx.raw[1], data, len);
+
+    uint16_t crc = crc16_ccitt(ctx.raw, len + 1);
+    ctx.raw[len + 1] = crc & 0xFF;
+    ctx.raw[len + 2] = crc >> 8;
+
+    uint8_t *frame = ctx.tx_buf[ctx.tx_sel];
+    size_t n = cobs_encode(ctx.raw, len + 3, &frame[1]);
+
+    frame[0] = 0;
+    frame[n + 1] = 0;
+
+    ret = debug_log_write_dma(frame, n + 2);
+    ctx.tx_sel ^= 1;
+
+    xSemaphoreGive(ctx.tx_lock);
+
+    return ret;
+}
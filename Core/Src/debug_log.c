@@ -9,10 +9,18 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
 
 #include "stm32l1xx_hal.h"
 
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+
 #include "debug_log.h"
+#include "sys_clock.h"
+#include "metrics.h"
 
 //--------------------------------------------------------------------------------
 
@@ -21,6 +29,9 @@
 #define DEBUG_UART_PIN_TX   GPIO_PIN_2
 #define DEBUG_UART_PIN_RX   GPIO_PIN_3
 #define DEBUG_UARTx         USART2
+#define DEBUG_UART_DMA_TX   DMA1_Channel7
+
+#define DEBUG_UART_IRQ_PRIO 6
 
 //--------------------------------------------------------------------------------
 
@@ -28,6 +39,9 @@
 struct debug_log_context
 {
     UART_HandleTypeDef handle;
+    DMA_HandleTypeDef dma_tx;
+    SemaphoreHandle_t dma_done;                 /* Held by the transfer owning TX */
+    debug_log_rx_cb_t rx_cb;
 };
 
 static struct debug_log_context ctx;
@@ -35,11 +49,59 @@ static struct debug_log_context ctx;
 //--------------------------------------------------------------------------------
 
 /* Static function declarations */
+static void debug_log_clock_changed(enum sys_clock_event evt);
+static bool debug_log_tx_take(void);
+static void debug_log_tx_give(void);
 
 //--------------------------------------------------------------------------------
 
 /* Static functions */
 
+//  Bytes on the wire finish at the old baud rate, then only the divider is
+//  rewritten so RX and the TX DMA stay armed
+static void debug_log_clock_changed(enum sys_clock_event evt)
+{
+    if (evt == SYS_CLOCK_PRE_SWITCH)
+    {
+        while (((DEBUG_UART_DMA_TX->CCR & DMA_CCR_EN) && (DEBUG_UART_DMA_TX->CNDTR != 0)) ||
+                !__HAL_UART_GET_FLAG(&ctx.handle, UART_FLAG_TC))
+        {
+        }
+    }
+    else
+    {
+        ctx.handle.Instance->BRR = UART_BRR_SAMPLING16(HAL_RCC_GetPCLK1Freq(), ctx.handle.Init.BaudRate);
+    }
+}
+
+//  Waits for the UART in tasks, only tries from interrupts or with the scheduler suspended
+static bool debug_log_tx_take(void)
+{
+    if (__get_IPSR() != 0)
+    {
+        return xSemaphoreTakeFromISR(ctx.dma_done, NULL) == pdPASS;
+    }
+
+    if (xTaskGetSchedulerState() == taskSCHEDULER_SUSPENDED)
+    {
+        return xSemaphoreTake(ctx.dma_done, 0) == pdPASS;
+    }
+
+    return xSemaphoreTake(ctx.dma_done, portMAX_DELAY) == pdPASS;
+}
+
+static void debug_log_tx_give(void)
+{
+    if (__get_IPSR() != 0)
+    {
+        xSemaphoreGiveFromISR(ctx.dma_done, NULL);
+    }
+    else
+    {
+        xSemaphoreGive(ctx.dma_done);
+    }
+}
+
 //--------------------------------------------------------------------------------
 
 /* Global functions */
@@ -73,13 +135,49 @@ void debug_log_init(void)
     HAL_UART_Init(&ctx.handle);
     __HAL_UART_ENABLE(&ctx.handle);
 
+    /* TX DMA for binary bulk transfers */
+    __HAL_RCC_DMA1_CLK_ENABLE();
+
+    ctx.dma_tx.Instance = DEBUG_UART_DMA_TX;
+    ctx.dma_tx.Init.Direction = DMA_MEMORY_TO_PERIPH;
+    ctx.dma_tx.Init.PeriphInc = DMA_PINC_DISABLE;
+    ctx.dma_tx.Init.MemInc = DMA_MINC_ENABLE;
+    ctx.dma_tx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+    ctx.dma_tx.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+    ctx.dma_tx.Init.Mode = DMA_NORMAL;
+    ctx.dma_tx.Init.Priority = DMA_PRIORITY_LOW;
+
+    HAL_DMA_Init(&ctx.dma_tx);
+    __HAL_LINKDMA(&ctx.handle, hdmatx, ctx.dma_tx);
+
+    HAL_NVIC_SetPriority(DMA1_Channel7_IRQn, DEBUG_UART_IRQ_PRIO, 0);
+    HAL_NVIC_EnableIRQ(DMA1_Channel7_IRQn);
+    HAL_NVIC_SetPriority(USART2_IRQn, DEBUG_UART_IRQ_PRIO, 0);
+    HAL_NVIC_EnableIRQ(USART2_IRQn);
+
+    ctx.dma_done = xSemaphoreCreateBinary();
+    xSemaphoreGive(ctx.dma_done);
+
+    sys_clock_register_callback(debug_log_clock_changed);
 }
 
+//  Text and DMA frames take turns on the same semaphore, a line never cuts into a frame
 bool debug_log_send(const char data[], size_t len)
 {
-    return HAL_UART_Transmit(&ctx.handle, data, len, 0xFFFFFF) == HAL_OK ? true : false;
+    bool ret;
+
+    if (!debug_log_tx_take())
+    {
+        return false;
+    }
+
+    ret = HAL_UART_Transmit(&ctx.handle, (uint8_t *)data, len, 0xFFFFFF) == HAL_OK;
+    debug_log_tx_give();
+
+    return ret;
 }
 
+//  Text output waits for a frame in flight, it is dropped only from interrupts
 bool debug_log(const char format[], ...)
 {
     char buffer[64];
@@ -93,5 +191,72 @@ bool debug_log(const char format[], ...)
 
     va_end (args);
 
+    metrics_inc(ret ? METRICS_LOG_LINES : METRICS_LOG_DROPS);
+
     return ret;
 }
+
+//  Starts a DMA transfer once the previous one is done, data must stay valid until then
+bool debug_log_write_dma(const uint8_t data[], size_t len)
+{
+    xSemaphoreTake(ctx.dma_done, portMAX_DELAY);
+
+    if (HAL_UART_Transmit_DMA(&ctx.handle, (uint8_t *)data, len) != HAL_OK)
+    {
+        xSemaphoreGive(ctx.dma_done);
+        return false;
+    }
+
+    return true;
+}
+
+void debug_log_flush(void)
+{
+    xSemaphoreTake(ctx.dma_done, portMAX_DELAY);
+    xSemaphoreGive(ctx.dma_done);
+}
+
+//  The callback runs in interrupt context for every received byte
+void debug_log_set_rx_callback(debug_log_rx_cb_t cb)
+{
+    ctx.rx_cb = cb;
+    __HAL_UART_ENABLE_IT(&ctx.handle, UART_IT_RXNE);
+}
+
+//  RX is served here instead of by HAL_UART_Receive_IT, which takes the handle
+//  lock and could not be re-armed while a blocking transmit holds it. TX
+//  completion is left to the HAL.
+void debug_log_irq_handler(void)
+{
+    uint32_t sr = ctx.handle.Instance->SR;
+
+    if (sr & (USART_SR_RXNE | USART_SR_ORE | USART_SR_NE | USART_SR_FE | USART_SR_PE))
+    {
+        //  Reading DR after SR clears RXNE and the error flags, a framing
+        //  error byte is dropped and the frame CRC catches the gap
+        uint8_t byte = ctx.handle.Instance->DR;
+
+        if ((sr & USART_SR_RXNE) && !(sr & USART_SR_FE) && ctx.rx_cb)
+        {
+            ctx.rx_cb(byte);
+        }
+    }
+
+    HAL_UART_IRQHandler(&ctx.handle);
+}
+
+void debug_log_dma_irq_handler(void)
+{
+    HAL_DMA_IRQHandler(&ctx.dma_tx);
+}
+
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart)
+{
+    BaseType_t woken = pdFALSE;
+
+    if (huart == &ctx.handle)
+    {
+        xSemaphoreGiveFromISR(ctx.dma_done, &woken);
+        portYIELD_FROM_ISR(woken);
+    }
+}
@@ -0,0 +1,274 @@
+/**
+ *  @file   hr_acf.c
+ *  @brief  Autocorrelation heart rate estimator.
+ *
+ *  The filtered IR AC signal is decimated to 25 Hz and kept in a 5.12 s
+ *  sliding window. Twice a second the normalized autocorrelation is evaluated
+ *  over the lags of 37..187 BPM, the fundamental peak is picked and refined by
+ *  parabolic interpolation. Integer only, ~3.5k MACs per estimate.
+ */
+
+//--------------------------------------------------------------------------------
+
+/* Includes */
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "stm32l1xx_hal.h"
+
+#include "hr_acf.h"
+#include "ramfunc.h"
+
+//--------------------------------------------------------------------------------
+
+/* Defines */
+#ifndef CFG_HR_ACF_PROFILE
+#define CFG_HR_ACF_PROFILE      0
+#endif
+
+#define ACF_INPUT_HZ            100
+#define ACF_DECIMATION          4
+#define ACF_FS                  (ACF_INPUT_HZ / ACF_DECIMATION)
+#define ACF_LEN                 128     /* Power of two, ring index mask */
+#define ACF_HOP                 12      /* ~0.5 s between estimates */
+
+#define ACF_LAG_MIN             8       /* 187 BPM */
+#define ACF_LAG_MAX             40      /* 37 BPM */
+
+#define ACF_SAMPLE_LIMIT        2048    /* Keeps products below 2^22 */
+#define ACF_PEAK_RATIO          27      /* /32, fundamental vs. strongest peak */
+
+//--------------------------------------------------------------------------------
+
+/* Static */
+struct hr_acf_context
+{
+    int16_t ring[ACF_LEN];
+    uint8_t head;
+    uint8_t filled;
+    uint8_t hop;
+
+    int32_t dec_sum;
+    uint8_t dec_cnt;
+
+    int16_t win[ACF_LEN];
+    int32_t acf[ACF_LAG_MAX + 2];
+};
+
+static struct hr_acf_context ctx;
+
+//--------------------------------------------------------------------------------
+
+/* Static function declarations */
+static bool hr_acf_prepare(void);
+static void hr_acf_correlate(void);
+static bool hr_acf_pick(struct hr_acf_result *result);
+
+//--------------------------------------------------------------------------------
+
+/* Static functions */
+
+//  Linearizes the ring, removes the mean and scales the peak into [ACF_SAMPLE_LIMIT / 2, ACF_SAMPLE_LIMIT)
+static bool hr_acf_prepare(void)
+{
+    int32_t mean = 0;
+    int16_t peak = 0;
+    uint8_t shift = 0;
+    uint8_t up = 0;
+
+    for (uint16_t i = 0; i < ACF_LEN; i++)
+    {
+        ctx.win[i] = ctx.ring[(ctx.head + i) & (ACF_LEN - 1)];
+        mean += ctx.win[i];
+    }
+
+    mean /= ACF_LEN;
+
+    for (uint16_t i = 0; i < ACF_LEN; i++)
+    {
+        int32_t v = ctx.win[i] - mean;
+
+        if (v > INT16_MAX)
+        {
+            v = INT16_MAX;
+        }
+        else if (v < -INT16_MAX)
+        {
+            v = -INT16_MAX;
+        }
+
+        ctx.win[i] = v;
+        if (v < 0)
+        {
+            v = -v;
+        }
+        if (v > peak)
+        {
+            peak = v;
+        }
+    }
+
+    if (peak == 0)
+    {
+        return false;
+    }
+
+    while ((peak >> shift) >= ACF_SAMPLE_LIMIT)
+    {
+        shift++;
+    }
+
+    //  Small signals are scaled up too, r0 is reduced to Q15 and would lose them
+    while ((peak << (up + 1)) < ACF_SAMPLE_LIMIT)
+    {
+        up++;
+    }
+
+    if (shift || up)
+    {
+        for (uint16_t i = 0; i < ACF_LEN; i++)
+        {
+            ctx.win[i] = (ctx.win[i] >> shift) << up;
+        }
+    }
+
+    return true;
+}
+
+//  Unbiased autocorrelation normalized to lag 0, Q15
+RAMFUNC static void hr_acf_correlate(void)
+{
+    int32_t r0 = 0;
+
+    for (uint16_t i = 0; i < ACF_LEN; i++)
+    {
+        r0 += (int32_t)ctx.win[i] * ctx.win[i];
+    }
+
+    r0 >>= 15;
+
+    for (uint8_t lag = ACF_LAG_MIN - 1; lag <= ACF_LAG_MAX + 1; lag++)
+    {
+        int32_t r = 0;
+
+        for (uint16_t i = 0; i < ACF_LEN - lag; i++)
+        {
+            r += (int32_t)ctx.win[i] * ctx.win[i + lag];
+        }
+
+        r = (r / (ACF_LEN - lag)) * ACF_LEN;
+        ctx.acf[lag] = r0 ? (r / r0) : 0;
+    }
+}
+
+//  Smallest-lag peak close to the strongest one, so harmonics are not picked
+static bool hr_acf_pick(struct hr_acf_result *result)
+{
+    int32_t best = 0;
+    uint8_t lag = 0;
+
+    for (uint8_t l = ACF_LAG_MIN; l <= ACF_LAG_MAX; l++)
+    {
+        if ((ctx.acf[l] >= ctx.acf[l - 1]) && (ctx.acf[l] > ctx.acf[l + 1]) && (ctx.acf[l] > best))
+        {
+            best = ctx.acf[l];
+        }
+    }
+
+    if (best <= 0)
+    {
+        return false;
+    }
+
+    for (uint8_t l = ACF_LAG_MIN; l <= ACF_LAG_MAX; l++)
+    {
+        if ((ctx.acf[l] >= ctx.acf[l - 1]) && (ctx.acf[l] > ctx.acf[l + 1]) &&
+                (ctx.acf[l] * 32 >= best * ACF_PEAK_RATIO))
+        {
+            lag = l;
+            break;
+        }
+    }
+
+    int32_t a = ctx.acf[lag - 1];
+    int32_t b = ctx.acf[lag];
+    int32_t c = ctx.acf[lag + 1];
+    int32_t den = a - 2 * b + c;
+    int32_t delta = den ? (((a - c) * 128) / den) : 0;     /* Q8 */
+
+    if (delta > 128)
+    {
+        delta = 128;
+    }
+    else if (delta < -128)
+    {
+        delta = -128;
+    }
+
+    int32_t period = lag * 256 + delta;
+
+    result->bpm = (60 * ACF_FS * 256 + period / 2) / period;
+    result->confidence = (b > INT16_MAX) ? INT16_MAX : b;
+
+    return true;
+}
+
+//--------------------------------------------------------------------------------
+
+/* Global functions */
+void hr_acf_reset(void)
+{
+    memset(&ctx, 0, sizeof(ctx));
+}
+
+//  Feeds one AC sample at ACF_INPUT_HZ, returns true when a new estimate is ready
+bool hr_acf_add_sample(int16_t ac, struct hr_acf_result *result)
+{
+    ctx.dec_sum += ac;
+
+    if (++ctx.dec_cnt < ACF_DECIMATION)
+    {
+        return false;
+    }
+
+    ctx.ring[ctx.head] = ctx.dec_sum / ACF_DECIMATION;
+    ctx.head = (ctx.head + 1) & (ACF_LEN - 1);
+    ctx.dec_sum = 0;
+    ctx.dec_cnt = 0;
+
+    if (ctx.filled < ACF_LEN)
+    {
+        ctx.filled++;
+        return false;
+    }
+
+    if (++ctx.hop < ACF_HOP)
+    {
+        return false;
+    }
+
+    ctx.hop = 0;
+
+#if CFG_HR_ACF_PROFILE
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    uint32_t start = DWT->CYCCNT;
+#endif
+
+    bool valid = hr_acf_prepare();
+
+    if (valid)
+    {
+        hr_acf_correlate();
+        valid = hr_acf_pick(result);
+    }
+
+#if CFG_HR_ACF_PROFILE
+    result->cycles = DWT->CYCCNT - start;
+#else
+    result->cycles = 0;
+#endif
+
+    return valid;
+}
@@ -9,6 +9,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
+#include <stdlib.h>
 
 #include "stm32l1xx_hal.h"
 
@@ -24,6 +25,20 @@
 #include "max30100.h"
 #include "debug_log.h"
 #include "oled_app.h"
+#include "hr_sqi.h"
+#include "hr_acf.h"
+#include "hr_hrv.h"
+#include "hr_history.h"
+#include "hr_stream.h"
+#include "hr_wave.h"
+#include "rtc.h"
+#include "ui.h"
+#include "sample_clock.h"
+#include "sys_clock.h"
+#include "ramfunc.h"
+#include "trace_rec.h"
+#include "sys_stats.h"
+#include "metrics.h"
 
 //--------------------------------------------------------------------------------
 
@@ -43,16 +58,104 @@
 #define MINUTE_IN_MS        60000
 #define CFG_HR_MEAS_MS      20000
 
+#ifndef CFG_HR_ACF_CONF_MIN
+#define CFG_HR_ACF_CONF_MIN         16384   /* Q15, autocorrelation peak to trust */
+#endif
+
+#ifndef CFG_HR_FUSE_TOL_PCT
+#define CFG_HR_FUSE_TOL_PCT         10      /* Beat count vs. ACF agreement */
+#endif
+
+#ifndef CFG_HR_PRESENCE_POLL_MS
+#define CFG_HR_PRESENCE_POLL_MS     500     /* Finger presence polling period */
+#endif
+
+#ifndef CFG_HR_PRESENCE_SETTLE_MS
+#define CFG_HR_PRESENCE_SETTLE_MS   50      /* Sensor wake-up before a presence read */
+#endif
+
+#ifndef CFG_HR_PRESENCE_DC_MIN
+#define CFG_HR_PRESENCE_DC_MIN      2000    /* IR level at 4.4 mA with a finger on */
+#endif
+
+#ifndef CFG_HR_MONITOR_EN
+#define CFG_HR_MONITOR_EN           1
+#endif
+
+#ifndef CFG_HR_MONITOR_PERIOD_MIN
+#define CFG_HR_MONITOR_PERIOD_MIN   10      /* Background reading interval */
+#endif
+
+#ifndef CFG_HR_MONITOR_MAX_MS
+#define CFG_HR_MONITOR_MAX_MS       30000   /* Give up a background session */
+#endif
+
+#ifndef CFG_HR_MONITOR_STABLE_CNT
+#define CFG_HR_MONITOR_STABLE_CNT   3       /* Consistent ACF estimates to stop early */
+#endif
+
+#ifndef CFG_HR_MONITOR_STABLE_BPM
+#define CFG_HR_MONITOR_STABLE_BPM   3
+#endif
+
+#ifndef CFG_HR_SENSOR_UA
+#define CFG_HR_SENSOR_UA            9300    /* MAX30100 average supply, 2x 27.1 mA at 16 % duty */
+#endif
+
+#ifndef CFG_HR_STREAM_POLL_MS
+#define CFG_HR_STREAM_POLL_MS       5       /* FIFO drain period, 16 samples last 16 ms */
+#endif
+
+#define HR_FIFO_BURST               16
+#define HR_MEAS_RATE_HZ             100     /* SAMPLE_RATE_100 */
+#define HR_SQI_SETTLE_WINDOWS       2       /* Discarded while the DC estimator and FIR settle */
+
+#define HR_NOTIFY_MONITOR           (1UL << 0)
+#define HR_NOTIFY_STREAM            (1UL << 1)
+#define HR_NOTIFY_BUTTON_SHIFT      4
+#define HR_NOTIFY_BUTTON_SHORT      (BUTTON_EVT_SHORT << HR_NOTIFY_BUTTON_SHIFT)
+#define HR_NOTIFY_BUTTON_LONG       (BUTTON_EVT_LONG << HR_NOTIFY_BUTTON_SHIFT)
+#define HR_NOTIFY_BUTTON_DOUBLE     (BUTTON_EVT_DOUBLE << HR_NOTIFY_BUTTON_SHIFT)
+#define HR_NOTIFY_BUTTON_ANY        (HR_NOTIFY_BUTTON_SHORT | HR_NOTIFY_BUTTON_LONG | HR_NOTIFY_BUTTON_DOUBLE)
+
 //--------------------------------------------------------------------------------
 
 /* Static */
 struct hr_app_context
 {
+    TaskHandle_t task;
     bool start;
     TimerHandle_t bpm_timer;
     uint32_t beat_cnt;
     uint8_t bpm;
     bool was_first_callback;
+    bool bpm_new;
+    bool presence_poll;
+    bool disagree;
+    enum hr_sqi_status sqi;
+    uint8_t sqi_settle;
+    struct hr_acf_result acf;
+    struct sample_clock clock;
+    bool clock_held;
+    bool sensor_probed;
+
+    struct
+    {
+        bool request;
+        bool active;
+        bool blanked;       /* A measurement display was switched off for it */
+    } stream;
+
+    struct
+    {
+        bool active;
+        bool done;
+        bool abort;
+        uint8_t bpm;
+        uint8_t stable;
+        uint16_t elapsed_s;
+        TickType_t start;
+    } monitor;
 
     struct
     {
@@ -63,7 +166,7 @@ struct hr_app_context
         int16_t ir_ac_signal_prev;
         int16_t ir_ac_signal_min;
         int16_t ir_ac_signal_max;
-        int16_t ir_avg_estimated;
+        uint16_t ir_avg_estimated;
 
         bool positive_edge;
         bool negative_edge;
@@ -76,16 +179,30 @@ struct hr_app_context
 
 static struct hr_app_context ctx;
 
-static const uint16_t lowpass_fir_coeff[12] = {172, 321, 579, 927, 1360, 1858, 2390, 2916, 3391, 3768, 4012, 4096};
+//  Not const, so it is copied to SRAM next to the RAMFUNC filter
+static uint16_t lowpass_fir_coeff[12] = {172, 321, 579, 927, 1360, 1858, 2390, 2916, 3391, 3768, 4012, 4096};
 
 //--------------------------------------------------------------------------------
 
 /* Static function declarations */
 static bool check_for_beat(int32_t sample);
-static int16_t avg_dc_estimator(int32_t *p, uint16_t x);
+static uint16_t avg_dc_estimator(int32_t *p, uint16_t x);
 static int16_t lowpass_fir(int16_t din);
-static int32_t mul16(int16_t x, int16_t y);
 static void init_beat_ctx(void);
+static void hr_app_start_measurement(void);
+static void hr_app_measure(void);
+static void hr_app_handle_sqi(const struct hr_sqi_result *sqi);
+static bool hr_app_poll_presence(void);
+static uint8_t hr_app_fuse_bpm(uint8_t counted);
+static void hr_app_start_background(void);
+static void hr_app_monitor_update(const struct hr_acf_result *acf);
+static void hr_app_finish_background(void);
+static void hr_app_rtc_wakeup(void);
+static void hr_app_store_result(uint8_t bpm, enum hr_history_quality quality);
+static bool hr_app_stream_switch(bool ready);
+static void hr_app_hold_clock(bool hold);
+static void hr_app_probe_sensor(void);
+static void hr_app_stream_poll(void);
 
 static void hr_app_timer_callback(TimerHandle_t xTimer);
 
@@ -97,7 +214,7 @@ static void hr_app_timer_callback(TimerHandle_t xTimer);
 //  Heart Rate Monitor functions takes a sample value and the sample number
 //  Returns true if a beat is detected
 //  A running average of four samples is recommended for display on the screen.
-static bool check_for_beat(int32_t sample)
+RAMFUNC static bool check_for_beat(int32_t sample)
 {
     bool beat_detected = false;
 
@@ -105,8 +222,17 @@ static bool check_for_beat(int32_t sample)
     ctx.beats.ir_ac_signal_prev = ctx.beats.ir_ac_signal_curr;
 
     //  Process next data sample
+    //  Seeded with the first sample, so the estimator does not ramp up from zero
+    if (ctx.beats.ir_avg_reg == 0)
+    {
+        ctx.beats.ir_avg_reg = sample << 15;
+    }
+
     ctx.beats.ir_avg_estimated = avg_dc_estimator(&ctx.beats.ir_avg_reg, sample);
-    ctx.beats.ir_ac_signal_curr = lowpass_fir(sample - ctx.beats.ir_avg_estimated);
+
+    int32_t ac = sample - ctx.beats.ir_avg_estimated;
+
+    ctx.beats.ir_ac_signal_curr = lowpass_fir((ac > INT16_MAX) ? INT16_MAX : ((ac < INT16_MIN) ? INT16_MIN : ac));
 
     //  Detect positive zero crossing (rising edge)
     if ((ctx.beats.ir_ac_signal_prev < 0) & (ctx.beats.ir_ac_signal_curr >= 0))
@@ -152,14 +278,20 @@ static bool check_for_beat(int32_t sample)
 }
 
 //  Average DC Estimator
-static int16_t avg_dc_estimator(int32_t *p, uint16_t x)
+RAMFUNC static uint16_t avg_dc_estimator(int32_t *p, uint16_t x)
 {
   *p += ((((long) x << 15) - *p) >> 4);
   return (*p >> 15);
 }
 
+//  Integer multiplier, forced inline so the RAM filter does not call back into flash at -O0
+__STATIC_FORCEINLINE int32_t mul16(int16_t x, int16_t y)
+{
+  return((long)x * (long)y);
+}
+
 //  Low Pass FIR Filter
-static int16_t lowpass_fir(int16_t din)
+RAMFUNC static int16_t lowpass_fir(int16_t din)
 {
     ctx.beats.cbuf[ctx.beats.offset] = din;
 
@@ -176,12 +308,6 @@ static int16_t lowpass_fir(int16_t din)
   return(z >> 15);
 }
 
-//  Integer multiplier
-int32_t mul16(int16_t x, int16_t y)
-{
-  return((long)x * (long)y);
-}
-
 static void init_beat_ctx(void)
 {
     ctx.beats.ir_ac_max = 20;
@@ -193,10 +319,415 @@ static void init_beat_ctx(void)
     ctx.beats.negative_edge = 0;
     ctx.beats.ir_avg_reg = 0;
     ctx.beats.offset = 0;
+    memset(ctx.beats.cbuf, 0, sizeof(ctx.beats.cbuf));
+}
+
+static void hr_app_start_measurement(void)
+{
+    init_beat_ctx();
+    hr_sqi_reset();
+    ctx.sqi_settle = HR_SQI_SETTLE_WINDOWS;
+    hr_acf_reset();
+    hr_hrv_reset();
+    hr_wave_reset();
+    max30100_reset();
+//    max30100_set_mode(MODE_HR_ONLY);
+    max30100_set_mode(MODE_SPO2_HR);
+    max30100_set_sample_rate(SAMPLE_RATE_100);
+    max30100_set_leds(PULSE_WIDTH_1600_uS, LED_27_1, LED_27_1);
+    max30100_set_highres(true);
+    max30100_startup();
+    if (!ctx.monitor.active)
+    {
+        hr_app_start_timer();
+    }
+    ctx.beat_cnt = 0;
+    ctx.bpm = 0;
+    ctx.sqi = HR_SQI_GOOD;
+    ctx.presence_poll = false;
+    ctx.disagree = false;
+    ctx.acf.bpm = 0;
+    ctx.acf.confidence = 0;
+    sample_clock_init(&ctx.clock, HR_MEAS_RATE_HZ);
+
+    ctx.was_first_callback = false;
+}
+
+//  Drains the FIFO and runs the beat, ACF and SQI pipeline on every sample at its own timestamp
+static void hr_app_measure(void)
+{
+    uint16_t ir[HR_FIFO_BURST];
+    uint16_t red[HR_FIFO_BURST];
+    struct hr_sqi_result sqi;
+    struct hr_acf_result acf;
+    struct oled_queue_msg oled_msg;
+    bool wave = false;
+    bool beat = false;
+    uint8_t lost;
+
+    //  Stamped before the pointers are read, the newest sample is never later than this
+    uint32_t read_us = rtc_get_mono_us();
+    uint8_t n = max30100_read_fifo(ir, red, HR_FIFO_BURST, &lost);
+
+    if ((n == 0) && (lost == 0))
+    {
+        return;
+    }
+
+    uint32_t first_us = sample_clock_batch(&ctx.clock, read_us, n, lost);
+    uint32_t dsp_start = sys_stats_timer_get();
+
+    TRACE_SPAN_BEGIN(TRACE_SPAN_HR_DSP);
+    for (uint8_t i = 0; (i < n) && !ctx.presence_poll; i++)
+    {
+        if (check_for_beat(ir[i]))
+        {
+            ctx.beat_cnt++;
+            metrics_inc(METRICS_HR_BEATS);
+            hr_hrv_add_beat(sample_clock_at(&ctx.clock, first_us, i));
+            beat = true;
+        }
+
+        if (hr_acf_add_sample(ctx.beats.ir_ac_signal_curr, &acf))
+        {
+            ctx.acf = acf;
+
+            if (ctx.monitor.active)
+            {
+                hr_app_monitor_update(&acf);
+            }
+        }
+
+        if (hr_sqi_add_sample(ir[i], ctx.beats.ir_ac_signal_curr, &sqi))
+        {
+            if (ctx.sqi_settle)
+            {
+                ctx.sqi_settle--;
+            }
+            else
+            {
+                hr_app_handle_sqi(&sqi);
+            }
+        }
+
+        //  Background sessions run without the display
+        if (!ctx.monitor.active && hr_wave_push(ctx.beats.ir_ac_signal_curr))
+        {
+            wave = true;
+        }
+    }
+    TRACE_SPAN_END(TRACE_SPAN_HR_DSP);
+    metrics_hist_add(METRICS_HR_DSP_US, sys_stats_timer_get() - dsp_start);
+
+    if (wave)
+    {
+        oled_msg.new_state = OLED_WAVE;
+        oled_app_queue_add(&oled_msg);
+    }
+
+    if (beat && !ctx.monitor.active)
+    {
+        oled_msg.new_state = OLED_BEAT;
+        oled_app_queue_add(&oled_msg);
+    }
+}
+
+static void hr_app_handle_sqi(const struct hr_sqi_result *sqi)
+{
+    struct oled_queue_msg oled_msg;
+    enum hr_sqi_status prev = ctx.sqi;
+
+    ctx.sqi = sqi->status;
+
+    switch (sqi->status)
+    {
+    case HR_SQI_NO_FINGER:
+        if (ctx.monitor.active)
+        {
+            ctx.monitor.abort = true;
+            break;
+        }
+
+        LOG("No finger (DC: %d), presence polling", sqi->dc);
+        hr_app_stop_timer();
+        max30100_reset();
+        max30100_set_mode(MODE_HR_ONLY);
+        max30100_set_sample_rate(SAMPLE_RATE_50);
+        max30100_set_leds(PULSE_WIDTH_200_uS, LED_0, LED_4_4);
+        max30100_shutdown();
+        ctx.presence_poll = true;
+
+        oled_msg.new_state = OLED_NO_FINGER;
+        oled_app_queue_add(&oled_msg);
+        break;
+
+    case HR_SQI_MOTION:
+        if (ctx.monitor.active)
+        {
+            break;
+        }
+
+        //  Beats counted so far are unreliable, restart the window
+        ctx.beat_cnt = 0;
+        xTimerReset(ctx.bpm_timer, 0);
+
+        if (prev != HR_SQI_MOTION)
+        {
+            LOG("Motion (PI: %d, crossings: %d, clipped: %d)", sqi->perfusion, sqi->crossings, sqi->clipped);
+            oled_msg.new_state = OLED_MOTION;
+            oled_app_queue_add(&oled_msg);
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+//  Wakes the sensor at low LED current for a single read, true if a finger is on
+static bool hr_app_poll_presence(void)
+{
+    uint16_t ir, red;
+
+    max30100_startup();
+    max30100_clear_fifo();
+    vTaskDelay(CFG_HR_PRESENCE_SETTLE_MS);
+    max30100_read_sensor(&ir, &red);
+    max30100_shutdown();
+
+    return (ir >= CFG_HR_PRESENCE_DC_MIN);
+}
+
+//  Combines the beat count with the autocorrelation estimate of the same window
+static uint8_t hr_app_fuse_bpm(uint8_t counted)
+{
+    struct hr_acf_result acf = ctx.acf;
+    uint8_t tol;
+
+    if (acf.confidence < CFG_HR_ACF_CONF_MIN)
+    {
+        ctx.disagree = false;
+        return counted;
+    }
+
+    tol = (acf.bpm * CFG_HR_FUSE_TOL_PCT) / 100;
+    if (tol < 5)
+    {
+        tol = 5;
+    }
+
+    if (abs(counted - acf.bpm) <= tol)
+    {
+        ctx.disagree = false;
+        return (counted + acf.bpm + 1) / 2;
+    }
+
+    ctx.disagree = true;
+    LOG("HR disagreement! Count: %d BPM, ACF: %d BPM (conf %d)", counted, acf.bpm, acf.confidence);
+
+    return acf.bpm;
+}
+
+static void hr_app_start_background(void)
+{
+    LOG("Background HR session...");
+
+    ctx.monitor.active = true;
+    ctx.monitor.done = false;
+    ctx.monitor.abort = false;
+    ctx.monitor.stable = 0;
+    ctx.monitor.start = xTaskGetTickCount();
+
+    hr_app_start_measurement();
+}
+
+//  Early stopping: a few consecutive confident and consistent ACF estimates
+static void hr_app_monitor_update(const struct hr_acf_result *acf)
+{
+    if ((acf->confidence < CFG_HR_ACF_CONF_MIN) || (ctx.sqi != HR_SQI_GOOD))
+    {
+        ctx.monitor.stable = 0;
+        return;
+    }
+
+    if (ctx.monitor.stable && (abs(acf->bpm - ctx.monitor.bpm) > CFG_HR_MONITOR_STABLE_BPM))
+    {
+        ctx.monitor.stable = 0;
+    }
+
+    ctx.monitor.bpm = ctx.monitor.stable ? ((ctx.monitor.bpm + acf->bpm + 1) / 2) : acf->bpm;
+
+    if (++ctx.monitor.stable >= CFG_HR_MONITOR_STABLE_CNT)
+    {
+        ctx.monitor.done = true;
+    }
+}
+
+static void hr_app_finish_background(void)
+{
+    uint32_t duration_ms = (xTaskGetTickCount() - ctx.monitor.start) * portTICK_PERIOD_MS;
+    uint32_t charge_uas = (duration_ms * CFG_HR_SENSOR_UA) / 1000;
+
+    max30100_reset();
+    max30100_shutdown();
+    ctx.monitor.active = false;
+
+    if (ctx.monitor.done)
+    {
+        LOG("Background HR: %d BPM in %lu ms, sensor charge %lu uAs", ctx.monitor.bpm, duration_ms, charge_uas);
+        hr_app_store_result(ctx.monitor.bpm, HR_HISTORY_GOOD);
+    }
+    else
+    {
+        LOG("Background HR: no reading (%s) in %lu ms, sensor charge %lu uAs",
+                ctx.monitor.abort ? "no finger" : "timeout", duration_ms, charge_uas);
+    }
+}
+
+static void hr_app_store_result(uint8_t bpm, enum hr_history_quality quality)
+{
+    struct hr_history_record rec;
+
+    rec.timestamp = rtc_get_timestamp();
+    rec.bpm = bpm;
+    rec.spo2 = 0;
+    rec.quality = quality;
+
+    hr_history_append(&rec);
+}
+
+//  Enters or leaves raw streaming, returns the new measurement ready state
+static bool hr_app_stream_switch(bool ready)
+{
+    struct oled_queue_msg oled_msg;
+
+    if (ctx.stream.request == ctx.stream.active)
+    {
+        return ready;
+    }
+
+    ctx.stream.active = ctx.stream.request;
+
+    if (ctx.stream.active)
+    {
+        LOG("Raw streaming at %d Hz", HR_APP_STREAM_RATE);
+
+        if (ready)
+        {
+            //  Streaming takes the sensor over, drop any running measurement
+            hr_app_stop_timer();
+            ctx.monitor.active = false;
+            ctx.presence_poll = false;
+
+            oled_msg.new_state = OLED_OFF;
+            oled_app_queue_add(&oled_msg);
+            ctx.stream.blanked = true;
+        }
+
+        ctx.start = false;
+
+        max30100_reset();
+        max30100_set_mode(MODE_SPO2_HR);
+        max30100_set_sample_rate(SAMPLE_RATE_1000);
+        max30100_set_leds(PULSE_WIDTH_200_uS, LED_27_1, LED_27_1);
+        max30100_set_highres(false);
+        max30100_startup();
+        max30100_clear_fifo();
+
+        hr_stream_begin();
+    }
+    else
+    {
+        max30100_reset();
+        max30100_shutdown();
+
+        hr_stream_end();
+        ctx.start = false;
+        LOG("Raw streaming stopped");
+
+        //  Back to the watch face, a dark OLED_OFF panel does not wake on a press
+        if (ctx.stream.blanked)
+        {
+            oled_msg.new_state = OLED_TIME_DISPLAY;
+            oled_app_queue_add(&oled_msg);
+            ctx.stream.blanked = false;
+        }
+    }
+
+    return false;
+}
+
+static void hr_app_stream_poll(void)
+{
+    uint16_t ir[HR_FIFO_BURST];
+    uint16_t red[HR_FIFO_BURST];
+    uint8_t lost;
+    uint8_t n = max30100_read_fifo(ir, red, HR_FIFO_BURST, &lost);
+
+    if (n || lost)
+    {
+        hr_stream_push(ir, red, n, lost);
+    }
+}
+
+//  The sensor bus is only used in the full clock profile
+static void hr_app_hold_clock(bool hold)
+{
+    if (hold == ctx.clock_held)
+    {
+        return;
+    }
+
+    ctx.clock_held = hold;
+
+    if (hold)
+    {
+        sys_clock_request();
+    }
+    else
+    {
+        sys_clock_release();
+    }
+}
+
+//  Deferred to the first event that needs the sensor, so the boot frame does not wait for it
+static void hr_app_probe_sensor(void)
+{
+    if (ctx.sensor_probed)
+    {
+        return;
+    }
+
+    max30100_i2c_init();
+    max30100_reset();
+
+    uint8_t i2c_read = max30100_get_rev_id();
+    LOG("rev id: %#02x\n\r", i2c_read);
+    i2c_read = max30100_get_part_id();
+    LOG("part id: %#02x\n\r", i2c_read);
+
+    ctx.sensor_probed = true;
+}
+
+//  RTC wakeup interrupt context
+static void hr_app_rtc_wakeup(void)
+{
+    BaseType_t woken = pdFALSE;
+
+    ctx.monitor.elapsed_s += CFG_RTC_WAKEUP_S;
+
+    if (ctx.monitor.elapsed_s >= (CFG_HR_MONITOR_PERIOD_MIN * 60))
+    {
+        ctx.monitor.elapsed_s = 0;
+        xTaskNotifyFromISR(ctx.task, HR_NOTIFY_MONITOR, eSetBits, &woken);
+        portYIELD_FROM_ISR(woken);
+    }
 }
 
 static void hr_app_timer_callback(TimerHandle_t xTimer)
 {
+    struct hr_hrv_result hrv;
+
     /* Optionally do something if the pxTimer parameter is NULL. */
     configASSERT(xTimer);
 
@@ -205,10 +736,19 @@ static void hr_app_timer_callback(TimerHandle_t xTimer)
         ctx.was_first_callback = true;
     }
 
-    ctx.bpm = ctx.beat_cnt * (MINUTE_IN_MS / CFG_HR_MEAS_MS);
+    ctx.bpm = hr_app_fuse_bpm(ctx.beat_cnt * (MINUTE_IN_MS / CFG_HR_MEAS_MS));
     LOG("Beat timer elapsed! Beats: %d, HR: %d BPM", ctx.beat_cnt, ctx.bpm);
+    LOG("Samples: %lu, dropped %lu, period %lu us, resyncs %u", ctx.clock.samples, ctx.clock.dropped,
+            sample_clock_period_us(&ctx.clock), ctx.clock.resyncs);
+
+    if (hr_hrv_get(&hrv))
+    {
+        LOG("HRV: RMSSD %d ms, SDNN %d ms, pNN50 %d%% (%d IBIs, %d rejected)",
+                hrv.rmssd, hrv.sdnn, hrv.pnn50, hrv.ibi_cnt, hrv.rejected);
+    }
 
     ctx.beat_cnt = 0;
+    ctx.bpm_new = true;
 }
 
 //--------------------------------------------------------------------------------
@@ -217,11 +757,17 @@ static void hr_app_timer_callback(TimerHandle_t xTimer)
 
 bool hr_app_task_create(void)
 {
-    if (xTaskCreate(hr_app_task, "hr", configMINIMAL_STACK_SIZE*4, NULL, 4, NULL) != pdPASS)
+    if (xTaskCreate(hr_app_task, "hr", configMINIMAL_STACK_SIZE*4, NULL, 4, &ctx.task) != pdPASS)
     {
         return false;
     }
 
+    button_subscribe(ctx.task, HR_NOTIFY_BUTTON_SHIFT);
+
+#if CFG_HR_MONITOR_EN
+    rtc_register_wakeup_callback(hr_app_rtc_wakeup);
+#endif
+
     return true;
 }
 
@@ -229,56 +775,105 @@ void hr_app_task(void* params)
 {
     LOG("===> HR task started!\n\r");
     struct oled_queue_msg oled_msg;
-    uint16_t ir, red;
-    uint8_t meas_cnt;
+    struct hr_hrv_result hrv;
+    uint8_t meas_cnt = 0;
     uint8_t tick_cnt = 0;
     static struct oled_queue_msg bpm_msg;
+    uint32_t notify;
 
     bool ready = false;
     ctx.start = false;
 
     init_beat_ctx();
-    max30100_i2c_init();
-    max30100_reset();
-
-    /* MAX30100 */
-    uint8_t i2c_read = max30100_get_rev_id();
-    LOG("rev id: %#02x\n\r", i2c_read);
-    i2c_read = max30100_get_part_id();
-    LOG("part id: %#02x\n\r", i2c_read);
 
     while (1)
     {
-        if (ctx.start)
+        //  Nothing to sample, sleep until a button, monitor or stream event
+        notify = 0;
+        hr_app_hold_clock(ready || ctx.start || ctx.stream.active);
+        xTaskNotifyWait(0, UINT32_MAX, &notify, (ready || ctx.start || ctx.stream.active) ? 0 : portMAX_DELAY);
+        hr_app_hold_clock(true);
+        hr_app_probe_sensor();
+
+        if (notify & HR_NOTIFY_STREAM)
+        {
+            ready = hr_app_stream_switch(ready);
+        }
+
+        if (ctx.stream.active)
+        {
+            hr_app_stream_poll();
+            vTaskDelay(CFG_HR_STREAM_POLL_MS);
+            continue;
+        }
+
+        if ((notify & HR_NOTIFY_BUTTON_ANY) && oled_app_wake())
+        {
+            //  The press only switched the dark panel back on
+            notify &= ~HR_NOTIFY_BUTTON_ANY;
+        }
+
+        //  No gesture of its own yet, a double press toggles like a single one
+        if (notify & (HR_NOTIFY_BUTTON_SHORT | HR_NOTIFY_BUTTON_DOUBLE))
+        {
+            ctx.start ^= true;
+        }
+
+        if (notify & HR_NOTIFY_BUTTON_LONG)
+        {
+            ctx.start = false;
+        }
+
+        if ((notify & HR_NOTIFY_MONITOR) && !ready && !ctx.start)
+        {
+            hr_app_start_background();
+            ready = true;
+        }
+
+        if (ctx.start && ctx.monitor.active)
+        {
+            //  Button pressed during a background session, continue as a manual one
+            ctx.monitor.active = false;
+            ready = false;
+        }
+
+        if (ctx.start || ctx.monitor.active)
         {
             if (!ready)
             {
                 LOG("HR initialization...");
                 oled_msg.new_state = OLED_STARTUP;
                 oled_app_queue_add(&oled_msg);
-                vTaskDelay(2000);
 
-                init_beat_ctx();
-                max30100_reset();
-//                max30100_set_mode(MODE_HR_ONLY);
-                max30100_set_mode(MODE_SPO2_HR);
-                max30100_set_sample_rate(SAMPLE_RATE_100);
-                max30100_set_leds(PULSE_WIDTH_1600_uS, LED_27_1, LED_27_1);
-                max30100_set_highres(true);
+                //  Sampling starts right away, the first progress screen replaces the splash
+                hr_app_start_measurement();
                 ready = true;
-                hr_app_start_timer();
-                ctx.beat_cnt = 0;
-                ctx.bpm = 0;
-
-                ctx.was_first_callback = false;
                 meas_cnt = 0;
             }
 
-            max30100_read_sensor(&ir, &red);
-            if (check_for_beat(ir))
+            if (ctx.presence_poll)
             {
-//                LOG("beat!");
-                ctx.beat_cnt++;
+                if (hr_app_poll_presence())
+                {
+                    LOG("Finger detected, restarting measurement");
+                    hr_app_start_measurement();
+                    meas_cnt = 0;
+                }
+                else
+                {
+                    hr_app_hold_clock(false);
+                    vTaskDelay(CFG_HR_PRESENCE_POLL_MS - CFG_HR_PRESENCE_SETTLE_MS);
+                    continue;
+                }
+            }
+
+            hr_app_measure();
+
+            if (ctx.monitor.active && (ctx.monitor.done || ctx.monitor.abort ||
+                    ((xTaskGetTickCount() - ctx.monitor.start) * portTICK_PERIOD_MS >= CFG_HR_MONITOR_MAX_MS)))
+            {
+                hr_app_finish_background();
+                ready = false;
             }
         }
         else
@@ -293,15 +888,32 @@ void hr_app_task(void* params)
                 max30100_reset();
                 max30100_shutdown();
                 ready = false;
+                ctx.presence_poll = false;
 
                 vTaskDelay(2000);
 
-                oled_msg.new_state = OLED_OFF;
+                oled_msg.new_state = OLED_TIME_DISPLAY;
                 oled_app_queue_add(&oled_msg);
             }
         }
 
-        if (!ctx.was_first_callback && ready)
+        if (ctx.bpm_new)
+        {
+            //  Persisted from the task, the timer daemon stack is kept small
+            ctx.bpm_new = false;
+            hr_app_store_result(ctx.bpm, ctx.disagree ? HR_HISTORY_FAIR :
+                    ((ctx.sqi == HR_SQI_GOOD) ? HR_HISTORY_GOOD : HR_HISTORY_POOR));
+        }
+
+        if (!ready || ctx.monitor.active)
+        {
+            //  Background sessions run without the display
+        }
+        else if ((ctx.sqi == HR_SQI_MOTION) || ctx.presence_poll)
+        {
+            //  Keep the quality screen until the signal recovers
+        }
+        else if (!ctx.was_first_callback && ready)
         {
             if (meas_cnt%10 == 0)
             {
@@ -316,12 +928,15 @@ void hr_app_task(void* params)
             tick_cnt++;
         }
 
-        if (ready && (tick_cnt % 100 == 0) && ctx.was_first_callback)
+        if (ready && (tick_cnt % 100 == 0) && ctx.was_first_callback &&
+                (ctx.sqi != HR_SQI_MOTION) && !ctx.presence_poll)
         {
             tick_cnt = 0;
             bpm_msg.new_state = OLED_HR_DISPLAY;
             bpm_msg.heart_rate = ctx.bpm;
             bpm_msg.sp02 = 0;
+            bpm_msg.hr_uncertain = ctx.disagree;
+            bpm_msg.rmssd = hr_hrv_get(&hrv) ? hrv.rmssd : 0;
             oled_app_queue_add(&bpm_msg);
         }
 
@@ -329,9 +944,11 @@ void hr_app_task(void* params)
     }
 }
 
-void hr_app_switch_on_off(void)
+//  Requests raw streaming on or off, handled by the HR task
+void hr_app_stream(bool enable)
 {
-    ctx.start ^= true;
+    ctx.stream.request = enable;
+    xTaskNotify(ctx.task, HR_NOTIFY_STREAM, eSetBits);
 }
 
 bool hr_app_create_timer(void)
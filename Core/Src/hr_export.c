@@ -0,0 +1,158 @@
+/**
+ *  @file   hr_export.c
+ *  @brief  HR history export over the command link.
+ *
+ *  All fields are little endian.
+ *
+ *      HISTORY_INFO    -> { first u32, next u32, eeprom writes u32 }
+ *      HISTORY_READ    { start u32, count u32 }
+ *                      -> HISTORY_DATA { index u32, n u8, n * record } ...
+ *                      -> HISTORY_END { next u32 }
+ *
+ *      record          { timestamp u32, bpm u8, spo2 u8, quality u8 }
+ *
+ *  Indices are absolute and never reused, so an interrupted transfer is
+ *  resumed by reading again from the last index received + 1. Records already
+ *  overwritten are skipped, the index field of each chunk tells where it starts.
+ */
+
+//--------------------------------------------------------------------------------
+
+/* Includes */
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "hr_export.h"
+#include "hr_history.h"
+#include "cmd_link.h"
+
+//--------------------------------------------------------------------------------
+
+/* Defines */
+#define EXPORT_RECORD_SIZE      7
+#define EXPORT_CHUNK_HDR_SIZE   5
+#define EXPORT_CHUNK_RECORDS    ((CMD_LINK_PAYLOAD_MAX - EXPORT_CHUNK_HDR_SIZE) / EXPORT_RECORD_SIZE)
+
+//--------------------------------------------------------------------------------
+
+/* Static */
+struct hr_export_context
+{
+    uint8_t buf[EXPORT_CHUNK_HDR_SIZE + EXPORT_CHUNK_RECORDS * EXPORT_RECORD_SIZE];
+};
+
+static struct hr_export_context ctx;
+
+//--------------------------------------------------------------------------------
+
+/* Static function declarations */
+static void put_u32(uint8_t *buf, uint32_t val);
+static uint32_t get_u32(const uint8_t *buf);
+static void hr_export_info(const uint8_t *payload, size_t len);
+static void hr_export_read(const uint8_t *payload, size_t len);
+
+//--------------------------------------------------------------------------------
+
+/* Static functions */
+static void put_u32(uint8_t *buf, uint32_t val)
+{
+    buf[0] = val;
+    buf[1] = val >> 8;
+    buf[2] = val >> 16;
+    buf[3] = val >> 24;
+}
+
+static uint32_t get_u32(const uint8_t *buf)
+{
+    return buf[0] | (buf[1] << 8) | ((uint32_t)buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+static void hr_export_info(const uint8_t *payload, size_t len)
+{
+    uint8_t rsp[12];
+
+    put_u32(&rsp[0], hr_history_first_index());
+    put_u32(&rsp[4], hr_history_next_index());
+    put_u32(&rsp[8], hr_history_get_writes());
+
+    cmd_link_send(CMD_LINK_HISTORY_INFO | CMD_LINK_RSP, rsp, sizeof(rsp));
+}
+
+static void hr_export_read(const uint8_t *payload, size_t len)
+{
+    if (len < 8)
+    {
+        cmd_link_send(CMD_LINK_RSP_ERROR, (uint8_t[]){ CMD_LINK_HISTORY_READ }, 1);
+        return;
+    }
+
+    uint32_t index = get_u32(&payload[0]);
+    uint32_t count = get_u32(&payload[4]);
+    uint32_t first = hr_history_first_index();
+    uint32_t next = hr_history_next_index();
+
+    if (index < first)
+    {
+        index = first;
+    }
+    else if (index > next)
+    {
+        index = next;
+    }
+
+    uint32_t end = ((next - index) < count) ? next : (index + count);
+    uint8_t n = 0;
+
+    while (index < end)
+    {
+        struct hr_history_record rec;
+
+        //  The log may wrap under us, the reader then skips to the new oldest record
+        if (!hr_history_read(index, &rec))
+        {
+            index = hr_history_first_index();
+            if (n)
+            {
+                cmd_link_send(CMD_LINK_RSP_HISTORY_DATA, ctx.buf,
+                        EXPORT_CHUNK_HDR_SIZE + n * EXPORT_RECORD_SIZE);
+                n = 0;
+            }
+            continue;
+        }
+
+        if (n == 0)
+        {
+            put_u32(&ctx.buf[0], index);
+        }
+
+        uint8_t *out = &ctx.buf[EXPORT_CHUNK_HDR_SIZE + n * EXPORT_RECORD_SIZE];
+        put_u32(&out[0], rec.timestamp);
+        out[4] = rec.bpm;
+        out[5] = rec.spo2;
+        out[6] = rec.quality;
+
+        index++;
+        n++;
+        ctx.buf[4] = n;
+
+        if ((n == EXPORT_CHUNK_RECORDS) || (index == end))
+        {
+            cmd_link_send(CMD_LINK_RSP_HISTORY_DATA, ctx.buf,
+                    EXPORT_CHUNK_HDR_SIZE + n * EXPORT_RECORD_SIZE);
+            n = 0;
+        }
+    }
+
+    uint8_t rsp[4];
+    put_u32(rsp, index);
+    cmd_link_send(CMD_LINK_RSP_HISTORY_END, rsp, sizeof(rsp));
+}
+
+//--------------------------------------------------------------------------------
+
+/* Global functions */
+bool hr_export_init(void)
+{
+    return cmd_link_register(CMD_LINK_HISTORY_INFO, hr_export_info) &&
+            cmd_link_register(CMD_LINK_HISTORY_READ, hr_export_read);
+}
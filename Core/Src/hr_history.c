@@ -0,0 +1,419 @@
+/**
+ *  @file   hr_history.c
+ *  @brief  Persistent HR history log in the data EEPROM.
+ *
+ *  The EEPROM area is a ring of 256 B sectors written strictly in order, so
+ *  every word is rewritten once per lap (wear leveling without a mapping
+ *  table). A sector holds a 3-word header and 61 packed 32-bit records:
+ *
+ *      header[0]   magic (31..16) | generation (15..0)
+ *      header[1]   absolute index of the first record
+ *      header[2]   base timestamp, unix time
+ *
+ *      record      quality (31..30) | lap (29) | SpO2 (28..22) | BPM (21..14) |
+ *                  minutes flag (13) | time since the previous record (12..0)
+ *
+ *  The delta is in seconds up to 2.3 h and in whole minutes beyond, up to
+ *  5.7 days, so sparse manual readings still share a sector. Longer gaps
+ *  continue in the next sector with a new base time.
+ *
+ *  Slots are not erased on a new lap: a record is valid when its quality is
+ *  non zero and its lap bit matches the generation parity of the sector
+ *  header. The generation comes from the ring, the one of the previous sector
+ *  plus one on a wrap, never from the header being rewritten. Sector first
+ *  indices are cached in RAM, so append is O(1) and a lookup is a binary search
+ *  over the sectors plus a delta sum inside one sector.
+ *
+ *  The log is appended from the HR task and read from the command link task,
+ *  public functions are serialized with a mutex.
+ */
+
+//--------------------------------------------------------------------------------
+
+/* Includes */
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "stm32l1xx_hal.h"
+#include "FreeRTOS.h"
+#include "semphr.h"
+
+#include "hr_history.h"
+#include "sys_clock.h"
+#include "debug_log.h"
+
+//--------------------------------------------------------------------------------
+
+#ifndef CFG_HR_HISTORY_LOG_EN
+#define CFG_HR_HISTORY_LOG_EN 1
+#endif
+
+#if CFG_HR_HISTORY_LOG_EN
+#define LOG(fmt, ...)   debug_log("[HISTORY] " fmt, ##__VA_ARGS__)
+#else
+#define LOG(fmt, ...)   do { } while (0)
+#endif
+
+//--------------------------------------------------------------------------------
+
+/* Defines */
+#ifndef CFG_HR_HISTORY_SECTORS
+#define CFG_HR_HISTORY_SECTORS  56      /* 14 KB of the 16 KB data EEPROM */
+#endif
+
+#define HIST_BASE               FLASH_EEPROM_BASE
+#define HIST_SECTOR_WORDS       64
+#define HIST_HEADER_WORDS       3
+#define HIST_SLOTS              (HIST_SECTOR_WORDS - HIST_HEADER_WORDS)
+
+#define HIST_MAGIC              0x4853UL    /* Bumped with the minute deltas */
+#define HIST_INVALID            UINT32_MAX
+
+#define REC_DELTA_BITS          13
+#define REC_DELTA_MAX           ((1UL << REC_DELTA_BITS) - 1)
+#define REC_DELTA_MIN_FLAG      (1UL << REC_DELTA_BITS)
+#define REC_DELTA_MASK          (REC_DELTA_MIN_FLAG | REC_DELTA_MAX)
+#define REC_BPM_POS             14
+#define REC_SPO2_POS            22
+#define REC_LAP_POS             29
+#define REC_QUALITY_POS         30
+
+//--------------------------------------------------------------------------------
+
+/* Static */
+struct hr_history_context
+{
+    uint32_t first_index[CFG_HR_HISTORY_SECTORS];
+    int16_t head;           /* -1 while the store is empty */
+    uint8_t head_cnt;
+    uint16_t head_gen;
+    uint32_t last_time;
+    uint32_t writes;
+    SemaphoreHandle_t lock;
+};
+
+static struct hr_history_context ctx;
+
+//--------------------------------------------------------------------------------
+
+/* Static function declarations */
+static uint32_t eeprom_read(uint16_t sector, uint8_t word);
+static void eeprom_write(uint16_t sector, uint8_t word, uint32_t data);
+static bool hist_slot_valid(uint32_t rec, uint16_t gen);
+static uint32_t hist_delta_decode(uint32_t rec);
+static uint32_t hist_delta_encode(uint32_t delta);
+static uint8_t hist_sector_count(uint16_t sector);
+static uint16_t hist_oldest(void);
+static uint16_t hist_find(uint32_t index);
+static void hist_open_sector(uint16_t sector, uint16_t gen, uint32_t first_index, uint32_t base_time);
+static uint32_t hist_first_index(void);
+static uint32_t hist_next_index(void);
+static bool hist_read(uint32_t index, struct hr_history_record *rec);
+
+//--------------------------------------------------------------------------------
+
+/* Static functions */
+static uint32_t eeprom_read(uint16_t sector, uint8_t word)
+{
+    return *(volatile uint32_t *)(HIST_BASE + (sector * HIST_SECTOR_WORDS + word) * 4);
+}
+
+//  Programmed in the full clock profile, the low one drops the core to range 3
+static void eeprom_write(uint16_t sector, uint8_t word, uint32_t data)
+{
+    sys_clock_request();
+    HAL_FLASHEx_DATAEEPROM_Unlock();
+    HAL_FLASHEx_DATAEEPROM_Program(FLASH_TYPEPROGRAMDATA_WORD,
+            HIST_BASE + (sector * HIST_SECTOR_WORDS + word) * 4, data);
+    HAL_FLASHEx_DATAEEPROM_Lock();
+    sys_clock_release();
+
+    ctx.writes++;
+}
+
+static bool hist_slot_valid(uint32_t rec, uint16_t gen)
+{
+    return ((rec >> REC_QUALITY_POS) != 0) && (((rec >> REC_LAP_POS) & 1) == (gen & 1));
+}
+
+static uint32_t hist_delta_decode(uint32_t rec)
+{
+    return (rec & REC_DELTA_MIN_FLAG) ? ((rec & REC_DELTA_MAX) * 60) : (rec & REC_DELTA_MAX);
+}
+
+//  Delta field rounded to the minute past REC_DELTA_MAX seconds, HIST_INVALID if it does not fit
+static uint32_t hist_delta_encode(uint32_t delta)
+{
+    if (delta <= REC_DELTA_MAX)
+    {
+        return delta;
+    }
+
+    delta = (delta + 30) / 60;
+
+    return (delta <= REC_DELTA_MAX) ? (REC_DELTA_MIN_FLAG | delta) : HIST_INVALID;
+}
+
+static uint8_t hist_sector_count(uint16_t sector)
+{
+    if (sector == ctx.head)
+    {
+        return ctx.head_cnt;
+    }
+
+    //  Sectors are written in ring order, the next one is always valid
+    return ctx.first_index[(sector + 1) % CFG_HR_HISTORY_SECTORS] - ctx.first_index[sector];
+}
+
+static uint16_t hist_oldest(void)
+{
+    uint16_t sector = (ctx.head + 1) % CFG_HR_HISTORY_SECTORS;
+
+    while (ctx.first_index[sector] == HIST_INVALID)
+    {
+        sector = (sector + 1) % CFG_HR_HISTORY_SECTORS;
+    }
+
+    return sector;
+}
+
+//  Binary search over the valid sectors in ring order
+static uint16_t hist_find(uint32_t index)
+{
+    uint16_t oldest = hist_oldest();
+    uint16_t lo = 0;
+    uint16_t hi = (ctx.head - oldest + CFG_HR_HISTORY_SECTORS) % CFG_HR_HISTORY_SECTORS;
+
+    while (lo < hi)
+    {
+        uint16_t mid = (lo + hi + 1) / 2;
+
+        if (ctx.first_index[(oldest + mid) % CFG_HR_HISTORY_SECTORS] <= index)
+        {
+            lo = mid;
+        }
+        else
+        {
+            hi = mid - 1;
+        }
+    }
+
+    return (oldest + lo) % CFG_HR_HISTORY_SECTORS;
+}
+
+//  gen is the lap of the ring, a power loss before the commit reopens the sector with the same one
+static void hist_open_sector(uint16_t sector, uint16_t gen, uint32_t first_index, uint32_t base_time)
+{
+    bool ours = (eeprom_read(sector, 0) >> 16) == HIST_MAGIC;
+
+    //  Invalidate first, the magic is written last to commit the header
+    eeprom_write(sector, 0, 0);
+
+    //  Slots of another format or of an interrupted open can match any lap parity
+    if (!ours)
+    {
+        for (uint8_t i = 0; i < HIST_SLOTS; i++)
+        {
+            if (eeprom_read(sector, HIST_HEADER_WORDS + i) != 0)
+            {
+                eeprom_write(sector, HIST_HEADER_WORDS + i, 0);
+            }
+        }
+    }
+
+    eeprom_write(sector, 1, first_index);
+    eeprom_write(sector, 2, base_time);
+    eeprom_write(sector, 0, (HIST_MAGIC << 16) | gen);
+
+    ctx.first_index[sector] = first_index;
+    ctx.head = sector;
+    ctx.head_cnt = 0;
+    ctx.head_gen = gen;
+    ctx.last_time = base_time;
+}
+
+static uint32_t hist_first_index(void)
+{
+    return (ctx.head < 0) ? 0 : ctx.first_index[hist_oldest()];
+}
+
+static uint32_t hist_next_index(void)
+{
+    return (ctx.head < 0) ? 0 : (ctx.first_index[ctx.head] + ctx.head_cnt);
+}
+
+static bool hist_read(uint32_t index, struct hr_history_record *rec)
+{
+    if ((index < hist_first_index()) || (index >= hist_next_index()))
+    {
+        return false;
+    }
+
+    uint16_t sector = hist_find(index);
+    uint8_t slot = index - ctx.first_index[sector];
+    uint32_t word = 0;
+
+    if (slot >= hist_sector_count(sector))
+    {
+        return false;
+    }
+
+    rec->timestamp = eeprom_read(sector, 2);
+
+    for (uint8_t i = 0; i <= slot; i++)
+    {
+        word = eeprom_read(sector, HIST_HEADER_WORDS + i);
+        rec->timestamp += hist_delta_decode(word);
+    }
+
+    rec->bpm = (word >> REC_BPM_POS) & 0xFF;
+    rec->spo2 = (word >> REC_SPO2_POS) & 0x7F;
+    rec->quality = (enum hr_history_quality)(word >> REC_QUALITY_POS);
+
+    return true;
+}
+
+//--------------------------------------------------------------------------------
+
+/* Global functions */
+void hr_history_init(void)
+{
+    uint32_t newest = 0;
+
+    ctx.lock = xSemaphoreCreateMutex();
+    ctx.head = -1;
+    ctx.head_cnt = 0;
+
+    for (uint16_t s = 0; s < CFG_HR_HISTORY_SECTORS; s++)
+    {
+        if ((eeprom_read(s, 0) >> 16) != HIST_MAGIC)
+        {
+            ctx.first_index[s] = HIST_INVALID;
+            continue;
+        }
+
+        ctx.first_index[s] = eeprom_read(s, 1);
+
+        if ((ctx.head < 0) || (ctx.first_index[s] >= newest))
+        {
+            newest = ctx.first_index[s];
+            ctx.head = s;
+        }
+    }
+
+    if (ctx.head < 0)
+    {
+        LOG("Empty store\n\r");
+        return;
+    }
+
+    ctx.head_gen = eeprom_read(ctx.head, 0) & 0xFFFF;
+    ctx.last_time = eeprom_read(ctx.head, 2);
+
+    while (ctx.head_cnt < HIST_SLOTS)
+    {
+        uint32_t rec = eeprom_read(ctx.head, HIST_HEADER_WORDS + ctx.head_cnt);
+
+        if (!hist_slot_valid(rec, ctx.head_gen))
+        {
+            break;
+        }
+
+        ctx.last_time += hist_delta_decode(rec);
+        ctx.head_cnt++;
+    }
+
+    LOG("%lu records, next index %lu\n\r", hist_next_index() - hist_first_index(), hist_next_index());
+}
+
+bool hr_history_append(const struct hr_history_record *rec)
+{
+    xSemaphoreTake(ctx.lock, portMAX_DELAY);
+
+    uint32_t delta = hist_delta_encode(rec->timestamp - ctx.last_time);
+
+    if (ctx.head < 0)
+    {
+        hist_open_sector(0, 1, 0, rec->timestamp);
+        delta = 0;
+    }
+    else if ((ctx.head_cnt == HIST_SLOTS) || (rec->timestamp < ctx.last_time) || (delta == HIST_INVALID))
+    {
+        //  Full, or the delta does not fit: continue in the next sector with a new base
+        uint16_t next = (ctx.head + 1) % CFG_HR_HISTORY_SECTORS;
+
+        hist_open_sector(next, ctx.head_gen + ((next == 0) ? 1 : 0),
+                ctx.first_index[ctx.head] + ctx.head_cnt, rec->timestamp);
+        delta = 0;
+    }
+
+    uint32_t word = ((uint32_t)(rec->quality & 0x03) << REC_QUALITY_POS) |
+            ((uint32_t)(ctx.head_gen & 1) << REC_LAP_POS) |
+            ((uint32_t)(rec->spo2 & 0x7F) << REC_SPO2_POS) |
+            ((uint32_t)rec->bpm << REC_BPM_POS) |
+            delta;
+
+    eeprom_write(ctx.head, HIST_HEADER_WORDS + ctx.head_cnt, word);
+
+    //  What a read gives back, a minute delta is rounded
+    ctx.head_cnt++;
+    ctx.last_time += hist_delta_decode(word);
+
+    xSemaphoreGive(ctx.lock);
+
+    return true;
+}
+
+uint32_t hr_history_first_index(void)
+{
+    xSemaphoreTake(ctx.lock, portMAX_DELAY);
+    uint32_t index = hist_first_index();
+    xSemaphoreGive(ctx.lock);
+
+    return index;
+}
+
+uint32_t hr_history_next_index(void)
+{
+    xSemaphoreTake(ctx.lock, portMAX_DELAY);
+    uint32_t index = hist_next_index();
+    xSemaphoreGive(ctx.lock);
+
+    return index;
+}
+
+//  Reads a record by absolute index
+bool hr_history_read(uint32_t index, struct hr_history_record *rec)
+{
+    xSemaphoreTake(ctx.lock, portMAX_DELAY);
+    bool ret = hist_read(index, rec);
+    xSemaphoreGive(ctx.lock);
+
+    return ret;
+}
+
+//  Reads the n-th newest record, n = 0 is the last one appended
+bool hr_history_read_last(uint32_t n, struct hr_history_record *rec)
+{
+    bool ret = false;
+
+    xSemaphoreTake(ctx.lock, portMAX_DELAY);
+
+    uint32_t next = hist_next_index();
+
+    if (n < next)
+    {
+        ret = hist_read(next - 1 - n, rec);
+    }
+
+    xSemaphoreGive(ctx.lock);
+
+    return ret;
+}
+
+//  EEPROM word writes since boot
+uint32_t hr_history_get_writes(void)
+{
+    return ctx.writes;
+}
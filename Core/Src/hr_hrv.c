@@ -0,0 +1,247 @@
+/**
+ *  @file   hr_hrv.c
+ *  @brief  Incremental heart rate variability metrics.
+ *
+ *  Inter-beat intervals are kept in a fixed ring together with the successive
+ *  difference each one produced. Running sums are updated when an IBI enters
+ *  or leaves the ring, so every beat costs O(1) and RMSSD, SDNN and pNN50 only
+ *  need an integer square root when read.
+ *
+ *  An IBI off a slow average of the recent in-range IBIs is rejected as an
+ *  artefact. Rejected IBIs still move the average, so after a lasting rate
+ *  change the new rhythm is accepted again within a few beats.
+ */
+
+//--------------------------------------------------------------------------------
+
+/* Includes */
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "hr_hrv.h"
+
+//--------------------------------------------------------------------------------
+
+/* Defines */
+#ifndef CFG_HR_HRV_LEN
+#define CFG_HR_HRV_LEN          32
+#endif
+
+#define HRV_IBI_MIN_MS          300     /* 200 BPM */
+#define HRV_IBI_MAX_MS          2000    /* 30 BPM */
+#define HRV_OUTLIER_DIV         4       /* Reject IBIs off the reference by > 25 % */
+#define HRV_OUTLIER_MIN_CNT     4       /* In-range IBIs averaged before rejecting */
+#define HRV_REF_SHIFT           3       /* Reference gain, 1/8 per in-range IBI */
+#define HRV_NN50_MS             50
+
+#define HRV_NO_DIFF             INT16_MIN
+
+//--------------------------------------------------------------------------------
+
+/* Static */
+struct hr_hrv_context
+{
+    uint16_t ibi[CFG_HR_HRV_LEN];
+    int16_t diff[CFG_HR_HRV_LEN];
+    uint8_t head;
+    uint8_t cnt;
+
+    uint32_t sum;
+    uint32_t sum_sq;
+    uint32_t diff_sq;
+    uint8_t diff_cnt;
+    uint8_t nn50;
+
+    uint32_t last_beat;     /* us */
+    uint16_t last_ibi;
+    bool has_beat;
+    bool chained;
+    uint16_t rejected;
+
+    uint32_t ref_q4;        /* Average of in-range IBIs, 1/16 ms */
+    uint8_t ref_cnt;
+};
+
+static struct hr_hrv_context ctx;
+
+//--------------------------------------------------------------------------------
+
+/* Static function declarations */
+static uint32_t isqrt(uint32_t x);
+static void hr_hrv_drop_oldest(void);
+
+//--------------------------------------------------------------------------------
+
+/* Static functions */
+static uint32_t isqrt(uint32_t x)
+{
+    uint32_t res = 0;
+    uint32_t bit = 1UL << 30;
+
+    while (bit > x)
+    {
+        bit >>= 2;
+    }
+
+    while (bit)
+    {
+        if (x >= res + bit)
+        {
+            x -= res + bit;
+            res = (res >> 1) + bit;
+        }
+        else
+        {
+            res >>= 1;
+        }
+        bit >>= 2;
+    }
+
+    return res;
+}
+
+static void hr_hrv_drop_oldest(void)
+{
+    uint16_t ibi = ctx.ibi[ctx.head];
+    int16_t diff = ctx.diff[ctx.head];
+
+    ctx.sum -= ibi;
+    ctx.sum_sq -= (uint32_t)ibi * ibi;
+    ctx.cnt--;
+
+    if (diff != HRV_NO_DIFF)
+    {
+        ctx.diff_sq -= (int32_t)diff * diff;
+        ctx.diff_cnt--;
+
+        if ((diff > HRV_NN50_MS) || (diff < -HRV_NN50_MS))
+        {
+            ctx.nn50--;
+        }
+    }
+}
+
+//--------------------------------------------------------------------------------
+
+/* Global functions */
+void hr_hrv_reset(void)
+{
+    memset(&ctx, 0, sizeof(ctx));
+}
+
+//  Registers a beat by its sample timestamp, returns true if the IBI ending on it was accepted.
+//  The IBI is rounded to ms after the difference, so the us timebase may wrap.
+bool hr_hrv_add_beat(uint32_t timestamp_us)
+{
+    uint32_t ibi = (timestamp_us - ctx.last_beat + 500) / 1000;
+    bool has_beat = ctx.has_beat;
+
+    ctx.last_beat = timestamp_us;
+    ctx.has_beat = true;
+
+    if (!has_beat)
+    {
+        return false;
+    }
+
+    //  Artefact rejection: physiological range, then distance from the reference
+    bool outlier = (ibi < HRV_IBI_MIN_MS) || (ibi > HRV_IBI_MAX_MS);
+
+    if (!outlier)
+    {
+        uint32_t ref = ctx.ref_q4 >> 4;
+
+        outlier = (ctx.ref_cnt >= HRV_OUTLIER_MIN_CNT) &&
+                ((uint32_t)abs((int32_t)ibi - (int32_t)ref) * HRV_OUTLIER_DIV > ref);
+
+        //  Follows rejected IBIs too, or a rate change would be rejected forever
+        if (ctx.ref_cnt == 0)
+        {
+            ctx.ref_q4 = ibi << 4;
+        }
+        else
+        {
+            ctx.ref_q4 += ((int32_t)(ibi << 4) - (int32_t)ctx.ref_q4) >> HRV_REF_SHIFT;
+        }
+
+        if (ctx.ref_cnt < HRV_OUTLIER_MIN_CNT)
+        {
+            ctx.ref_cnt++;
+        }
+    }
+
+    if (outlier)
+    {
+        ctx.rejected++;
+        ctx.chained = false;
+        return false;
+    }
+
+    if (ctx.cnt == CFG_HR_HRV_LEN)
+    {
+        hr_hrv_drop_oldest();
+    }
+
+    int16_t diff = ctx.chained ? (int16_t)(ibi - ctx.last_ibi) : HRV_NO_DIFF;
+
+    ctx.ibi[ctx.head] = ibi;
+    ctx.diff[ctx.head] = diff;
+    ctx.head = (ctx.head + 1) % CFG_HR_HRV_LEN;
+    ctx.cnt++;
+
+    ctx.sum += ibi;
+    ctx.sum_sq += ibi * ibi;
+
+    if (diff != HRV_NO_DIFF)
+    {
+        ctx.diff_sq += (int32_t)diff * diff;
+        ctx.diff_cnt++;
+
+        if ((diff > HRV_NN50_MS) || (diff < -HRV_NN50_MS))
+        {
+            ctx.nn50++;
+        }
+    }
+
+    ctx.last_ibi = ibi;
+    ctx.chained = true;
+
+    return true;
+}
+
+bool hr_hrv_get(struct hr_hrv_result *result)
+{
+    uint32_t sum, sum_sq, diff_sq;
+    uint8_t cnt, diff_cnt, nn50;
+
+    //  Snapshot, the sums are updated from the HR task
+    taskENTER_CRITICAL();
+    sum = ctx.sum;
+    sum_sq = ctx.sum_sq;
+    diff_sq = ctx.diff_sq;
+    cnt = ctx.cnt;
+    diff_cnt = ctx.diff_cnt;
+    nn50 = ctx.nn50;
+    result->rejected = ctx.rejected;
+    taskEXIT_CRITICAL();
+
+    result->ibi_cnt = cnt;
+
+    if ((cnt < 2) || (diff_cnt == 0))
+    {
+        return false;
+    }
+
+    uint64_t var = ((uint64_t)sum_sq * cnt - (uint64_t)sum * sum) / ((uint32_t)cnt * cnt);
+
+    result->sdnn = isqrt((uint32_t)var);
+    result->rmssd = isqrt(diff_sq / diff_cnt);
+    result->pnn50 = (nn50 * 100U) / diff_cnt;
+
+    return true;
+}
@@ -0,0 +1,149 @@
+/**
+ *  @file   hr_sqi.c
+ *  @brief  Signal quality index of the IR PPG channel.
+ *
+ *  Every CFG_HR_SQI_WINDOW samples the window statistics (DC level, perfusion
+ *  index, periodicity and clipping) are classified, so a missing finger or
+ *  heavy motion is known after about one second instead of a full measurement.
+ */
+
+//--------------------------------------------------------------------------------
+
+/* Includes */
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "hr_sqi.h"
+
+//--------------------------------------------------------------------------------
+
+/* Defines */
+#ifndef CFG_HR_SQI_DC_MIN
+#define CFG_HR_SQI_DC_MIN           10000   /* Below this nothing reflects the LED */
+#endif
+
+#ifndef CFG_HR_SQI_CLIP_LEVEL
+#define CFG_HR_SQI_CLIP_LEVEL       65000   /* 16-bit high resolution mode */
+#endif
+
+#ifndef CFG_HR_SQI_PI_MIN
+#define CFG_HR_SQI_PI_MIN           5       /* 0.05 % */
+#endif
+
+#ifndef CFG_HR_SQI_PI_MAX
+#define CFG_HR_SQI_PI_MAX           1000    /* 10 % */
+#endif
+
+#ifndef CFG_HR_SQI_CROSS_MAX
+#define CFG_HR_SQI_CROSS_MAX        4       /* > 240 BPM per 1 s window */
+#endif
+
+//--------------------------------------------------------------------------------
+
+/* Static */
+struct hr_sqi_context
+{
+    uint32_t dc_sum;
+    int16_t ac_min;
+    int16_t ac_max;
+    int16_t ac_prev;
+    uint8_t crossings;
+    uint8_t clipped;
+    uint8_t cnt;
+};
+
+static struct hr_sqi_context ctx;
+
+//--------------------------------------------------------------------------------
+
+/* Static function declarations */
+static void hr_sqi_classify(struct hr_sqi_result *result);
+
+//--------------------------------------------------------------------------------
+
+/* Static functions */
+static void hr_sqi_classify(struct hr_sqi_result *result)
+{
+    uint32_t dc = ctx.dc_sum / ctx.cnt;
+    uint32_t ac_pp = (int32_t)ctx.ac_max - ctx.ac_min;
+
+    result->dc = dc;
+    result->perfusion = dc ? ((ac_pp * 10000) / dc) : 0;
+    result->crossings = ctx.crossings;
+    result->clipped = ctx.clipped;
+
+    if (dc < CFG_HR_SQI_DC_MIN)
+    {
+        result->status = HR_SQI_NO_FINGER;
+    }
+    else if (ctx.clipped || (result->perfusion > CFG_HR_SQI_PI_MAX) ||
+            (ctx.crossings > CFG_HR_SQI_CROSS_MAX))
+    {
+        result->status = HR_SQI_MOTION;
+    }
+    else if (result->perfusion < CFG_HR_SQI_PI_MIN)
+    {
+        result->status = HR_SQI_WEAK;
+    }
+    else
+    {
+        result->status = HR_SQI_GOOD;
+    }
+}
+
+//--------------------------------------------------------------------------------
+
+/* Global functions */
+void hr_sqi_reset(void)
+{
+    memset(&ctx, 0, sizeof(ctx));
+}
+
+//  Accumulates one sample, returns true and fills result when a window is complete
+bool hr_sqi_add_sample(uint16_t raw, int16_t ac, struct hr_sqi_result *result)
+{
+    if (ctx.cnt == 0)
+    {
+        ctx.ac_min = ac;
+        ctx.ac_max = ac;
+    }
+    else
+    {
+        if (ac < ctx.ac_min)
+        {
+            ctx.ac_min = ac;
+        }
+        if (ac > ctx.ac_max)
+        {
+            ctx.ac_max = ac;
+        }
+    }
+
+    if ((ctx.ac_prev < 0) && (ac >= 0))
+    {
+        ctx.crossings++;
+    }
+
+    ctx.ac_prev = ac;
+    ctx.dc_sum += raw;
+
+    if (raw >= CFG_HR_SQI_CLIP_LEVEL)
+    {
+        ctx.clipped++;
+    }
+
+    if (++ctx.cnt < CFG_HR_SQI_WINDOW)
+    {
+        return false;
+    }
+
+    hr_sqi_classify(result);
+
+    ctx.dc_sum = 0;
+    ctx.crossings = 0;
+    ctx.clipped = 0;
+    ctx.cnt = 0;
+
+    return true;
+}
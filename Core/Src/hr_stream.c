@@ -0,0 +1,158 @@
+/**
+ *  @file   hr_stream.c
+ *  @brief  Raw IR/RED sample streaming over the command link.
+ *
+ *  STREAM_START switches the HR task to raw capture at full sensor rate, every
+ *  FIFO sample is forwarded until STREAM_STOP. All fields are little endian.
+ *
+ *      STREAM_START    -> { sample rate u16 }
+ *      STREAM_DATA     { seq u32, lost u8, n u8, n * (ir u16, red u16) } ...
+ *      STREAM_STOP     -> { samples u32, lost u32 }
+ *
+ *  seq is the sensor sample number of the first sample in the frame. Samples
+ *  dropped by the sensor FIFO are counted in seq too, so a capture tool sees
+ *  them as a gap and lost tells how many were dropped right before this frame.
+ */
+
+//--------------------------------------------------------------------------------
+
+/* Includes */
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "hr_stream.h"
+#include "hr_app.h"
+#include "cmd_link.h"
+
+//--------------------------------------------------------------------------------
+
+/* Defines */
+#define STREAM_HDR_SIZE         6
+#define STREAM_SAMPLE_SIZE      4
+#define STREAM_BATCH            ((CMD_LINK_PAYLOAD_MAX - STREAM_HDR_SIZE) / STREAM_SAMPLE_SIZE)
+
+//--------------------------------------------------------------------------------
+
+/* Static */
+struct hr_stream_context
+{
+    uint8_t buf[STREAM_HDR_SIZE + STREAM_BATCH * STREAM_SAMPLE_SIZE];
+    uint8_t n;
+    uint32_t seq;
+    uint32_t samples;
+    uint32_t lost;
+    uint8_t gap;
+};
+
+static struct hr_stream_context ctx;
+
+//--------------------------------------------------------------------------------
+
+/* Static function declarations */
+static void put_u32(uint8_t *buf, uint32_t val);
+static void hr_stream_flush(void);
+static void hr_stream_start_cmd(const uint8_t *payload, size_t len);
+static void hr_stream_stop_cmd(const uint8_t *payload, size_t len);
+
+//--------------------------------------------------------------------------------
+
+/* Static functions */
+static void put_u32(uint8_t *buf, uint32_t val)
+{
+    buf[0] = val;
+    buf[1] = val >> 8;
+    buf[2] = val >> 16;
+    buf[3] = val >> 24;
+}
+
+static void hr_stream_flush(void)
+{
+    if (ctx.n == 0)
+    {
+        return;
+    }
+
+    ctx.buf[5] = ctx.n;
+    cmd_link_send(CMD_LINK_RSP_STREAM_DATA, ctx.buf, STREAM_HDR_SIZE + ctx.n * STREAM_SAMPLE_SIZE);
+    ctx.n = 0;
+}
+
+static void hr_stream_start_cmd(const uint8_t *payload, size_t len)
+{
+    uint8_t rsp[2] = { HR_APP_STREAM_RATE & 0xFF, HR_APP_STREAM_RATE >> 8 };
+
+    cmd_link_send(CMD_LINK_STREAM_START | CMD_LINK_RSP, rsp, sizeof(rsp));
+    hr_app_stream(true);
+}
+
+//  Acknowledged by hr_stream_end() once the last samples are out
+static void hr_stream_stop_cmd(const uint8_t *payload, size_t len)
+{
+    hr_app_stream(false);
+}
+
+//--------------------------------------------------------------------------------
+
+/* Global functions */
+bool hr_stream_init(void)
+{
+    return cmd_link_register(CMD_LINK_STREAM_START, hr_stream_start_cmd) &&
+            cmd_link_register(CMD_LINK_STREAM_STOP, hr_stream_stop_cmd);
+}
+
+void hr_stream_begin(void)
+{
+    ctx.n = 0;
+    ctx.seq = 0;
+    ctx.samples = 0;
+    ctx.lost = 0;
+    ctx.gap = 0;
+}
+
+//  Called from the HR task with every FIFO burst
+void hr_stream_push(const uint16_t ir[], const uint16_t red[], uint8_t n, uint8_t lost)
+{
+    if (lost)
+    {
+        //  Start a new frame so the gap is right before its first sample
+        hr_stream_flush();
+        ctx.seq += lost;
+        ctx.lost += lost;
+        ctx.gap = ((ctx.gap + lost) > UINT8_MAX) ? UINT8_MAX : (ctx.gap + lost);
+    }
+
+    for (uint8_t i = 0; i < n; i++)
+    {
+        if (ctx.n == 0)
+        {
+            put_u32(&ctx.buf[0], ctx.seq);
+            ctx.buf[4] = ctx.gap;
+            ctx.gap = 0;
+        }
+
+        uint8_t *out = &ctx.buf[STREAM_HDR_SIZE + ctx.n * STREAM_SAMPLE_SIZE];
+        out[0] = ir[i];
+        out[1] = ir[i] >> 8;
+        out[2] = red[i];
+        out[3] = red[i] >> 8;
+
+        ctx.seq++;
+        ctx.samples++;
+
+        if (++ctx.n == STREAM_BATCH)
+        {
+            hr_stream_flush();
+        }
+    }
+}
+
+void hr_stream_end(void)
+{
+    uint8_t rsp[8];
+
+    hr_stream_flush();
+
+    put_u32(&rsp[0], ctx.samples);
+    put_u32(&rsp[4], ctx.lost);
+    cmd_link_send(CMD_LINK_STREAM_STOP | CMD_LINK_RSP, rsp, sizeof(rsp));
+}
@@ -0,0 +1,105 @@
+/**
+ *  @file   hr_wave.c
+ *  @brief  Decimated PPG waveform from the HR task to the display.
+ *
+ *  The HR task pushes every filtered IR sample, CFG_HR_WAVE_DECIM of them are
+ *  averaged into one plot point. Points go through a single producer, single
+ *  consumer ring: the HR task only writes the head, the OLED task only writes
+ *  the tail, so neither side takes a lock. A full ring drops the new point.
+ *
+ *  hr_wave_push() reports a point added to a ring the consumer had emptied.
+ *  The consumer pops until the ring is empty, so one wakeup per report is
+ *  enough to never leave points behind, a spurious one finds nothing.
+ */
+
+//--------------------------------------------------------------------------------
+
+/* Includes */
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "stm32l1xx_hal.h"
+
+#include "hr_wave.h"
+
+//--------------------------------------------------------------------------------
+
+/* Defines */
+#define WAVE_RING_LEN           32      /* Power of two, 1.3 s at 25 Hz */
+
+//--------------------------------------------------------------------------------
+
+/* Static */
+struct hr_wave_context
+{
+    int16_t ring[WAVE_RING_LEN];
+    volatile uint8_t head;      /* Written by the producer only */
+    volatile uint8_t tail;      /* Written by the consumer only */
+
+    int32_t acc;
+    uint8_t acc_cnt;
+};
+
+static struct hr_wave_context ctx;
+
+//--------------------------------------------------------------------------------
+
+/* Global functions */
+
+//  Producer side, drops a partly averaged point
+void hr_wave_reset(void)
+{
+    ctx.acc = 0;
+    ctx.acc_cnt = 0;
+}
+
+//  Producer side, returns true if the consumer has to be woken up
+bool hr_wave_push(int16_t ac)
+{
+    uint8_t head = ctx.head;
+    uint8_t tail = ctx.tail;
+
+    ctx.acc += ac;
+
+    if (++ctx.acc_cnt < CFG_HR_WAVE_DECIM)
+    {
+        return false;
+    }
+
+    int16_t point = ctx.acc / CFG_HR_WAVE_DECIM;
+
+    ctx.acc = 0;
+    ctx.acc_cnt = 0;
+
+    if ((uint8_t)(head - tail) >= WAVE_RING_LEN)
+    {
+        return false;
+    }
+
+    ctx.ring[head % WAVE_RING_LEN] = point;
+
+    //  The point is in memory before the consumer can see the new head
+    __DMB();
+    ctx.head = head + 1;
+
+    //  Read again, a consumer that emptied the ring meanwhile went back to sleep
+    return ctx.tail == head;
+}
+
+//  Consumer side
+bool hr_wave_pop(int16_t *val)
+{
+    uint8_t tail = ctx.tail;
+
+    if (tail == ctx.head)
+    {
+        return false;
+    }
+
+    *val = ctx.ring[tail % WAVE_RING_LEN];
+
+    __DMB();
+    ctx.tail = tail + 1;
+
+    return true;
+}
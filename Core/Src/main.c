@@ -23,6 +23,15 @@
 #include "oled_app.h"
 #include "hr_app.h"
 #include "ui.h"
+#include "rtc.h"
+#include "hr_history.h"
+#include "cmd_link.h"
+#include "hr_export.h"
+#include "hr_stream.h"
+#include "sys_stats.h"
+#include "sys_clock.h"
+#include "trace_rec.h"
+#include "metrics.h"
 
 //--------------------------------------------------------------------------------
 
@@ -59,10 +68,10 @@ static void system_clock_config(void)
     /* Configure the main internal regulator output voltage */
     __HAL_PWR_VOLTAGESCALING_CONFIG(PWR_REGULATOR_VOLTAGE_SCALE1);
     /* Initializes the CPU, AHB and APB busses clocks */
-    RCC_OscInitStruct.OscillatorType = RCC_OSCILLATORTYPE_HSI | RCC_OSCILLATORTYPE_LSE;
+    /* LSE is started by rtc_init, it keeps running through resets */
+    RCC_OscInitStruct.OscillatorType = RCC_OSCILLATORTYPE_HSI;
     RCC_OscInitStruct.HSIState = RCC_HSI_ON;
     RCC_OscInitStruct.HSICalibrationValue = RCC_HSICALIBRATION_DEFAULT;
-    RCC_OscInitStruct.LSEState = RCC_LSE_ON;
     RCC_OscInitStruct.PLL.PLLState = RCC_PLL_ON;
     RCC_OscInitStruct.PLL.PLLSource = RCC_PLLSOURCE_HSI;
     RCC_OscInitStruct.PLL.PLLMUL = RCC_PLL_MUL6;
@@ -138,10 +147,14 @@ int main(void)
 {
     HAL_Init();
     system_clock_config();
+    sys_stats_timer_init();
+    sys_clock_init();
     debug_log_init();
     led_init();
     button_interrupt_init();
-//    rtc_init();
+    rtc_init();
+    sys_stats_boot_mark(SYS_STATS_BOOT_RTC);
+    hr_history_init();
 
 
     if (oled_app_queue_create())
@@ -152,7 +165,21 @@ int main(void)
 
         hr_app_create_timer();
         hr_app_task_create();
+
+        cmd_link_task_create();
+        hr_export_init();
+        hr_stream_init();
+        sys_stats_init();
+        trace_rec_init();
+        metrics_init();
     }
 
+    sys_stats_boot_mark(SYS_STATS_BOOT_SCHEDULER);
     vTaskStartScheduler();
 }
+
+//  Sleep until the next interrupt, SysTick or the RTC wakeup at the latest
+void vApplicationIdleHook(void)
+{
+    __WFI();
+}
@@ -0,0 +1,116 @@
+/**
+ *  @file   metrics.c
+ *  @brief  Statically registered counters, gauges and latency histograms.
+ *
+ *  Every metric is a slot in a fixed table indexed by its enum, updating one
+ *  is an inline exclusive load/store on that slot: a few cycles, no lock, and
+ *  safe from interrupts. Gauges keep their last value and the peak since the
+ *  last reset. Histograms count durations in log2 buckets of microseconds,
+ *  the bucket is the bit length of the value.
+ *
+ *  The table is served over the command link, a first frame with the counters
+ *  and gauges and one frame per histogram:
+ *
+ *      METRICS [reset u8] -> { counters u8, gauges u8, hists u8, buckets u8,
+ *                              counters * u32, gauges * (value i32, peak i32) }
+ *                         -> hists * { index u8, buckets * u32 }
+ *
+ *  A non-zero reset clears everything once it is sent.
+ */
+
+//--------------------------------------------------------------------------------
+
+/* Includes */
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "metrics.h"
+#include "cmd_link.h"
+
+//--------------------------------------------------------------------------------
+
+/* Defines */
+#define METRICS_HDR_SIZE        4
+
+//--------------------------------------------------------------------------------
+
+/* Static */
+struct metrics_context metrics;
+
+//--------------------------------------------------------------------------------
+
+/* Static function declarations */
+static void metrics_put_u32(uint8_t *out, uint32_t val);
+static void metrics_dump(const uint8_t *payload, size_t len);
+
+//--------------------------------------------------------------------------------
+
+/* Static functions */
+static void metrics_put_u32(uint8_t *out, uint32_t val)
+{
+    out[0] = val;
+    out[1] = val >> 8;
+    out[2] = val >> 16;
+    out[3] = val >> 24;
+}
+
+//  Command link task, the copy is taken with the interrupts that update metrics masked
+static void metrics_dump(const uint8_t *payload, size_t len)
+{
+    static struct metrics_context snap;
+    uint8_t rsp[METRICS_HDR_SIZE + METRICS_COUNTERS * 4 + METRICS_GAUGES * 8];
+    uint8_t *out = &rsp[METRICS_HDR_SIZE];
+
+    taskENTER_CRITICAL();
+    memcpy(&snap, (const void *)&metrics, sizeof(snap));
+
+    if ((len > 0) && (payload[0] != 0))
+    {
+        memset((void *)&metrics, 0, sizeof(metrics));
+    }
+    taskEXIT_CRITICAL();
+
+    rsp[0] = METRICS_COUNTERS;
+    rsp[1] = METRICS_GAUGES;
+    rsp[2] = METRICS_HISTS;
+    rsp[3] = METRICS_HIST_BUCKETS;
+
+    for (uint8_t i = 0; i < METRICS_COUNTERS; i++, out += 4)
+    {
+        metrics_put_u32(out, snap.counters[i]);
+    }
+
+    for (uint8_t i = 0; i < METRICS_GAUGES; i++, out += 8)
+    {
+        metrics_put_u32(out, snap.gauges[i].value);
+        metrics_put_u32(out + 4, snap.gauges[i].peak);
+    }
+
+    cmd_link_send(CMD_LINK_METRICS | CMD_LINK_RSP, rsp, sizeof(rsp));
+
+    for (uint8_t i = 0; i < METRICS_HISTS; i++)
+    {
+        uint8_t hist[1 + METRICS_HIST_BUCKETS * 4];
+
+        hist[0] = i;
+
+        for (uint8_t b = 0; b < METRICS_HIST_BUCKETS; b++)
+        {
+            metrics_put_u32(&hist[1 + b * 4], snap.hists[i][b]);
+        }
+
+        cmd_link_send(CMD_LINK_METRICS | CMD_LINK_RSP, hist, sizeof(hist));
+    }
+}
+
+//--------------------------------------------------------------------------------
+
+/* Global functions */
+bool metrics_init(void)
+{
+    return cmd_link_register(CMD_LINK_METRICS, metrics_dump);
+}
@@ -1,6 +1,29 @@
 /**
  *  @file   oled_app.c
  *  @brief  -
+ *
+ *  Panel power follows the time since the last activity, a button press or a
+ *  new screen (clock ticks do not count): the contrast is lowered in two
+ *  stages, then the panel and its charge pump are switched off. A dimmed watch
+ *  face drops the seconds and is redrawn once a minute. A dark panel
+ *  gets no clock ticks and no flushes, changes stay in the framebuffer and
+ *  the wake sends them in one flush before the panel is switched back on.
+ *
+ *  The measurement screen plots the PPG waveform as a sweep: every point from
+ *  the HR task rewrites one column of the plot area and blanks the next one,
+ *  the column index wraps around. Only the bytes of those two columns change,
+ *  so a frame flushes a few short spans instead of the whole plot. A beat
+ *  blits the large heart next to the title, the small one is put back a few
+ *  points later.
+ *
+ *  A flush only starts the DMA, the next message is drawn into the back buffer
+ *  while the previous frame goes out. The full clock profile is held from the
+ *  first flush of a burst until the queue is empty and the last frame is sent.
+ *
+ *  Full screens are display lists: the fixed ones are const tables, the ones
+ *  showing values are filled in on the stack and replayed. Every message is
+ *  timed per state for the OLED_STATS report, and OLED_FRAME sends the back
+ *  buffer to the host, where it is compared against a golden image.
  */
 
 //--------------------------------------------------------------------------------
@@ -18,9 +41,20 @@
 
 #include "ssd1306.h"
 #include "ssd1306_fonts.h"
+#include "ssd1306_fonts_packed.h"
+#include "ssd1306_icons.h"
+#include "ssd1306_dl.h"
 
 #include "oled_app.h"
+#include "rtc.h"
+#include "sys_clock.h"
+#include "sys_stats.h"
+#include "hr_wave.h"
+#include "text_fmt.h"
+#include "cmd_link.h"
 #include "debug_log.h"
+#include "trace_rec.h"
+#include "metrics.h"
 
 //--------------------------------------------------------------------------------
 
@@ -40,27 +74,544 @@
 #define OLED_QUEUE_LEN          5
 #define OLED_TASK_PRIORITY      (tskIDLE_PRIORITY + 1)
 
+//  Drawing needs little stack since text is formatted without snprintf, the
+//  message logs still go through vsnprintf on this stack. The driver only
+//  logs at init, before anything else is on the stack.
+#if CFG_OLED_APP_LOG_EN
+#define OLED_TASK_STACK         (configMINIMAL_STACK_SIZE * 3)
+#else
+#define OLED_TASK_STACK         (configMINIMAL_STACK_SIZE * 2)
+#endif
+
 #define MAX_MEAS_CNT            4
 
+#define WATCH_TIME_Y            12
+#define WATCH_DATE_X            29
+#define WATCH_DATE_Y            44
+
+#define PLOT_Y                  16      /* Waveform area, pages 2 to 6 */
+#define PLOT_H                  40
+#define PLOT_GAP                1       /* Blank columns ahead of the sweep */
+#define PLOT_ENV_MIN            20      /* Smallest full scale amplitude */
+#define PLOT_ENV_DECAY          6       /* Full scale decay per point, 1/64 */
+
+#define HEART_X                 4
+#define HEART_Y                 2
+#define HEART_PULSE_POINTS      4       /* Large heart shown for 160 ms at 25 Hz */
+
+#define FRAME_CHUNK             64      /* Framebuffer bytes per OLED_FRAME response */
+
+#ifndef CFG_OLED_DIM_MS
+#define CFG_OLED_DIM_MS         10000   /* Idle time to the first dim stage, 0 keeps the panel on */
+#endif
+
+#ifndef CFG_OLED_OFF_MS
+#define CFG_OLED_OFF_MS         30000   /* Idle time to panel off */
+#endif
+
 //--------------------------------------------------------------------------------
 
 /* Static */
+enum oled_pm_stage
+{
+    OLED_PM_ON,
+    OLED_PM_DIM,
+    OLED_PM_DIMMER,
+    OLED_PM_OFF
+};
+
+struct oled_pm_level
+{
+    uint32_t idle_ms;       /* Entered after this long without activity */
+    uint8_t contrast;
+};
+
+struct oled_render_stats
+{
+    uint32_t count;
+    uint32_t sum_us;
+    uint32_t max_us;
+};
+
+//  Messages that draw, in OLED_STATS report order
+static const enum oled_state oled_render_states[] =
+{
+    OLED_STARTUP,
+    OLED_SHUTDOWN,
+    OLED_TIME_DISPLAY,
+    OLED_HR_MEASURMENT,
+    OLED_HR_DISPLAY,
+    OLED_NO_FINGER,
+    OLED_MOTION,
+    OLED_CLOCK_TICK,
+    OLED_WAVE,
+    OLED_BEAT
+};
+
+#define OLED_RENDER_STATES      (sizeof(oled_render_states) / sizeof(oled_render_states[0]))
+
 struct oled_app_context
 {
-    enum oled_state state;
+    volatile enum oled_state state;
     QueueHandle_t oled_queue;
+    volatile bool low_power;
+
+    struct
+    {
+        char time[9];       /* Text on the panel, redrawn per changed char */
+        char date[11];
+        bool low_power;
+    } watch;
+
+    bool clock_held;        /* Full profile kept while a flush is in flight */
+
+    struct
+    {
+        volatile enum oled_pm_stage stage;
+        TickType_t activity;
+        TickType_t on_since;
+        uint32_t on_ms;         /* Panel lit time before on_since */
+    } pm;
+
+    struct
+    {
+        uint8_t x;              /* Next column of the sweep */
+        uint8_t prev_y;
+        int16_t env;            /* Peak amplitude, decays towards the signal */
+        uint8_t pulse;          /* Points left until the heart shrinks back */
+    } plot;
+
+    struct oled_render_stats render[OLED_RENDER_STATES];
 };
 
 static struct oled_app_context ctx;
 
+static const struct oled_pm_level oled_pm_levels[] =
+{
+    [OLED_PM_ON]        = { 0, 0xFF },
+    [OLED_PM_DIM]       = { CFG_OLED_DIM_MS, 0x40 },
+    [OLED_PM_DIMMER]    = { (CFG_OLED_DIM_MS + CFG_OLED_OFF_MS) / 2, 0x08 },
+    [OLED_PM_OFF]       = { CFG_OLED_OFF_MS, 0 }
+};
+
+static const struct ssd1306_dl_cmd oled_screen_startup[] =
+{
+    SSD1306_DL_FILL(COLOR_BLACK),
+    SSD1306_DL_TEXT_PACKED(2, 24, "SWAW watch", Font_11x18_packed, COLOR_WHITE)
+};
+
+static const struct ssd1306_dl_cmd oled_screen_shutdown[] =
+{
+    SSD1306_DL_FILL(COLOR_BLACK),
+    SSD1306_DL_TEXT_PACKED(16, 24, "Goodbye!", Font_11x18_packed, COLOR_WHITE)
+};
+
+static const struct ssd1306_dl_cmd oled_screen_measurement[] =
+{
+    SSD1306_DL_FILL(COLOR_BLACK),
+    SSD1306_DL_TEXT(18, 2, "Measurment...", Font_7x10, COLOR_WHITE),
+    SSD1306_DL_BITMAP(HEART_X, HEART_Y, icon_heart_small, SSD1306_BLIT_COPY)
+};
+
+static const struct ssd1306_dl_cmd oled_screen_no_finger[] =
+{
+    SSD1306_DL_FILL(COLOR_BLACK),
+    SSD1306_DL_TEXT_PACKED(14, 12, "No finger", Font_11x18_packed, COLOR_WHITE),
+    SSD1306_DL_TEXT(22, 40, "Place finger", Font_7x10, COLOR_WHITE)
+};
+
+static const struct ssd1306_dl_cmd oled_screen_motion[] =
+{
+    SSD1306_DL_FILL(COLOR_BLACK),
+    SSD1306_DL_TEXT_PACKED(9, 12, "Hold still", Font_11x18_packed, COLOR_WHITE),
+    SSD1306_DL_TEXT(11, 40, "Too much motion", Font_7x10, COLOR_WHITE)
+};
+
 //--------------------------------------------------------------------------------
 
 /* Static function declarations */
+static void oled_app_draw_watch(bool full);
+static void oled_app_draw_hr_clock(void);
+static void oled_app_rtc_tick(void);
+static void oled_app_stats(const uint8_t *payload, size_t len);
+static void oled_app_frame(const uint8_t *payload, size_t len);
+static void oled_app_frame_send(void);
+static void oled_app_render_done(enum oled_state state, uint32_t start);
+static void oled_app_plot_reset(void);
+static void oled_app_plot_point(int16_t val);
+static void oled_app_plot_drain(bool draw);
+static uint32_t oled_app_pm_idle(void);
+static enum oled_pm_stage oled_app_pm_target(uint32_t idle);
+static TickType_t oled_app_pm_timeout(void);
+static void oled_app_pm_apply(enum oled_pm_stage stage);
+static void oled_app_flush(void);
+static void oled_app_flush_done(void);
 
 //--------------------------------------------------------------------------------
 
 /* Static functions */
 
+//  Watch face, only the characters that changed since the last call are drawn
+static void oled_app_draw_watch(bool full)
+{
+    RTC_TimeTypeDef time;
+    RTC_DateTypeDef date;
+    char buffer[11];
+    uint8_t len;
+    uint8_t x;
+
+    rtc_get_time(&time, &date);
+
+    if (full || (ctx.watch.low_power != ctx.low_power))
+    {
+        ssd1306_fill(COLOR_BLACK);
+        memset(&ctx.watch, 0, sizeof(ctx.watch));
+        ctx.watch.low_power = ctx.low_power;
+    }
+
+    //  Low power mode refreshes once a minute, seconds are not shown
+    if (ctx.watch.low_power)
+    {
+        len = text_fmt_hhmm(buffer, time.Hours, time.Minutes) - buffer;
+    }
+    else
+    {
+        len = text_fmt_hhmmss(buffer, time.Hours, time.Minutes, time.Seconds) - buffer;
+    }
+
+    x = (SSD1306_WIDTH - len * Font_16x26_packed.w) / 2;
+
+    for (uint8_t i = 0; i < len; i++)
+    {
+        if (buffer[i] != ctx.watch.time[i])
+        {
+            ssd1306_set_cursor(x + i * Font_16x26_packed.w, WATCH_TIME_Y);
+            ssd1306_write_packed(buffer[i], &Font_16x26_packed, COLOR_WHITE);
+            ctx.watch.time[i] = buffer[i];
+        }
+    }
+
+    text_fmt_date(buffer, date.Date, date.Month, date.Year);
+
+    if (strcmp(buffer, ctx.watch.date) != 0)
+    {
+        ssd1306_set_cursor(WATCH_DATE_X, WATCH_DATE_Y);
+        ssd1306_write_string(buffer, Font_7x10, COLOR_WHITE);
+        strcpy(ctx.watch.date, buffer);
+    }
+}
+
+//  Unchanged glyph bytes do not dirty the framebuffer, so the flush stays small
+static void oled_app_draw_hr_clock(void)
+{
+    RTC_TimeTypeDef time;
+    RTC_DateTypeDef date;
+    char clock[TEXT_FMT_HHMMSS_LEN];
+    char day[TEXT_FMT_DATE_LEN];
+    const struct ssd1306_dl_cmd dl[] =
+    {
+        SSD1306_DL_TEXT_PACKED(22, 2, clock, Font_11x18_packed, COLOR_WHITE),
+        SSD1306_DL_TEXT(30, 24, day, Font_7x10, COLOR_WHITE)
+    };
+
+    rtc_get_time(&time, &date);
+
+    text_fmt_hhmmss(clock, time.Hours, time.Minutes, time.Seconds);
+    text_fmt_date(day, date.Date, date.Month, date.Year);
+    ssd1306_dl_replay(dl, SSD1306_DL_LEN(dl));
+}
+
+//  RTC wakeup interrupt context, 1 Hz
+static void oled_app_rtc_tick(void)
+{
+    BaseType_t woken = pdFALSE;
+    struct oled_queue_msg msg = { .new_state = OLED_CLOCK_TICK };
+
+    if ((ctx.state != OLED_TIME_DISPLAY) && (ctx.state != OLED_HR_DISPLAY))
+    {
+        return;
+    }
+
+    if (ctx.pm.stage == OLED_PM_OFF)
+    {
+        return;     // Redrawn by the wake
+    }
+
+    if (ctx.low_power && (ctx.state == OLED_TIME_DISPLAY) && (rtc_get_seconds() != 0))
+    {
+        return;
+    }
+
+    //  A full queue already holds a redraw, dropping the tick is fine
+    if (xQueueSendFromISR(ctx.oled_queue, &msg, &woken) != pdPASS)
+    {
+        metrics_inc(METRICS_OLED_DROPS);
+    }
+
+    portYIELD_FROM_ISR(woken);
+}
+
+static void oled_app_stats(const uint8_t *payload, size_t len)
+{
+    struct ssd1306_stats stats;
+    uint32_t val[4];
+    uint8_t rsp[16 + OLED_RENDER_STATES * 9];
+    TickType_t now = xTaskGetTickCount();
+
+    ssd1306_get_stats(&stats);
+
+    val[0] = stats.flushes;
+    val[1] = stats.bytes;
+    val[2] = now * portTICK_PERIOD_MS;
+    val[3] = ctx.pm.on_ms + ((ctx.pm.stage != OLED_PM_OFF) ? (now - ctx.pm.on_since) * portTICK_PERIOD_MS : 0);
+
+    for (uint8_t i = 0; i < 16; i++)
+    {
+        rsp[i] = val[i / 4] >> ((i % 4) * 8);
+    }
+
+    //  Per state {state, count, mean us, max us}, times saturate at 65 ms
+    for (uint8_t i = 0; i < OLED_RENDER_STATES; i++)
+    {
+        struct oled_render_stats r;
+        uint8_t *p = &rsp[16 + i * 9];
+
+        taskENTER_CRITICAL();
+        r = ctx.render[i];
+        taskEXIT_CRITICAL();
+
+        uint32_t mean = r.count ? (r.sum_us / r.count) : 0;
+        uint32_t max = r.max_us;
+
+        mean = (mean > 0xFFFF) ? 0xFFFF : mean;
+        max = (max > 0xFFFF) ? 0xFFFF : max;
+
+        p[0] = oled_render_states[i];
+        for (uint8_t j = 0; j < 4; j++)
+        {
+            p[1 + j] = r.count >> (j * 8);
+        }
+        p[5] = mean;
+        p[6] = mean >> 8;
+        p[7] = max;
+        p[8] = max >> 8;
+    }
+
+    cmd_link_send(CMD_LINK_OLED_STATS | CMD_LINK_RSP, rsp, sizeof(rsp));
+}
+
+//  Command link task, the capture runs on the OLED task between two messages
+static void oled_app_frame(const uint8_t *payload, size_t len)
+{
+    struct oled_queue_msg msg = { .new_state = OLED_CAPTURE };
+
+    if (xQueueSend(ctx.oled_queue, &msg, 0) != pdPASS)
+    {
+        cmd_link_send(CMD_LINK_RSP_ERROR, (uint8_t[]){ CMD_LINK_OLED_FRAME }, 1);
+    }
+}
+
+//  Back buffer in page order, one {chunk index, FRAME_CHUNK bytes} response each
+static void oled_app_frame_send(void)
+{
+    const uint8_t *fb = ssd1306_get_buffer();
+    uint8_t rsp[1 + FRAME_CHUNK];
+
+    for (uint8_t i = 0; i < (SSD1306_WIDTH * SSD1306_HEIGHT / 8) / FRAME_CHUNK; i++)
+    {
+        rsp[0] = i;
+        memcpy(&rsp[1], &fb[i * FRAME_CHUNK], FRAME_CHUNK);
+        cmd_link_send(CMD_LINK_OLED_FRAME | CMD_LINK_RSP, rsp, sizeof(rsp));
+    }
+}
+
+static void oled_app_render_done(enum oled_state state, uint32_t start)
+{
+    uint32_t elapsed = sys_stats_timer_get() - start;
+
+    metrics_hist_add(METRICS_OLED_RENDER_US, elapsed);
+
+    for (uint8_t i = 0; i < OLED_RENDER_STATES; i++)
+    {
+        if (oled_render_states[i] == state)
+        {
+            struct oled_render_stats *r = &ctx.render[i];
+
+            taskENTER_CRITICAL();
+            r->count++;
+            r->sum_us += elapsed;
+            if (elapsed > r->max_us)
+            {
+                r->max_us = elapsed;
+            }
+            taskEXIT_CRITICAL();
+            break;
+        }
+    }
+}
+
+static void oled_app_plot_reset(void)
+{
+    ctx.plot.x = 0;
+    ctx.plot.prev_y = PLOT_Y + PLOT_H / 2;
+    ctx.plot.env = PLOT_ENV_MIN;
+    ctx.plot.pulse = 0;
+}
+
+//  Rewrites the column at the sweep position and blanks the gap ahead of it
+static void oled_app_plot_point(int16_t val)
+{
+    int16_t mag = (val < 0) ? -val : val;
+    int16_t env = ctx.plot.env - (ctx.plot.env >> PLOT_ENV_DECAY);
+    uint8_t x = ctx.plot.x;
+    int16_t y;
+
+    ctx.plot.env = (mag > env) ? mag : ((env > PLOT_ENV_MIN) ? env : PLOT_ENV_MIN);
+
+    //  Larger values up, full scale fills the area
+    y = PLOT_Y + PLOT_H / 2 - ((int32_t)val * (PLOT_H / 2 - 1)) / ctx.plot.env;
+
+    for (uint8_t i = 0; i <= PLOT_GAP; i++)
+    {
+        ssd1306_draw_fill_rectangle((x + i) % SSD1306_WIDTH, PLOT_Y, 1, PLOT_H, COLOR_BLACK);
+    }
+
+    //  A new sweep starts without a segment from the right edge
+    ssd1306_draw_line(x, (x == 0) ? y : ctx.plot.prev_y, x, y, COLOR_WHITE);
+
+    ctx.plot.prev_y = y;
+    ctx.plot.x = (x + 1) % SSD1306_WIDTH;
+
+    if ((ctx.plot.pulse != 0) && (--ctx.plot.pulse == 0))
+    {
+        ssd1306_draw_bitmap(HEART_X, HEART_Y, &icon_heart_small, SSD1306_BLIT_COPY);
+    }
+}
+
+//  Empties the waveform ring, points that arrive outside the measurement screen are dropped
+static void oled_app_plot_drain(bool draw)
+{
+    int16_t val;
+
+    while (hr_wave_pop(&val))
+    {
+        if (draw)
+        {
+            oled_app_plot_point(val);
+        }
+    }
+}
+
+//  Power stage for the time since the last activity
+static uint32_t oled_app_pm_idle(void)
+{
+    return (xTaskGetTickCount() - ctx.pm.activity) * portTICK_PERIOD_MS;
+}
+
+//  Stage for idle ms, callers read the tick once for the stage and the time left in it
+static enum oled_pm_stage oled_app_pm_target(uint32_t idle)
+{
+    enum oled_pm_stage stage = OLED_PM_ON;
+
+    if (ctx.state == OLED_OFF)
+    {
+        return OLED_PM_OFF;
+    }
+
+    if (CFG_OLED_DIM_MS == 0)
+    {
+        return OLED_PM_ON;
+    }
+
+    while ((stage < OLED_PM_OFF) && (idle >= oled_pm_levels[stage + 1].idle_ms))
+    {
+        stage++;
+    }
+
+    return stage;
+}
+
+//  Queue wait until the next stage is due
+static TickType_t oled_app_pm_timeout(void)
+{
+    uint32_t idle = oled_app_pm_idle();
+    enum oled_pm_stage stage = oled_app_pm_target(idle);
+
+    if ((CFG_OLED_DIM_MS == 0) || (stage == OLED_PM_OFF))
+    {
+        return portMAX_DELAY;
+    }
+
+    return pdMS_TO_TICKS(oled_pm_levels[stage + 1].idle_ms - idle);
+}
+
+//  Called with the full clock held, after the flush so a woken panel shows the new frame
+static void oled_app_pm_apply(enum oled_pm_stage stage)
+{
+    TickType_t now = xTaskGetTickCount();
+
+    if (stage == ctx.pm.stage)
+    {
+        return;
+    }
+
+    if (stage == OLED_PM_OFF)
+    {
+        ssd1306_set_display_on(false);
+        ctx.pm.on_ms += (now - ctx.pm.on_since) * portTICK_PERIOD_MS;
+    }
+    else
+    {
+        ssd1306_set_contrast(oled_pm_levels[stage].contrast);
+
+        if (ctx.pm.stage == OLED_PM_OFF)
+        {
+            ssd1306_set_display_on(true);
+            ctx.pm.on_since = now;
+        }
+    }
+
+    LOG("Panel stage %d -> %d\n", ctx.pm.stage, stage);
+    ctx.pm.stage = stage;
+
+    //  Nobody reads the seconds on a dimmed face, tick it once a minute
+    if ((stage >= OLED_PM_DIM) != ctx.low_power)
+    {
+        oled_app_set_low_power(stage >= OLED_PM_DIM);
+    }
+}
+
+//  Drawing runs in the low clock profile, only the I2C traffic needs the PLL
+static void oled_app_flush(void)
+{
+    enum oled_pm_stage stage = oled_app_pm_target(oled_app_pm_idle());
+
+    if (!ctx.clock_held)
+    {
+        sys_clock_request();
+        ctx.clock_held = true;
+    }
+
+    //  Returns once the DMA is started, the next message is drawn meanwhile
+    if (stage != OLED_PM_OFF)
+    {
+        ssd1306_update_screen();
+    }
+
+    oled_app_pm_apply(stage);
+}
+
+//  Nothing left to draw, the clock drops once the last frame is out
+static void oled_app_flush_done(void)
+{
+    if (ctx.clock_held)
+    {
+        ssd1306_wait_flush();
+        sys_clock_release();
+        ctx.clock_held = false;
+    }
+}
+
 //--------------------------------------------------------------------------------
 
 /* Global functions */
@@ -68,10 +619,11 @@ bool oled_app_queue_create(void)
 {
     ctx.oled_queue = NULL;
 
-    ctx.oled_queue = xQueueCreate(OLED_QUEUE_LEN, sizeof(struct oled_queue_msg*));
+    ctx.oled_queue = xQueueCreate(OLED_QUEUE_LEN, sizeof(struct oled_queue_msg));
 
     if (ctx.oled_queue != NULL)
     {
+        trace_rec_name_queue(ctx.oled_queue, "oled");
         return true;
     }
 
@@ -80,115 +632,229 @@ bool oled_app_queue_create(void)
 
 bool oled_app_queue_add(struct oled_queue_msg *msg)
 {
-    xQueueSend(ctx.oled_queue, msg, portMAX_DELAY);
+    return xQueueSend(ctx.oled_queue, msg, portMAX_DELAY) == pdPASS;
 }
 
 bool oled_app_task_create(void)
 {
-    if (xTaskCreate(oled_app_task, "oled", configMINIMAL_STACK_SIZE*4, NULL, 3, NULL) != pdPASS)
+    if (xTaskCreate(oled_app_task, "oled", OLED_TASK_STACK, NULL, 3, NULL) != pdPASS)
     {
         return false;
     }
 
+    rtc_register_wakeup_callback(oled_app_rtc_tick);
+    cmd_link_register(CMD_LINK_OLED_STATS, oled_app_stats);
+    cmd_link_register(CMD_LINK_OLED_FRAME, oled_app_frame);
+
     return true;
 }
 
+//  Low power watch face: minutes only, refreshed once a minute. Follows the
+//  dim stages, the redraw is queued so it may be called from the OLED task.
+void oled_app_set_low_power(bool enable)
+{
+    struct oled_queue_msg msg = { .new_state = OLED_CLOCK_TICK };
+
+    ctx.low_power = enable;
+
+    if (xQueueSend(ctx.oled_queue, &msg, 0) != pdPASS)
+    {
+        metrics_inc(METRICS_OLED_DROPS);
+    }
+}
+
+//  Any button event, returns true if the panel was off so the press should only wake it
+bool oled_app_wake(void)
+{
+    struct oled_queue_msg msg = { .new_state = OLED_WAKE };
+    bool dark = (ctx.pm.stage == OLED_PM_OFF) && (ctx.state != OLED_OFF);
+
+    if (xQueueSend(ctx.oled_queue, &msg, 0) != pdPASS)
+    {
+        metrics_inc(METRICS_OLED_DROPS);
+    }
+
+    return dark;
+}
+
 void oled_app_task(void* params)
 {
     struct oled_queue_msg msg;
-    char buffer[16];
+    char bpm[16];
+    char hrv[16];
+    uint32_t start;
     volatile uint8_t meas_cnt = 0;
-    RTC_TimeTypeDef time;
-    RTC_DateTypeDef date;
 
     LOG("===> OLED task started!\n");
 
-    ctx.state = OLED_OFF;
-
-    rtc_init();
-
+    //  The panel is switched on once it holds the first frame, a single flush
+    sys_clock_request();
     ssd1306_i2c_init();
     ssd1306_init();
+    sys_stats_boot_mark(SYS_STATS_BOOT_PANEL);
+
+    ctx.state = OLED_TIME_DISPLAY;
+    oled_app_draw_watch(true);
     ssd1306_update_screen();
+    ssd1306_set_display_on(true);
+    sys_stats_boot_mark(SYS_STATS_BOOT_FRAME);
+    sys_clock_release();
+
+    ctx.pm.activity = xTaskGetTickCount();
+    ctx.pm.on_since = ctx.pm.activity;
 
     while (1)
     {
-        xQueueReceive(ctx.oled_queue, &msg, portMAX_DELAY );
+        if (xQueueReceive(ctx.oled_queue, &msg, 0) != pdPASS)
+        {
+            oled_app_flush_done();
+
+            if (xQueueReceive(ctx.oled_queue, &msg, oled_app_pm_timeout()) != pdPASS)
+            {
+                //  Idle timeout, only the power stage changes
+                oled_app_flush();
+                continue;
+            }
+        }
+
+        metrics_gauge_set(METRICS_OLED_QUEUE, uxQueueMessagesWaiting(ctx.oled_queue));
+
+        if (msg.new_state == OLED_CAPTURE)
+        {
+            oled_app_frame_send();
+            continue;
+        }
+
+        if (msg.new_state != OLED_CLOCK_TICK)
+        {
+            ctx.pm.activity = xTaskGetTickCount();
+        }
 
-        LOG("Received msg! ID #%d\n", msg.new_state);
+        if ((msg.new_state != OLED_CLOCK_TICK) && (msg.new_state != OLED_WAVE) && (msg.new_state != OLED_BEAT))
+        {
+            LOG("Received msg! ID #%d\n", msg.new_state);
+        }
+
+        start = sys_stats_timer_get();
+        TRACE_SPAN_BEGIN(TRACE_SPAN_OLED_DRAW);
         switch (msg.new_state)
         {
+        case OLED_CLOCK_TICK:
+            if (ctx.state == OLED_TIME_DISPLAY)
+            {
+                oled_app_draw_watch(false);
+            }
+            else if (ctx.state == OLED_HR_DISPLAY)
+            {
+                oled_app_draw_hr_clock();
+            }
+            break;
+
+        case OLED_WAKE:
+            //  Clock ticks were skipped while the panel was off
+            if (ctx.state == OLED_TIME_DISPLAY)
+            {
+                oled_app_draw_watch(false);
+            }
+            else if (ctx.state == OLED_HR_DISPLAY)
+            {
+                oled_app_draw_hr_clock();
+            }
+            break;
+
+        case OLED_WAVE:
+            oled_app_plot_drain(ctx.state == OLED_HR_MEASURMENT);
+            break;
+
+        case OLED_BEAT:
+            if (ctx.state == OLED_HR_MEASURMENT)
+            {
+                ssd1306_draw_bitmap(HEART_X, HEART_Y, &icon_heart_big, SSD1306_BLIT_COPY);
+                ctx.plot.pulse = HEART_PULSE_POINTS;
+            }
+            break;
+
         case OLED_OFF:
+            //  Panel off right away, the cleared framebuffer is flushed by the next wake
             ctx.state = OLED_OFF;
             ssd1306_fill(COLOR_BLACK);
             break;
 
         case OLED_STARTUP:
             ctx.state = OLED_STARTUP;
-            ssd1306_fill(COLOR_BLACK);
-            ssd1306_set_cursor(2, 24);
-            ssd1306_write_string("SWAW watch", Font_11x18, COLOR_WHITE);
+            ssd1306_dl_replay(oled_screen_startup, SSD1306_DL_LEN(oled_screen_startup));
             break;
 
         case OLED_SHUTDOWN:
             ctx.state = OLED_SHUTDOWN;
-            ssd1306_fill(COLOR_BLACK);
-            ssd1306_set_cursor(16, 24);
-            ssd1306_write_string("Goodbye!", Font_11x18, COLOR_WHITE);
+            ssd1306_dl_replay(oled_screen_shutdown, SSD1306_DL_LEN(oled_screen_shutdown));
             break;
 
         case OLED_TIME_DISPLAY:
             ctx.state = OLED_TIME_DISPLAY;
-            ssd1306_fill(COLOR_BLACK);
-            ssd1306_set_cursor(24, 24);
-            ssd1306_write_string("hh:mm", Font_16x26, COLOR_WHITE);
+            oled_app_draw_watch(true);
             break;
 
         case OLED_HR_MEASURMENT:
-            ssd1306_fill(COLOR_BLACK);
+            //  The layout is drawn once, updates only move the progress bar
+            //  so the waveform plot is kept
             if (ctx.state != OLED_HR_MEASURMENT)
             {
                 ctx.state = OLED_HR_MEASURMENT;
                 meas_cnt = 0;
+                ssd1306_dl_replay(oled_screen_measurement, SSD1306_DL_LEN(oled_screen_measurement));
+                oled_app_plot_reset();
             }
             else
             {
                 meas_cnt++;
             }
             meas_cnt %= 4;
-            ssd1306_draw_fill_rectangle(32 * meas_cnt, 60, 32, 4, COLOR_WHITE);
-            ssd1306_set_cursor(0, 8);
-            ssd1306_write_string("Measurment", Font_11x18, COLOR_WHITE);
-            ssd1306_set_cursor(0, 32);
-            ssd1306_write_string("in progress", Font_11x18, COLOR_WHITE);
+            {
+                const struct ssd1306_dl_cmd bar[] =
+                {
+                    SSD1306_DL_FILL_RECT(0, 60, SSD1306_WIDTH, 4, COLOR_BLACK),
+                    SSD1306_DL_FILL_RECT(32 * meas_cnt, 60, 32, 4, COLOR_WHITE)
+                };
+
+                ssd1306_dl_replay(bar, SSD1306_DL_LEN(bar));
+            }
+            break;
+
+        case OLED_NO_FINGER:
+            ctx.state = OLED_NO_FINGER;
+            ssd1306_dl_replay(oled_screen_no_finger, SSD1306_DL_LEN(oled_screen_no_finger));
+            break;
+
+        case OLED_MOTION:
+            ctx.state = OLED_MOTION;
+            ssd1306_dl_replay(oled_screen_motion, SSD1306_DL_LEN(oled_screen_motion));
             break;
 
         case OLED_HR_DISPLAY:
             ctx.state = OLED_HR_DISPLAY;
-            ssd1306_fill(COLOR_BLACK);
-//            ssd1306_set_cursor(0, 8);
-//            snprintf(buffer, sizeof(buffer), "Sp02: %d%%", msg.sp02);
-//            ssd1306_write_string(buffer, Font_11x18, COLOR_WHITE);
-
-            ssd1306_set_cursor(22, 2);
-            rtc_get_time(&time, &date);
-            //    LOG("Date: %d/%d/%d", date->Date, date->Month, date->Year);
-            snprintf(buffer, sizeof(buffer), "%02d:%02d:%02d", time.Hours, time.Minutes, time.Seconds);
-            ssd1306_write_string(buffer, Font_11x18, COLOR_WHITE);
-
-            ssd1306_set_cursor(30, 24);
-            snprintf(buffer, sizeof(buffer), "%02d/%02d/20%02d", date.Date, date.Month, date.Year);
-            ssd1306_write_string(buffer, Font_7x10, COLOR_WHITE);
-
-            ssd1306_set_cursor(30, 40);
-            snprintf(buffer, sizeof(buffer), "%d BPM", msg.heart_rate);
-            ssd1306_write_string(buffer, Font_11x18, COLOR_WHITE);
+            {
+                //  The HRV line is left out while there is no value
+                const struct ssd1306_dl_cmd screen[] =
+                {
+                    SSD1306_DL_FILL(COLOR_BLACK),
+                    SSD1306_DL_TEXT_PACKED(30, 36, bpm, Font_11x18_packed, COLOR_WHITE),
+                    SSD1306_DL_TEXT(34, 56, hrv, Font_6x8, COLOR_WHITE)
+                };
+
+                text_fmt_value(bpm, "", msg.heart_rate, msg.hr_uncertain ? " BPM?" : " BPM");
+                text_fmt_value(hrv, "HRV ", msg.rmssd, "ms");
+                ssd1306_dl_replay(screen, msg.rmssd ? SSD1306_DL_LEN(screen) : SSD1306_DL_LEN(screen) - 1);
+            }
+            oled_app_draw_hr_clock();
             break;
 
         default:
             break;
         }
+        TRACE_SPAN_END(TRACE_SPAN_OLED_DRAW);
+        oled_app_render_done(msg.new_state, start);
 
-        ssd1306_update_screen();
+        oled_app_flush();
     }
 }
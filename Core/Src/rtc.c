@@ -1,6 +1,18 @@
 /**
  *  @file   rtc.c
  *  @brief  -
+ *
+ *  The calendar runs from the LSE in the backup domain. A magic value in the
+ *  first backup register marks it as set, so a reset keeps the time and only
+ *  a backup domain loss (power removed) falls back to the default date.
+ *
+ *  The unix time is cached in RAM and refreshed from the calendar registers
+ *  on every wakeup interrupt. Readers use the cache without touching the RTC,
+ *  a 32-bit aligned load is atomic so no lock is needed.
+ *
+ *  The prescalers split the 32768 Hz LSE into a 1024 Hz sub-second counter,
+ *  which gives a monotonic microsecond timebase with ~1 ms resolution. Setting
+ *  the calendar moves the timebase origin along, so it does not jump.
  */
 
 //--------------------------------------------------------------------------------
@@ -12,6 +24,8 @@
 
 #include "stm32l1xx_hal.h"
 
+#include "rtc.h"
+#include "cmd_link.h"
 #include "debug_log.h"
 
 //--------------------------------------------------------------------------------
@@ -29,6 +43,14 @@
 //--------------------------------------------------------------------------------
 
 /* Defines */
+#define RTC_WAKEUP_CB_MAX       4
+#define RTC_WAKEUP_IRQ_PRIO     14
+
+#define RTC_BKP_MAGIC           0x52544331UL    /* "RTC1" */
+#define RTC_SECONDS_PER_DAY     86400UL
+
+#define RTC_PREDIV_A            31              /* 32768 Hz LSE / 32 = 1024 Hz */
+#define RTC_PREDIV_S            1023            /* 1024 Hz / 1024 = 1 Hz */
 
 //--------------------------------------------------------------------------------
 
@@ -36,6 +58,10 @@
 struct rtc_context
 {
     RTC_HandleTypeDef rtc_handler;
+    rtc_wakeup_cb_t wakeup_cb[RTC_WAKEUP_CB_MAX];
+    uint8_t wakeup_cb_cnt;
+    volatile uint32_t now;      /* Cached unix time */
+    uint32_t mono_base;         /* Unix time at the monotonic origin */
 };
 
 static struct rtc_context ctx;
@@ -43,56 +69,231 @@ static struct rtc_context ctx;
 //--------------------------------------------------------------------------------
 
 /* Static function declarations */
+static uint32_t rtc_days_from_civil(uint32_t y, uint32_t m, uint32_t d);
+static uint8_t rtc_bcd(uint32_t reg, uint8_t pos, uint8_t tens_mask);
+static uint32_t rtc_regs_to_timestamp(uint32_t tr, uint32_t dr);
+static uint32_t rtc_read_timestamp(void);
+static void rtc_set_command(const uint8_t *payload, size_t len);
 
 //--------------------------------------------------------------------------------
 
 /* Static functions */
 
+//  Days since 1970-01-01 of a Gregorian date
+static uint32_t rtc_days_from_civil(uint32_t y, uint32_t m, uint32_t d)
+{
+    if (m <= 2)
+    {
+        y--;
+    }
+
+    uint32_t era = y / 400;
+    uint32_t yoe = y - era * 400;
+    uint32_t doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    uint32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+    return era * 146097 + doe - 719468;
+}
+
+static uint8_t rtc_bcd(uint32_t reg, uint8_t pos, uint8_t tens_mask)
+{
+    return ((reg >> (pos + 4)) & tens_mask) * 10 + ((reg >> pos) & 0x0F);
+}
+
+static uint32_t rtc_regs_to_timestamp(uint32_t tr, uint32_t dr)
+{
+    return rtc_days_from_civil(2000 + rtc_bcd(dr, 16, 0x0F), rtc_bcd(dr, 8, 0x01), rtc_bcd(dr, 0, 0x03)) *
+            RTC_SECONDS_PER_DAY + rtc_bcd(tr, 16, 0x03) * 3600UL + rtc_bcd(tr, 8, 0x07) * 60UL + rtc_bcd(tr, 0, 0x07);
+}
+
+//  Straight from the calendar registers, no HAL synchronization waits
+static uint32_t rtc_read_timestamp(void)
+{
+    uint32_t tr = RTC->TR;
+    uint32_t dr = RTC->DR;      // Reading TR locks the shadow registers until DR is read
+
+    return rtc_regs_to_timestamp(tr, dr);
+}
+
+//  SET_TIME { unix time u32 } sets the calendar, an empty payload only reads it
+static void rtc_set_command(const uint8_t *payload, size_t len)
+{
+    uint32_t now;
+    uint8_t rsp[4];
+
+    if (len >= 4)
+    {
+        rtc_set_timestamp(payload[0] | (payload[1] << 8) | ((uint32_t)payload[2] << 16) | ((uint32_t)payload[3] << 24));
+    }
+
+    now = rtc_get_timestamp();
+    rsp[0] = now;
+    rsp[1] = now >> 8;
+    rsp[2] = now >> 16;
+    rsp[3] = now >> 24;
+
+    cmd_link_send(CMD_LINK_SET_TIME | CMD_LINK_RSP, rsp, sizeof(rsp));
+}
+
 //--------------------------------------------------------------------------------
 
 /* Global functions */
 void rtc_init(void)
 {
-    RTC_TimeTypeDef time;
-    RTC_DateTypeDef date;
-
     __HAL_RCC_PWR_CLK_ENABLE();
     HAL_PWR_EnableBkUpAccess();
-    __HAL_RCC_RTC_CONFIG(RCC_RTCCLKSOURCE_LSE);
 
     ctx.rtc_handler.Instance = RTC;
-    ctx.rtc_handler.Init.AsynchPrediv = 124;
-    ctx.rtc_handler.Init.SynchPrediv = 249;
+    ctx.rtc_handler.Init.AsynchPrediv = RTC_PREDIV_A;
+    ctx.rtc_handler.Init.SynchPrediv = RTC_PREDIV_S;
     ctx.rtc_handler.Init.OutPut = RTC_OUTPUT_DISABLE;
     ctx.rtc_handler.Init.OutPutPolarity = RTC_OUTPUT_POLARITY_HIGH;
     ctx.rtc_handler.Init.OutPutType = RTC_OUTPUT_TYPE_OPENDRAIN;
     ctx.rtc_handler.Init.HourFormat = RTC_HOURFORMAT_24;
 
-    HAL_RTC_Init(&ctx.rtc_handler);
-    __HAL_RCC_RTC_ENABLE();
+    if (HAL_RTCEx_BKUPRead(&ctx.rtc_handler, RTC_BKP_DR0) == RTC_BKP_MAGIC)
+    {
+        //  Calendar kept running through the reset, leave it untouched
+        ctx.rtc_handler.State = HAL_RTC_STATE_READY;
+        HAL_RTC_WaitForSynchro(&ctx.rtc_handler);
+        ctx.now = rtc_read_timestamp();
+        LOG("Time kept across reset: %lu\n\r", ctx.now);
+    }
+    else
+    {
+        //  Cold boot, the crystal takes about a second to start
+        RCC_OscInitTypeDef osc = { 0 };
+
+        osc.OscillatorType = RCC_OSCILLATORTYPE_LSE;
+        osc.LSEState = RCC_LSE_ON;
+        osc.PLL.PLLState = RCC_PLL_NONE;
+        HAL_RCC_OscConfig(&osc);
 
-    time.Hours = 12;
-    time.Minutes = 0;
-    time.Seconds = 0;
+        __HAL_RCC_RTC_CONFIG(RCC_RTCCLKSOURCE_LSE);
+        HAL_RTC_Init(&ctx.rtc_handler);
+        __HAL_RCC_RTC_ENABLE();
+
+        rtc_set_timestamp(CFG_RTC_DEFAULT_TIME);
+        LOG("Backup domain lost, time set to default\n\r");
+    }
+
+    ctx.mono_base = ctx.now;
+
+    /* Periodic wakeup clocked from the 1 Hz calendar prescaler output */
+    HAL_RTCEx_SetWakeUpTimer_IT(&ctx.rtc_handler, CFG_RTC_WAKEUP_S - 1, RTC_WAKEUPCLOCK_CK_SPRE_16BITS);
+    HAL_NVIC_SetPriority(RTC_WKUP_IRQn, RTC_WAKEUP_IRQ_PRIO, 0);
+    HAL_NVIC_EnableIRQ(RTC_WKUP_IRQn);
+
+    cmd_link_register(CMD_LINK_SET_TIME, rtc_set_command);
+}
+
+//  Broken down cached time, no RTC access
+void rtc_get_time(RTC_TimeTypeDef *time, RTC_DateTypeDef *date)
+{
+    rtc_time_from_timestamp(ctx.now, time, date);
+}
+
+//  Cached unix time, any context
+uint32_t rtc_get_timestamp(void)
+{
+    return ctx.now;
+}
+
+//  Seconds of the cached time, any context
+uint8_t rtc_get_seconds(void)
+{
+    return ctx.now % 60;
+}
+
+//  Microseconds since boot from the calendar and the sub-second counter, any context.
+//  Wraps every ~71 minutes, only differences are meaningful.
+uint32_t rtc_get_mono_us(void)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    uint32_t ssr = RTC->SSR;    // Reading SSR locks TR and DR until DR is read
+    uint32_t tr = RTC->TR;
+    uint32_t dr = RTC->DR;
+    uint32_t base = ctx.mono_base;
+
+    __set_PRIMASK(primask);
+
+    uint32_t secs = rtc_regs_to_timestamp(tr, dr) - base;
+
+    return secs * 1000000UL + ((RTC_PREDIV_S - (ssr & RTC_PREDIV_S)) * 1000000UL) / (RTC_PREDIV_S + 1);
+}
+
+//  Sets the calendar, valid for years 2000 to 2099
+void rtc_set_timestamp(uint32_t timestamp)
+{
+    RTC_TimeTypeDef time;
+    RTC_DateTypeDef date;
+
+    rtc_time_from_timestamp(timestamp, &time, &date);
     time.SubSeconds = 0;
     time.DayLightSaving = RTC_DAYLIGHTSAVING_NONE;
     time.StoreOperation = RTC_STOREOPERATION_RESET;
-    HAL_RTC_SetTime(&ctx.rtc_handler, &time, RTC_FORMAT_BIN);
 
-    date.WeekDay = RTC_WEEKDAY_THURSDAY;
-    date.Month = RTC_MONTH_JUNE;
-    date.Date = 4;
-    date.Year = 20;
+    uint32_t prev = rtc_read_timestamp();
+
+    HAL_RTC_SetTime(&ctx.rtc_handler, &time, RTC_FORMAT_BIN);
     HAL_RTC_SetDate(&ctx.rtc_handler, &date, RTC_FORMAT_BIN);
+    HAL_RTCEx_BKUPWrite(&ctx.rtc_handler, RTC_BKP_DR0, RTC_BKP_MAGIC);
+
+    ctx.mono_base += timestamp - prev;
+    ctx.now = timestamp;
 }
 
-void rtc_get_time(RTC_TimeTypeDef *time, RTC_DateTypeDef *date)
+//  Civil date of a unix time, the inverse of rtc_days_from_civil
+void rtc_time_from_timestamp(uint32_t timestamp, RTC_TimeTypeDef *time, RTC_DateTypeDef *date)
 {
-    HAL_RTC_GetTime(&ctx.rtc_handler, time, RTC_FORMAT_BIN);
-    HAL_RTC_GetDate(&ctx.rtc_handler, date, RTC_FORMAT_BIN);
+    uint32_t days = timestamp / RTC_SECONDS_PER_DAY;
+    uint32_t secs = timestamp % RTC_SECONDS_PER_DAY;
 
-//    LOG("Time: %d:%d:%d", time->Hours, time->Minutes, time->Seconds);
-//    LOG("Date: %d/%d/%d", date->Date, date->Month, date->Year);
+    time->Hours = secs / 3600;
+    time->Minutes = (secs / 60) % 60;
+    time->Seconds = secs % 60;
+
+    uint32_t z = days + 719468;
+    uint32_t era = z / 146097;
+    uint32_t doe = z - era * 146097;
+    uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    uint32_t mp = (5 * doy + 2) / 153;
+    uint32_t m = (mp < 10) ? (mp + 3) : (mp - 9);
+    uint32_t y = yoe + era * 400 + (m <= 2);
+
+    date->Date = doy - (153 * mp + 2) / 5 + 1;
+    date->Month = m;
+    date->Year = y - 2000;
+    date->WeekDay = ((days + 3) % 7) + 1;   // 1970-01-01 was a Thursday, Monday is 1
 }
 
+//  Callbacks run in interrupt context, only FromISR API is allowed
+bool rtc_register_wakeup_callback(rtc_wakeup_cb_t cb)
+{
+    if (ctx.wakeup_cb_cnt >= RTC_WAKEUP_CB_MAX)
+    {
+        return false;
+    }
+
+    ctx.wakeup_cb[ctx.wakeup_cb_cnt++] = cb;
+    return true;
+}
+
+void rtc_wakeup_irq_handler(void)
+{
+    HAL_RTCEx_WakeUpTimerIRQHandler(&ctx.rtc_handler);
+}
+
+void HAL_RTCEx_WakeUpTimerEventCallback(RTC_HandleTypeDef *hrtc)
+{
+    ctx.now = rtc_read_timestamp();
+
+    for (uint8_t i = 0; i < ctx.wakeup_cb_cnt; i++)
+    {
+        ctx.wakeup_cb[i]();
+    }
+}
 
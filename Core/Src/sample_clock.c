@@ -0,0 +1,169 @@
+/**
+ *  @file   sample_clock.c
+ *  @brief  Per-sample timestamps for FIFO batches.
+ *
+ *  The sensor samples on its own oscillator and the FIFO is drained at
+ *  whatever time the task gets to run, so a batch only tells that its newest
+ *  sample was taken before the read. The clock predicts the newest sample time
+ *  from the previous batch and the estimated period, and corrects the estimate
+ *  against the read timestamp:
+ *
+ *      - a prediction later than the read is impossible, the phase is pulled
+ *        back fully and the period shortened,
+ *      - otherwise the phase creeps towards the read, so it settles on the
+ *        earliest reads, the ones with the least scheduling delay.
+ *
+ *  The period is measured over windows of the tracked phase, so it follows
+ *  the sensor oscillator drift and samples are spaced by it instead of by the
+ *  read jitter. The creep gain starts wide after a sync and narrows with every
+ *  window as the period settles. Samples reported lost by the
+ *  FIFO overflow counter still advance the clock, a prediction far off the
+ *  read resynchronizes it and counts the missing samples.
+ */
+
+//--------------------------------------------------------------------------------
+
+/* Includes */
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "sample_clock.h"
+
+//--------------------------------------------------------------------------------
+
+/* Defines */
+#ifndef CFG_SAMPLE_CLOCK_TOL_PCT
+#define CFG_SAMPLE_CLOCK_TOL_PCT    10      /* Sensor oscillator tolerance */
+#endif
+
+#ifndef CFG_SAMPLE_CLOCK_RESYNC
+#define CFG_SAMPLE_CLOCK_RESYNC     4       /* Periods off the read to give up tracking */
+#endif
+
+#ifndef CFG_SAMPLE_CLOCK_WINDOW_MS
+#define CFG_SAMPLE_CLOCK_WINDOW_MS  4000    /* Period measurement span */
+#endif
+
+#define CLOCK_CREEP_SHIFT_MIN       2       /* Phase gain towards a later read after a sync */
+#define CLOCK_CREEP_SHIFT_MAX       8       /* ... narrowed once per window down to 1/256 */
+#define CLOCK_RATE_SHIFT            2       /* Period smoothing over windows, 1/4 */
+
+//--------------------------------------------------------------------------------
+
+/* Static function declarations */
+static void sample_clock_update_rate(struct sample_clock *clk, uint32_t span_us);
+
+//--------------------------------------------------------------------------------
+
+/* Static functions */
+
+//  Period measured over a window of tracked phase, smoothed and kept within tolerance
+static void sample_clock_update_rate(struct sample_clock *clk, uint32_t span_us)
+{
+    int32_t meas_q8 = ((uint64_t)span_us << 8) / clk->ref_steps;
+    int32_t tol_q8 = (clk->nominal_q8 * CFG_SAMPLE_CLOCK_TOL_PCT) / 100;
+    int32_t period_q8 = (int32_t)clk->period_q8 + ((meas_q8 - (int32_t)clk->period_q8) >> CLOCK_RATE_SHIFT);
+
+    if (period_q8 > (int32_t)clk->nominal_q8 + tol_q8)
+    {
+        period_q8 = clk->nominal_q8 + tol_q8;
+    }
+    else if (period_q8 < (int32_t)clk->nominal_q8 - tol_q8)
+    {
+        period_q8 = clk->nominal_q8 - tol_q8;
+    }
+
+    clk->period_q8 = period_q8;
+}
+
+//--------------------------------------------------------------------------------
+
+/* Global functions */
+void sample_clock_init(struct sample_clock *clk, uint16_t rate_hz)
+{
+    memset(clk, 0, sizeof(*clk));
+
+    clk->nominal_q8 = (1000000UL * 256) / rate_hz;
+    clk->period_q8 = clk->nominal_q8;
+}
+
+//  Registers a batch of n samples read at read_us, returns the timestamp of the first one
+uint32_t sample_clock_batch(struct sample_clock *clk, uint32_t read_us, uint8_t n, uint8_t lost)
+{
+    uint32_t steps = (uint32_t)n + lost;
+    uint32_t period = clk->period_q8 >> 8;
+
+    if (steps == 0)
+    {
+        return clk->last_us;
+    }
+
+    uint32_t adv_q8 = steps * clk->period_q8 + clk->frac;
+    uint32_t pred = clk->last_us + (adv_q8 >> 8);
+    int32_t err = (int32_t)(read_us - pred);
+
+    clk->frac = adv_q8 & 0xFF;
+
+    if (!clk->synced || (err > (int32_t)(period * CFG_SAMPLE_CLOCK_RESYNC)) ||
+            (err < -(int32_t)(period * CFG_SAMPLE_CLOCK_RESYNC)))
+    {
+        if (clk->synced)
+        {
+            clk->resyncs++;
+
+            if (err > 0)
+            {
+                clk->dropped += err / period;
+            }
+        }
+
+        clk->last_us = read_us;
+        clk->frac = 0;
+        clk->synced = true;
+        clk->ref_us = read_us;
+        clk->ref_steps = 0;
+        clk->creep_shift = CLOCK_CREEP_SHIFT_MIN;
+    }
+    else
+    {
+        //  Never later than the read, otherwise creep towards it
+        clk->last_us = pred + ((err < 0) ? err : (err >> clk->creep_shift));
+        clk->ref_steps += steps;
+
+        uint32_t span = clk->last_us - clk->ref_us;
+
+        if (span >= CFG_SAMPLE_CLOCK_WINDOW_MS * 1000UL)
+        {
+            sample_clock_update_rate(clk, span);
+            clk->ref_us = clk->last_us;
+            clk->ref_steps = 0;
+
+            if (clk->creep_shift < CLOCK_CREEP_SHIFT_MAX)
+            {
+                clk->creep_shift++;
+            }
+        }
+    }
+
+    clk->samples += n;
+    clk->dropped += lost;
+
+    if (n == 0)
+    {
+        return clk->last_us;
+    }
+
+    return clk->last_us - (((uint32_t)(n - 1) * clk->period_q8) >> 8);
+}
+
+//  Timestamp of sample i of the batch starting at first_us
+uint32_t sample_clock_at(const struct sample_clock *clk, uint32_t first_us, uint8_t i)
+{
+    return first_us + (((uint32_t)i * clk->period_q8) >> 8);
+}
+
+uint32_t sample_clock_period_us(const struct sample_clock *clk)
+{
+    return clk->period_q8 >> 8;
+}
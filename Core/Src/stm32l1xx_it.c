@@ -25,6 +25,10 @@
 #include "task.h"
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
+#include "rtc.h"
+#include "debug_log.h"
+#include "ssd1306.h"
+#include "trace_rec.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -170,14 +174,56 @@ void DebugMon_Handler(void)
 void EXTI3_IRQHandler(void)
 {
   /* USER CODE BEGIN EXTI0_IRQn 0 */
-
+  TRACE_ISR_ENTER();
   /* USER CODE END EXTI0_IRQn 0 */
   HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_3);
   /* USER CODE BEGIN EXTI0_IRQn 1 */
-
+  TRACE_ISR_EXIT();
   /* USER CODE END EXTI0_IRQn 1 */
 }
 
+void RTC_WKUP_IRQHandler(void)
+{
+  TRACE_ISR_ENTER();
+  rtc_wakeup_irq_handler();
+  TRACE_ISR_EXIT();
+}
+
+void USART2_IRQHandler(void)
+{
+  TRACE_ISR_ENTER();
+  debug_log_irq_handler();
+  TRACE_ISR_EXIT();
+}
+
+void DMA1_Channel7_IRQHandler(void)
+{
+  TRACE_ISR_ENTER();
+  debug_log_dma_irq_handler();
+  TRACE_ISR_EXIT();
+}
+
+void DMA1_Channel6_IRQHandler(void)
+{
+  TRACE_ISR_ENTER();
+  ssd1306_dma_irq_handler();
+  TRACE_ISR_EXIT();
+}
+
+void I2C1_EV_IRQHandler(void)
+{
+  TRACE_ISR_ENTER();
+  ssd1306_i2c_ev_irq_handler();
+  TRACE_ISR_EXIT();
+}
+
+void I2C1_ER_IRQHandler(void)
+{
+  TRACE_ISR_ENTER();
+  ssd1306_i2c_er_irq_handler();
+  TRACE_ISR_EXIT();
+}
+
 /******************************************************************************/
 /* STM32L1xx Peripheral Interrupt Handlers                                    */
 /* Add here the Interrupt Handlers for the used peripherals.                  */
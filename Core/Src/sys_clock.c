@@ -0,0 +1,265 @@
+/**
+ *  @file   sys_clock.c
+ *  @brief  System clock profiles, PLL on demand and MSI otherwise.
+ *
+ *  The watch face only needs a few MHz, so the core idles on MSI at 4.194 MHz
+ *  with the regulator in range 3. Measurement, display flushes and EEPROM
+ *  writes request the full profile (HSI PLL 32 MHz, range 1) and release it
+ *  when done; the PLL runs while at least one request is held.
+ *
+ *  A switch runs with the scheduler suspended. Registered drivers are called
+ *  before it to let ongoing transfers finish and after it to recompute their
+ *  bus clock dependent timings (UART divider, I2C timings, timer prescalers).
+ *  SysTick follows the core clock through HAL_InitTick.
+ */
+
+//--------------------------------------------------------------------------------
+
+/* Includes */
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "stm32l1xx_hal.h"
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+
+#include "sys_clock.h"
+#include "sys_stats.h"
+
+//--------------------------------------------------------------------------------
+
+/* Defines */
+#define SYS_CLOCK_CB_MAX        6
+
+//--------------------------------------------------------------------------------
+
+/* Static */
+struct sys_clock_context
+{
+    SemaphoreHandle_t lock;
+    sys_clock_cb_t cb[SYS_CLOCK_CB_MAX];
+    uint8_t cb_cnt;
+    uint8_t holds;
+    enum sys_clock_profile profile;
+    struct sys_clock_stats stats;
+};
+
+static struct sys_clock_context ctx;
+
+//--------------------------------------------------------------------------------
+
+/* Static function declarations */
+static void sys_clock_set_voltage(uint32_t range);
+static void sys_clock_apply(enum sys_clock_profile profile);
+static void sys_clock_switch(enum sys_clock_profile profile);
+
+//--------------------------------------------------------------------------------
+
+/* Static functions */
+static void sys_clock_set_voltage(uint32_t range)
+{
+    while (__HAL_PWR_GET_FLAG(PWR_FLAG_VOS))
+    {
+    }
+
+    __HAL_PWR_VOLTAGESCALING_CONFIG(range);
+
+    while (__HAL_PWR_GET_FLAG(PWR_FLAG_VOS))
+    {
+    }
+}
+
+static void sys_clock_apply(enum sys_clock_profile profile)
+{
+    RCC_OscInitTypeDef osc = { 0 };
+    RCC_ClkInitTypeDef clk = { 0 };
+
+    clk.ClockType = RCC_CLOCKTYPE_HCLK | RCC_CLOCKTYPE_SYSCLK | RCC_CLOCKTYPE_PCLK1 | RCC_CLOCKTYPE_PCLK2;
+    clk.AHBCLKDivider = RCC_SYSCLK_DIV1;
+    clk.APB1CLKDivider = RCC_HCLK_DIV1;
+    clk.APB2CLKDivider = RCC_HCLK_DIV1;
+
+    if (profile == SYS_CLOCK_FULL)
+    {
+        //  Range 1 before the core goes above 16 MHz
+        sys_clock_set_voltage(PWR_REGULATOR_VOLTAGE_SCALE1);
+
+        osc.OscillatorType = RCC_OSCILLATORTYPE_HSI;
+        osc.HSIState = RCC_HSI_ON;
+        osc.HSICalibrationValue = RCC_HSICALIBRATION_DEFAULT;
+        osc.PLL.PLLState = RCC_PLL_ON;
+        osc.PLL.PLLSource = RCC_PLLSOURCE_HSI;
+        osc.PLL.PLLMUL = RCC_PLL_MUL6;
+        osc.PLL.PLLDIV = RCC_PLL_DIV3;
+        HAL_RCC_OscConfig(&osc);
+
+        clk.SYSCLKSource = RCC_SYSCLKSOURCE_PLLCLK;
+        HAL_RCC_ClockConfig(&clk, FLASH_LATENCY_1);
+    }
+    else
+    {
+        osc.OscillatorType = RCC_OSCILLATORTYPE_MSI;
+        osc.MSIState = RCC_MSI_ON;
+        osc.MSICalibrationValue = RCC_MSICALIBRATION_DEFAULT;
+        osc.MSIClockRange = RCC_MSIRANGE_6;
+        osc.PLL.PLLState = RCC_PLL_NONE;
+        HAL_RCC_OscConfig(&osc);
+
+        clk.SYSCLKSource = RCC_SYSCLKSOURCE_MSI;
+        HAL_RCC_ClockConfig(&clk, FLASH_LATENCY_0);
+
+        //  Off the clock tree now, stop the PLL first and then its source
+        osc.OscillatorType = RCC_OSCILLATORTYPE_NONE;
+        osc.PLL.PLLState = RCC_PLL_OFF;
+        HAL_RCC_OscConfig(&osc);
+
+        osc.OscillatorType = RCC_OSCILLATORTYPE_HSI;
+        osc.HSIState = RCC_HSI_OFF;
+        osc.PLL.PLLState = RCC_PLL_NONE;
+        HAL_RCC_OscConfig(&osc);
+
+        sys_clock_set_voltage(PWR_REGULATOR_VOLTAGE_SCALE3);
+    }
+}
+
+//  Called with the lock held
+static void sys_clock_switch(enum sys_clock_profile profile)
+{
+    uint32_t start = sys_stats_timer_get();
+
+    vTaskSuspendAll();
+
+    for (uint8_t i = 0; i < ctx.cb_cnt; i++)
+    {
+        ctx.cb[i](SYS_CLOCK_PRE_SWITCH);
+    }
+
+    sys_clock_apply(profile);
+    ctx.profile = profile;
+
+    for (uint8_t i = 0; i < ctx.cb_cnt; i++)
+    {
+        ctx.cb[i](SYS_CLOCK_POST_SWITCH);
+    }
+
+    xTaskResumeAll();
+
+    //  Approximate, the run time counter is one of the reprogrammed timers
+    uint32_t elapsed = sys_stats_timer_get() - start;
+
+    ctx.stats.switches++;
+    ctx.stats.last_us = elapsed;
+
+    if (elapsed > ctx.stats.max_us)
+    {
+        ctx.stats.max_us = elapsed;
+    }
+}
+
+//--------------------------------------------------------------------------------
+
+/* Global functions */
+
+//  Called from main before the peripherals are initialized, drops to the low profile
+void sys_clock_init(void)
+{
+    __HAL_RCC_PWR_CLK_ENABLE();
+
+    ctx.lock = xSemaphoreCreateMutex();
+    ctx.profile = SYS_CLOCK_FULL;
+
+#if CFG_SYS_CLOCK_DYNAMIC_EN
+    sys_clock_apply(SYS_CLOCK_LOW);
+    ctx.profile = SYS_CLOCK_LOW;
+
+    //  Only the boot timer is registered this early
+    for (uint8_t i = 0; i < ctx.cb_cnt; i++)
+    {
+        ctx.cb[i](SYS_CLOCK_POST_SWITCH);
+    }
+#endif
+}
+
+//  Callbacks run with the scheduler suspended, they must not block
+bool sys_clock_register_callback(sys_clock_cb_t cb)
+{
+    bool ret = false;
+
+    taskENTER_CRITICAL();
+
+    if (ctx.cb_cnt < SYS_CLOCK_CB_MAX)
+    {
+        ctx.cb[ctx.cb_cnt++] = cb;
+        ret = true;
+    }
+
+    taskEXIT_CRITICAL();
+
+    return ret;
+}
+
+//  Holds the full profile until the matching release, task context only
+void sys_clock_request(void)
+{
+#if CFG_SYS_CLOCK_DYNAMIC_EN
+    xSemaphoreTake(ctx.lock, portMAX_DELAY);
+
+    if (ctx.holds++ == 0)
+    {
+        sys_clock_switch(SYS_CLOCK_FULL);
+    }
+
+    xSemaphoreGive(ctx.lock);
+#endif
+}
+
+void sys_clock_release(void)
+{
+#if CFG_SYS_CLOCK_DYNAMIC_EN
+    xSemaphoreTake(ctx.lock, portMAX_DELAY);
+
+    configASSERT(ctx.holds > 0);
+
+    if (--ctx.holds == 0)
+    {
+        sys_clock_switch(SYS_CLOCK_LOW);
+    }
+
+    xSemaphoreGive(ctx.lock);
+#endif
+}
+
+enum sys_clock_profile sys_clock_get_profile(void)
+{
+    return ctx.profile;
+}
+
+void sys_clock_get_stats(struct sys_clock_stats *stats)
+{
+    taskENTER_CRITICAL();
+    *stats = ctx.stats;
+    taskEXIT_CRITICAL();
+}
+
+//  Called by HAL_Init and HAL_RCC_ClockConfig. Once the kernel owns SysTick only
+//  the reload follows the new core clock, its priority is left to the port.
+HAL_StatusTypeDef HAL_InitTick(uint32_t TickPriority)
+{
+    if (xTaskGetSchedulerState() == taskSCHEDULER_NOT_STARTED)
+    {
+        if (HAL_SYSTICK_Config(SystemCoreClock / 1000U) != 0U)
+        {
+            return HAL_ERROR;
+        }
+
+        HAL_NVIC_SetPriority(SysTick_IRQn, TickPriority, 0U);
+        return HAL_OK;
+    }
+
+    SysTick->LOAD = (SystemCoreClock / configTICK_RATE_HZ) - 1UL;
+    SysTick->VAL = 0;
+
+    return HAL_OK;
+}
@@ -0,0 +1,281 @@
+/**
+ *  @file   sys_stats.c
+ *  @brief  Per-task CPU load and stack usage statistics.
+ *
+ *  The FreeRTOS run time counter is TIM5, a 32-bit timer running at 1 MHz
+ *  (wraps after ~71 min). Unlike the DWT cycle counter it keeps counting while
+ *  the core sleeps, so idle time is accounted for correctly. The prescaler is
+ *  reloaded on clock profile switches; MSI at 4.194 MHz has no integer divider
+ *  to 1 MHz, so the counter runs ~5 % fast in the low profile.
+ *
+ *  Every period a software timer takes a snapshot of all tasks and turns the
+ *  run time deltas into per mille of the period. The last snapshot is served
+ *  over the command link:
+ *
+ *      SYS_STATS   -> { period ms u16, load per mille u16, n u8,
+ *                       n * (number u8, cpu per mille u16, stack free words u16, name[8]),
+ *                       clock profile u8, switches u32, last switch us u32, max switch us u32 }
+ *
+ *  The counter is started from main right after the boot clock is up, so it
+ *  also timestamps the boot phases (enum sys_stats_boot), served as:
+ *
+ *      BOOT_TIMES  -> { n u8, n * us u32 }, 0xFFFFFFFF for a phase not reached yet
+ */
+
+//--------------------------------------------------------------------------------
+
+/* Includes */
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "stm32l1xx_hal.h"
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "timers.h"
+
+#include "sys_stats.h"
+#include "sys_clock.h"
+#include "cmd_link.h"
+
+//--------------------------------------------------------------------------------
+
+/* Defines */
+#ifndef CFG_SYS_STATS_PERIOD_MS
+#define CFG_SYS_STATS_PERIOD_MS     5000
+#endif
+
+#ifndef CFG_SYS_STATS_TASKS_MAX
+#define CFG_SYS_STATS_TASKS_MAX     8
+#endif
+
+#define SYS_STATS_NAME_LEN          8
+#define SYS_STATS_HDR_SIZE          5
+#define SYS_STATS_ENTRY_SIZE        (5 + SYS_STATS_NAME_LEN)
+#define SYS_STATS_CLOCK_SIZE        13
+
+#define SYS_STATS_BOOT_NONE         UINT32_MAX
+
+//--------------------------------------------------------------------------------
+
+/* Static */
+struct sys_stats_entry
+{
+    uint8_t number;
+    uint16_t cpu;           /* Per mille of the period */
+    uint16_t stack_free;    /* Words, lowest since the task start */
+    char name[SYS_STATS_NAME_LEN];
+};
+
+struct sys_stats_context
+{
+    TimerHandle_t timer;
+    TaskStatus_t status[CFG_SYS_STATS_TASKS_MAX];
+    uint32_t prev_runtime[CFG_SYS_STATS_TASKS_MAX];
+    uint32_t prev_total;
+
+    struct sys_stats_entry entries[CFG_SYS_STATS_TASKS_MAX];
+    uint8_t entry_cnt;
+    uint16_t load;
+
+    uint32_t boot[SYS_STATS_BOOT_MARKS];
+};
+
+static struct sys_stats_context ctx;
+
+//--------------------------------------------------------------------------------
+
+/* Static function declarations */
+static void sys_stats_sample(TimerHandle_t timer);
+static void sys_stats_report(const uint8_t *payload, size_t len);
+static void sys_stats_boot_report(const uint8_t *payload, size_t len);
+static uint32_t sys_stats_timer_prescaler(void);
+static void sys_stats_clock_changed(enum sys_clock_event evt);
+
+//--------------------------------------------------------------------------------
+
+/* Static functions */
+static void sys_stats_sample(TimerHandle_t timer)
+{
+    uint32_t total;
+    uint8_t n = uxTaskGetSystemState(ctx.status, CFG_SYS_STATS_TASKS_MAX, &total);
+    uint32_t period = total - ctx.prev_total;
+    struct sys_stats_entry entries[CFG_SYS_STATS_TASKS_MAX];
+    uint8_t cnt = 0;
+    uint16_t load = 1000;
+
+    ctx.prev_total = total;
+
+    if (period == 0)
+    {
+        return;
+    }
+
+    for (uint8_t i = 0; i < n; i++)
+    {
+        const TaskStatus_t *st = &ctx.status[i];
+        uint8_t slot = st->xTaskNumber % CFG_SYS_STATS_TASKS_MAX;
+        uint32_t delta = st->ulRunTimeCounter - ctx.prev_runtime[slot];
+
+        ctx.prev_runtime[slot] = st->ulRunTimeCounter;
+
+        entries[cnt].number = st->xTaskNumber;
+        entries[cnt].cpu = ((uint64_t)delta * 1000) / period;
+        entries[cnt].stack_free = st->usStackHighWaterMark;
+        strncpy(entries[cnt].name, st->pcTaskName, SYS_STATS_NAME_LEN);
+
+        if (st->xHandle == xTaskGetIdleTaskHandle())
+        {
+            load = (entries[cnt].cpu < 1000) ? (1000 - entries[cnt].cpu) : 0;
+        }
+
+        cnt++;
+    }
+
+    taskENTER_CRITICAL();
+    memcpy(ctx.entries, entries, sizeof(entries));
+    ctx.entry_cnt = cnt;
+    ctx.load = load;
+    taskEXIT_CRITICAL();
+}
+
+static void sys_stats_report(const uint8_t *payload, size_t len)
+{
+    uint8_t rsp[SYS_STATS_HDR_SIZE + CFG_SYS_STATS_TASKS_MAX * SYS_STATS_ENTRY_SIZE + SYS_STATS_CLOCK_SIZE];
+    struct sys_stats_entry entries[CFG_SYS_STATS_TASKS_MAX];
+    struct sys_clock_stats clock;
+    uint8_t cnt;
+    uint16_t load;
+
+    taskENTER_CRITICAL();
+    memcpy(entries, ctx.entries, sizeof(entries));
+    cnt = ctx.entry_cnt;
+    load = ctx.load;
+    taskEXIT_CRITICAL();
+
+    rsp[0] = CFG_SYS_STATS_PERIOD_MS & 0xFF;
+    rsp[1] = CFG_SYS_STATS_PERIOD_MS >> 8;
+    rsp[2] = load & 0xFF;
+    rsp[3] = load >> 8;
+    rsp[4] = cnt;
+
+    for (uint8_t i = 0; i < cnt; i++)
+    {
+        uint8_t *out = &rsp[SYS_STATS_HDR_SIZE + i * SYS_STATS_ENTRY_SIZE];
+
+        out[0] = entries[i].number;
+        out[1] = entries[i].cpu & 0xFF;
+        out[2] = entries[i].cpu >> 8;
+        out[3] = entries[i].stack_free & 0xFF;
+        out[4] = entries[i].stack_free >> 8;
+        memcpy(&out[5], entries[i].name, SYS_STATS_NAME_LEN);
+    }
+
+    //  Clock profile switches, the on-target view of sys_clock
+    uint8_t *out = &rsp[SYS_STATS_HDR_SIZE + cnt * SYS_STATS_ENTRY_SIZE];
+    uint32_t val[3];
+
+    sys_clock_get_stats(&clock);
+    val[0] = clock.switches;
+    val[1] = clock.last_us;
+    val[2] = clock.max_us;
+    out[0] = sys_clock_get_profile();
+
+    for (uint8_t i = 0; i < 12; i++)
+    {
+        out[1 + i] = val[i / 4] >> ((i % 4) * 8);
+    }
+
+    cmd_link_send(CMD_LINK_SYS_STATS | CMD_LINK_RSP, rsp, SYS_STATS_HDR_SIZE + cnt * SYS_STATS_ENTRY_SIZE + SYS_STATS_CLOCK_SIZE);
+}
+
+static void sys_stats_boot_report(const uint8_t *payload, size_t len)
+{
+    uint8_t rsp[1 + SYS_STATS_BOOT_MARKS * 4];
+
+    rsp[0] = SYS_STATS_BOOT_MARKS;
+
+    for (uint8_t i = 0; i < SYS_STATS_BOOT_MARKS * 4; i++)
+    {
+        rsp[1 + i] = ctx.boot[i / 4] >> ((i % 4) * 8);
+    }
+
+    cmd_link_send(CMD_LINK_BOOT_TIMES | CMD_LINK_RSP, rsp, sizeof(rsp));
+}
+
+//  APB1 runs undivided, so the timer clock is PCLK1
+static uint32_t sys_stats_timer_prescaler(void)
+{
+    return ((HAL_RCC_GetPCLK1Freq() + SYS_STATS_TIMER_HZ / 2) / SYS_STATS_TIMER_HZ) - 1;
+}
+
+//  The update event loads the new prescaler and clears the counter, the count is carried over
+static void sys_stats_clock_changed(enum sys_clock_event evt)
+{
+    if (evt == SYS_CLOCK_POST_SWITCH)
+    {
+        uint32_t cnt = TIM5->CNT;
+
+        TIM5->PSC = sys_stats_timer_prescaler();
+        TIM5->EGR = TIM_EGR_UG;
+        TIM5->CNT = cnt;
+    }
+}
+
+//--------------------------------------------------------------------------------
+
+/* Global functions */
+bool sys_stats_init(void)
+{
+    ctx.timer = xTimerCreate("stats", pdMS_TO_TICKS(CFG_SYS_STATS_PERIOD_MS), pdTRUE, NULL, sys_stats_sample);
+
+    if ((ctx.timer == NULL) || (xTimerStart(ctx.timer, 0) != pdPASS))
+    {
+        return false;
+    }
+
+    return cmd_link_register(CMD_LINK_SYS_STATS, sys_stats_report) &&
+            cmd_link_register(CMD_LINK_BOOT_TIMES, sys_stats_boot_report);
+}
+
+//  Called from main once the boot clock is up and again as
+//  portCONFIGURE_TIMER_FOR_RUN_TIME_STATS by vTaskStartScheduler
+void sys_stats_timer_init(void)
+{
+    if (TIM5->CR1 & TIM_CR1_CEN)
+    {
+        return;
+    }
+
+    for (uint8_t i = 0; i < SYS_STATS_BOOT_MARKS; i++)
+    {
+        ctx.boot[i] = SYS_STATS_BOOT_NONE;
+    }
+
+    __HAL_RCC_TIM5_CLK_ENABLE();
+
+    TIM5->CR1 = 0;
+    TIM5->PSC = sys_stats_timer_prescaler();
+    TIM5->ARR = UINT32_MAX;
+    TIM5->CNT = 0;
+    TIM5->EGR = TIM_EGR_UG;
+    TIM5->CR1 = TIM_CR1_CEN;
+
+    sys_clock_register_callback(sys_stats_clock_changed);
+}
+
+//  portGET_RUN_TIME_COUNTER_VALUE
+uint32_t sys_stats_timer_get(void)
+{
+    return TIM5->CNT;
+}
+
+//  Microseconds since the counter start, only the first mark of a phase is kept
+void sys_stats_boot_mark(enum sys_stats_boot mark)
+{
+    if (ctx.boot[mark] == SYS_STATS_BOOT_NONE)
+    {
+        ctx.boot[mark] = TIM5->CNT;
+    }
+}
@@ -0,0 +1,102 @@
+/**
+ *  @file   text_fmt.c
+ *  @brief  Allocation free integer formatting for the display.
+ *
+ *  The screens only show small unsigned numbers: clock fields, dates and the
+ *  measured values with their unit. These helpers cover that instead of
+ *  snprintf, whose formatter costs a few hundred bytes of stack per call and
+ *  parses the format string every frame.
+ *
+ *  Every function writes at dst, terminates the string and returns a pointer
+ *  to the terminator, so calls chain to build a line. The caller sizes the
+ *  buffer, nothing is truncated.
+ */
+
+//--------------------------------------------------------------------------------
+
+/* Includes */
+#include <stdint.h>
+
+#include "text_fmt.h"
+
+//--------------------------------------------------------------------------------
+
+/* Global functions */
+char *text_fmt_str(char *dst, const char *str)
+{
+    while (*str)
+    {
+        *dst++ = *str++;
+    }
+
+    *dst = '\0';
+    return dst;
+}
+
+char *text_fmt_uint(char *dst, uint32_t val)
+{
+    char digits[10];
+    uint8_t n = 0;
+
+    do
+    {
+        digits[n++] = '0' + (val % 10);
+        val /= 10;
+    } while (val);
+
+    while (n)
+    {
+        *dst++ = digits[--n];
+    }
+
+    *dst = '\0';
+    return dst;
+}
+
+//  Two digits, zero padded, values above 99 keep their last two digits
+char *text_fmt_u2(char *dst, uint8_t val)
+{
+    val %= 100;
+
+    dst[0] = '0' + (val / 10);
+    dst[1] = '0' + (val % 10);
+    dst[2] = '\0';
+
+    return &dst[2];
+}
+
+char *text_fmt_hhmm(char *dst, uint8_t hours, uint8_t minutes)
+{
+    dst = text_fmt_u2(dst, hours);
+    *dst++ = ':';
+
+    return text_fmt_u2(dst, minutes);
+}
+
+char *text_fmt_hhmmss(char *dst, uint8_t hours, uint8_t minutes, uint8_t seconds)
+{
+    dst = text_fmt_hhmm(dst, hours, minutes);
+    *dst++ = ':';
+
+    return text_fmt_u2(dst, seconds);
+}
+
+//  DD/MM/20YY, the RTC year counts from 2000
+char *text_fmt_date(char *dst, uint8_t day, uint8_t month, uint8_t year)
+{
+    dst = text_fmt_u2(dst, day);
+    *dst++ = '/';
+    dst = text_fmt_u2(dst, month);
+    dst = text_fmt_str(dst, "/20");
+
+    return text_fmt_u2(dst, year);
+}
+
+//  prefix, value and unit, e.g. "HRV " 42 "ms", either string may be empty
+char *text_fmt_value(char *dst, const char *prefix, uint32_t val, const char *unit)
+{
+    dst = text_fmt_str(dst, prefix);
+    dst = text_fmt_uint(dst, val);
+
+    return text_fmt_str(dst, unit);
+}
@@ -0,0 +1,218 @@
+/**
+ *  @file   trace_rec.c
+ *  @brief  Scheduler and interrupt trace recorder.
+ *
+ *  FreeRTOS trace macros, interrupt handlers and driver spans write 8 byte
+ *  events into a RAM ring, the oldest events are overwritten. Timestamps come
+ *  from the run time stats timer (1 us). Queue events are only recorded for
+ *  queues named with trace_rec_name_queue(), which leaves out the mutexes and
+ *  semaphores.
+ *
+ *  TRACE_DUMP freezes the recorder and sends it over the command link:
+ *
+ *      -> TRACE_INFO   { timer Hz u32, events u16, overwritten u32,
+ *                        n tasks u8, n * (number u8, name[8]),
+ *                        n queues u8, n * (number u8, name[8]) }
+ *      -> TRACE_DATA   { n u8, n * (time u32, type u8, id u8, arg u16) } ...
+ *      -> TRACE_END    { }
+ *
+ *  Events are sent oldest first, the ring is cleared afterwards.
+ */
+
+//--------------------------------------------------------------------------------
+
+/* Includes */
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "stm32l1xx_hal.h"
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+
+#include "trace_rec.h"
+#include "sys_stats.h"
+#include "cmd_link.h"
+
+//--------------------------------------------------------------------------------
+
+/* Defines */
+#ifndef CFG_TRACE_REC_LEN
+#define CFG_TRACE_REC_LEN       512     /* Events, power of two */
+#endif
+
+#define TRACE_QUEUES_MAX        4
+#define TRACE_TASKS_MAX         8
+#define TRACE_NAME_LEN          8
+#define TRACE_EVENT_SIZE        8
+#define TRACE_DATA_EVENTS       ((CMD_LINK_PAYLOAD_MAX - 1) / TRACE_EVENT_SIZE)
+
+//--------------------------------------------------------------------------------
+
+/* Static */
+struct trace_rec_entry
+{
+    uint32_t time;
+    uint8_t type;
+    uint8_t id;
+    uint16_t arg;
+};
+
+struct trace_rec_context
+{
+    struct trace_rec_entry ring[CFG_TRACE_REC_LEN];
+    uint32_t head;          /* Total events written */
+    bool frozen;
+    uint8_t last_task;
+
+    const char *queue_names[TRACE_QUEUES_MAX];
+    uint8_t queue_cnt;
+
+    TaskStatus_t status[TRACE_TASKS_MAX];
+    uint8_t buf[CMD_LINK_PAYLOAD_MAX];
+};
+
+static struct trace_rec_context ctx;
+
+//--------------------------------------------------------------------------------
+
+/* Static function declarations */
+static void put_u32(uint8_t *buf, uint32_t val);
+static uint8_t trace_rec_put_name(uint8_t *out, uint8_t number, const char *name);
+static void trace_rec_dump(const uint8_t *payload, size_t len);
+
+//--------------------------------------------------------------------------------
+
+/* Static functions */
+static void put_u32(uint8_t *buf, uint32_t val)
+{
+    buf[0] = val;
+    buf[1] = val >> 8;
+    buf[2] = val >> 16;
+    buf[3] = val >> 24;
+}
+
+static uint8_t trace_rec_put_name(uint8_t *out, uint8_t number, const char *name)
+{
+    out[0] = number;
+    strncpy((char *)&out[1], name, TRACE_NAME_LEN);
+
+    return 1 + TRACE_NAME_LEN;
+}
+
+static void trace_rec_dump(const uint8_t *payload, size_t len)
+{
+    uint32_t total;
+    uint8_t tasks = uxTaskGetSystemState(ctx.status, TRACE_TASKS_MAX, &total);
+    uint8_t *out = ctx.buf;
+
+    ctx.frozen = true;
+
+    uint32_t count = (ctx.head < CFG_TRACE_REC_LEN) ? ctx.head : CFG_TRACE_REC_LEN;
+    uint32_t overwritten = ctx.head - count;
+
+    put_u32(&out[0], SYS_STATS_TIMER_HZ);
+    out[4] = count & 0xFF;
+    out[5] = count >> 8;
+    put_u32(&out[6], overwritten);
+    out += 10;
+
+    *out++ = tasks;
+    for (uint8_t i = 0; i < tasks; i++)
+    {
+        out += trace_rec_put_name(out, ctx.status[i].xTaskNumber, ctx.status[i].pcTaskName);
+    }
+
+    *out++ = ctx.queue_cnt;
+    for (uint8_t i = 0; i < ctx.queue_cnt; i++)
+    {
+        out += trace_rec_put_name(out, i + 1, ctx.queue_names[i]);
+    }
+
+    cmd_link_send(CMD_LINK_TRACE_DUMP | CMD_LINK_RSP, ctx.buf, out - ctx.buf);
+
+    uint8_t n = 0;
+
+    for (uint32_t i = ctx.head - count; i != ctx.head; i++)
+    {
+        const struct trace_rec_entry *ev = &ctx.ring[i & (CFG_TRACE_REC_LEN - 1)];
+        uint8_t *p = &ctx.buf[1 + n * TRACE_EVENT_SIZE];
+
+        put_u32(&p[0], ev->time);
+        p[4] = ev->type;
+        p[5] = ev->id;
+        p[6] = ev->arg;
+        p[7] = ev->arg >> 8;
+
+        if (++n == TRACE_DATA_EVENTS)
+        {
+            ctx.buf[0] = n;
+            cmd_link_send(CMD_LINK_RSP_TRACE_DATA, ctx.buf, 1 + n * TRACE_EVENT_SIZE);
+            n = 0;
+        }
+    }
+
+    if (n)
+    {
+        ctx.buf[0] = n;
+        cmd_link_send(CMD_LINK_RSP_TRACE_DATA, ctx.buf, 1 + n * TRACE_EVENT_SIZE);
+    }
+
+    cmd_link_send(CMD_LINK_RSP_TRACE_END, NULL, 0);
+
+    taskENTER_CRITICAL();
+    ctx.head = 0;
+    ctx.frozen = false;
+    taskEXIT_CRITICAL();
+}
+
+//--------------------------------------------------------------------------------
+
+/* Global functions */
+bool trace_rec_init(void)
+{
+    return cmd_link_register(CMD_LINK_TRACE_DUMP, trace_rec_dump);
+}
+
+//  Any context, including PendSV and interrupts above the syscall priority
+void trace_rec_event(uint8_t type, uint8_t id, uint16_t arg)
+{
+    uint32_t primask = __get_PRIMASK();
+
+    __disable_irq();
+
+    if (!ctx.frozen)
+    {
+        struct trace_rec_entry *ev = &ctx.ring[ctx.head & (CFG_TRACE_REC_LEN - 1)];
+
+        ev->time = sys_stats_timer_get();
+        ev->type = type;
+        ev->id = id;
+        ev->arg = arg;
+        ctx.head++;
+    }
+
+    __set_PRIMASK(primask);
+}
+
+//  traceTASK_SWITCHED_IN, the kernel switches in the same task on most ticks
+void trace_rec_task_switch(uint8_t task)
+{
+    if (task != ctx.last_task)
+    {
+        ctx.last_task = task;
+        trace_rec_event(TRACE_EV_TASK_SWITCH, task, 0);
+    }
+}
+
+//  Enables queue event recording for the queue, call before the scheduler starts
+void trace_rec_name_queue(void *queue, const char *name)
+{
+    if (ctx.queue_cnt < TRACE_QUEUES_MAX)
+    {
+        ctx.queue_names[ctx.queue_cnt++] = name;
+        vQueueSetQueueNumber((QueueHandle_t)queue, ctx.queue_cnt);
+    }
+}
@@ -12,9 +12,12 @@
 
 #include "stm32l1xx_hal.h"
 
+#include "FreeRTOS.h"
+#include "task.h"
+#include "timers.h"
+
 #include "ui.h"
 #include "debug_log.h"
-#include "hr_app.h"
 
 //--------------------------------------------------------------------------------
 
@@ -37,13 +40,53 @@
 #define USER_BUTTON_PORT    GPIOB
 #define USER_BUTTON_PIN     GPIO_PIN_3
 
+#ifndef CFG_BUTTON_ACTIVE_HIGH
+#define CFG_BUTTON_ACTIVE_HIGH      1
+#endif
+
+#ifndef CFG_BUTTON_DEBOUNCE_MS
+#define CFG_BUTTON_DEBOUNCE_MS      30      /* Level must be stable this long */
+#endif
+
+#ifndef CFG_BUTTON_LONG_MS
+#define CFG_BUTTON_LONG_MS          800     /* Held down from the first edge */
+#endif
+
+#ifndef CFG_BUTTON_DOUBLE_MS
+#define CFG_BUTTON_DOUBLE_MS        0       /* Second press window, delays every short press, 0 disables */
+#endif
+
+#define BUTTON_SUBSCRIBERS_MAX      3
+
 //--------------------------------------------------------------------------------
 
 /* Static */
+enum button_state
+{
+    BUTTON_IDLE,
+    BUTTON_PRESSED,
+    BUTTON_WAIT_DOUBLE,
+    BUTTON_HELD             /* Event already sent, wait for the release */
+};
+
+struct button_subscriber
+{
+    TaskHandle_t task;
+    uint8_t shift;
+};
+
 struct ui_context
 {
-    char dummy;
-    bool test;
+    TimerHandle_t debounce_timer;
+    TimerHandle_t gesture_timer;
+    enum button_state state;
+    bool level;
+    volatile TickType_t edge_tick;      /* First edge of the current bounce burst */
+    volatile bool bouncing;             /* edge_tick latched, until the debounce timer fires */
+    TickType_t press_tick;
+
+    struct button_subscriber subscribers[BUTTON_SUBSCRIBERS_MAX];
+    uint8_t subscriber_cnt;
 };
 
 static struct ui_context ctx;
@@ -51,10 +94,101 @@ static struct ui_context ctx;
 //--------------------------------------------------------------------------------
 
 /* Static function declarations */
+static bool button_is_pressed(void);
+static void button_emit(uint32_t event);
+static void button_debounce_callback(TimerHandle_t timer);
+static void button_gesture_callback(TimerHandle_t timer);
 
 //--------------------------------------------------------------------------------
 
 /* Static functions */
+static bool button_is_pressed(void)
+{
+    return HAL_GPIO_ReadPin(USER_BUTTON_PORT, USER_BUTTON_PIN) == (CFG_BUTTON_ACTIVE_HIGH ? GPIO_PIN_SET : GPIO_PIN_RESET);
+}
+
+static void button_emit(uint32_t event)
+{
+    LOG("Button %s", (event == BUTTON_EVT_SHORT) ? "short" : ((event == BUTTON_EVT_LONG) ? "long" : "double"));
+
+    for (uint8_t i = 0; i < ctx.subscriber_cnt; i++)
+    {
+        xTaskNotify(ctx.subscribers[i].task, event << ctx.subscribers[i].shift, eSetBits);
+    }
+}
+
+//  Timer daemon context, the level has been stable for the debounce time
+static void button_debounce_callback(TimerHandle_t timer)
+{
+    TickType_t edge = ctx.edge_tick;
+    bool level;
+
+    //  An edge from here on starts a new burst
+    ctx.bouncing = false;
+    level = button_is_pressed();
+
+    if (level == ctx.level)
+    {
+        return;     // Glitch
+    }
+
+    ctx.level = level;
+
+    if (level)
+    {
+        ctx.press_tick = edge;
+
+        if (ctx.state == BUTTON_WAIT_DOUBLE)
+        {
+            xTimerStop(ctx.gesture_timer, 0);
+            ctx.state = BUTTON_HELD;
+            button_emit(BUTTON_EVT_DOUBLE);
+        }
+        else
+        {
+            //  Long press is measured from the first edge, not the debounced one
+            TickType_t held = xTaskGetTickCount() - ctx.press_tick;
+            TickType_t left = (pdMS_TO_TICKS(CFG_BUTTON_LONG_MS) > held) ? (pdMS_TO_TICKS(CFG_BUTTON_LONG_MS) - held) : 1;
+
+            ctx.state = BUTTON_PRESSED;
+            xTimerChangePeriod(ctx.gesture_timer, left, 0);
+        }
+    }
+    else if (ctx.state == BUTTON_PRESSED)
+    {
+        xTimerStop(ctx.gesture_timer, 0);
+
+        if (CFG_BUTTON_DOUBLE_MS)
+        {
+            ctx.state = BUTTON_WAIT_DOUBLE;
+            xTimerChangePeriod(ctx.gesture_timer, pdMS_TO_TICKS(CFG_BUTTON_DOUBLE_MS), 0);
+        }
+        else
+        {
+            ctx.state = BUTTON_IDLE;
+            button_emit(BUTTON_EVT_SHORT);
+        }
+    }
+    else
+    {
+        ctx.state = BUTTON_IDLE;
+    }
+}
+
+//  Timer daemon context, long press or end of the double press window
+static void button_gesture_callback(TimerHandle_t timer)
+{
+    if (ctx.state == BUTTON_PRESSED)
+    {
+        ctx.state = BUTTON_HELD;
+        button_emit(BUTTON_EVT_LONG);
+    }
+    else if (ctx.state == BUTTON_WAIT_DOUBLE)
+    {
+        ctx.state = BUTTON_IDLE;
+        button_emit(BUTTON_EVT_SHORT);
+    }
+}
 
 //--------------------------------------------------------------------------------
 
@@ -96,17 +230,19 @@ void button_init(void)
 bool button_polling_readstate(void)
 {
     return HAL_GPIO_ReadPin(USER_BUTTON_PORT, USER_BUTTON_PIN);
-//    return ctx.test;
 }
 
 void button_interrupt_init(void)
 {
     GPIO_InitTypeDef GPIO_InitStruct;
 
+    ctx.debounce_timer = xTimerCreate("btn", pdMS_TO_TICKS(CFG_BUTTON_DEBOUNCE_MS), pdFALSE, NULL, button_debounce_callback);
+    ctx.gesture_timer = xTimerCreate("btn2", pdMS_TO_TICKS(CFG_BUTTON_LONG_MS), pdFALSE, NULL, button_gesture_callback);
+
     __GPIOB_CLK_ENABLE();
 
     GPIO_InitStruct.Pin = USER_BUTTON_PIN;
-    GPIO_InitStruct.Mode = GPIO_MODE_IT_RISING;
+    GPIO_InitStruct.Mode = GPIO_MODE_IT_RISING_FALLING;
     GPIO_InitStruct.Pull = GPIO_NOPULL;
     GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_HIGH;
 
@@ -116,19 +252,35 @@ void button_interrupt_init(void)
     HAL_NVIC_EnableIRQ(EXTI3_IRQn);
 }
 
+//  Delivers BUTTON_EVT_* bits shifted left by shift to the task notification value
+bool button_subscribe(TaskHandle_t task, uint8_t shift)
+{
+    if (ctx.subscriber_cnt >= BUTTON_SUBSCRIBERS_MAX)
+    {
+        return false;
+    }
+
+    ctx.subscribers[ctx.subscriber_cnt].task = task;
+    ctx.subscribers[ctx.subscriber_cnt].shift = shift;
+    ctx.subscriber_cnt++;
+
+    return true;
+}
+
+//  Both edges, timestamps the first one of a burst and restarts the debounce timer
 void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin)
 {
-    if (GPIO_Pin == USER_BUTTON_PIN)
+    BaseType_t woken = pdFALSE;
+
+    if ((GPIO_Pin == USER_BUTTON_PIN) && (ctx.debounce_timer != NULL))
     {
-//        for (uint32_t i = 0; i < 333000; i++)
-//        {
-//            asm("NOP");
-//        }
-//
-//        if (!button_polling_readstate())
-//        {
-            LOG("Button irq!");
-            hr_app_switch_on_off();
-//        }
+        if (!ctx.bouncing)
+        {
+            ctx.edge_tick = xTaskGetTickCountFromISR();
+            ctx.bouncing = true;
+        }
+
+        xTimerResetFromISR(ctx.debounce_timer, &woken);
+        portYIELD_FROM_ISR(woken);
     }
 }
@@ -1,6 +1,30 @@
 /**
  *  @file   ssd1306.c
  *  @brief  -
+ *
+ *  Drawing goes to the back buffer while the front buffer is sent. A flush
+ *  waits for the previous one, swaps the buffers and starts an I2C DMA chain
+ *  over the dirty spans of the new front: per page a column/page window
+ *  transfer and a data transfer, started one after the other from the
+ *  completion interrupt. The new back buffer is one frame behind, the same
+ *  spans are copied over from the front before drawing resumes, so the
+ *  dirty spans stay relative to what the panel shows.
+ *
+ *  Every buffer has a spare byte in front of the pixels. The data control
+ *  byte is written into the byte preceding a span for its transfer and the
+ *  pixel restored afterwards, so spans go out straight from the framebuffer.
+ *
+ *  Lines, rectangles and clears are rasterized as vertical spans: the area is
+ *  clipped once, then every page it covers gets one column run with a byte
+ *  mask for the partial top and bottom rows. Full bytes are written with
+ *  memset and each run extends the page dirty span once, only the Bresenham
+ *  line and the glyphs still go through single pixels.
+ *
+ *  Bitmaps share the framebuffer layout, so a blit combines whole bytes: a
+ *  destination page takes the low bits of one source page and the high bits
+ *  of the next one, shifted by the y offset, under a mask of the bitmap rows.
+ *  Packed fonts (tools/fontgen.py) store their glyphs the same way and are
+ *  drawn with the same blit, the index gives the glyph of a char directly.
  */
 
 //--------------------------------------------------------------------------------
@@ -9,11 +33,20 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "stm32l1xx_hal.h"
 
+#include "FreeRTOS.h"
+#include "semphr.h"
+
 #include "ssd1306.h"
 #include "debug_log.h"
+#include "trace_rec.h"
+#include "sys_clock.h"
+#include "sys_stats.h"
+#include "metrics.h"
+#include "ramfunc.h"
 
 //--------------------------------------------------------------------------------
 
@@ -34,44 +67,378 @@
 #define SSD1306_I2C_PIN_SCL     GPIO_PIN_8
 #define SSD1306_I2C_PIN_SDA     GPIO_PIN_9
 #define SSD1306_I2Cx            I2C1
+#define SSD1306_DMA_TX          DMA1_Channel6
+
+#define SSD1306_IRQ_PRIO        6
 
 #define SSD1306_I2C_ADDR        (0x3C << 1)
 
+#define SSD1306_PAGES           (SSD1306_HEIGHT / 8)
+#define SSD1306_BUFFER_SIZE     (SSD1306_WIDTH * SSD1306_PAGES)
+#define SSD1306_CLEAN           0xFF    /* Dirty span start of a clean page */
+
 #define SWAP_INT(_a, _b) { int t = _a; _a = _b; _b = t; }
 
 //--------------------------------------------------------------------------------
 
 /* Static */
+struct ssd1306_dirty
+{
+    uint8_t x0;
+    uint8_t x1;
+};
+
+enum ssd1306_flush_state
+{
+    FLUSH_IDLE,
+    FLUSH_WINDOW,
+    FLUSH_DATA
+};
+
 struct ssd1306_context
 {
     I2C_HandleTypeDef handle;
-    uint8_t buffer[SSD1306_WIDTH * SSD1306_HEIGHT / 8];
+    DMA_HandleTypeDef dma_tx;
+    uint8_t fb[2][1 + SSD1306_BUFFER_SIZE];     /* Spare byte for the control byte, then pixels */
+    uint8_t *buffer;                            /* Back buffer, drawn into */
+    uint8_t *front;                             /* Being sent or on the panel */
     struct ssd1306_transformations ssd1306;
+    struct ssd1306_dirty dirty[SSD1306_PAGES];  /* Back buffer columns that differ from the panel */
+    struct ssd1306_stats stats;
+
+    struct
+    {
+        SemaphoreHandle_t done;
+        volatile enum ssd1306_flush_state state;
+        volatile bool failed;
+        struct ssd1306_dirty span[SSD1306_PAGES];
+        uint8_t page;
+        uint8_t saved;                          /* Pixel under the control byte */
+        uint8_t window[7];
+        uint32_t start_us;
+    } flush;
 };
 
 static struct ssd1306_context ctx;
 
+//  Sent as one command stream, the panel is switched on after the first frame
+static const uint8_t ssd1306_init_seq[] =
+{
+    0xAE,           // Display off
+    0x20, 0x00,     // Horizontal addressing mode
+    0xB0,           // Page start address for page addressing mode
+#ifdef SSD1306_MIRROR_VERT
+    0xC0,           // Mirror vertically
+#else
+    0xC8,           // COM output scan direction
+#endif
+    0x00,           // Low column address
+    0x10,           // High column address
+    0x40,           // Start line address
+    0x81, 0xFF,     // Contrast
+#ifdef SSD1306_MIRROR_HORIZ
+    0xA0,           // Mirror horizontally
+#else
+    0xA1,           // Segment re-map 0 to 127
+#endif
+#ifdef SSD1306_INVERSE_COLOR
+    0xA7,           // Inverse color
+#else
+    0xA6,           // Normal color
+#endif
+#if (SSD1306_HEIGHT == 128)
+    0xFF,           // Multiplex ratio, found in the Luma Python lib for SH1106
+#else
+    0xA8,           // Multiplex ratio
+#endif
+#if (SSD1306_HEIGHT == 32)
+    0x1F,
+#elif (SSD1306_HEIGHT == 64)
+    0x3F,
+#elif (SSD1306_HEIGHT == 128)
+    0x3F,           // Seems to work for 128px high displays too
+#else
+#error "Only 32, 64, or 128 lines of height are supported!"
+#endif
+    0xA4,           // Output follows RAM content
+    0xD3, 0x00,     // Display offset
+    0xD5, 0xF0,     // Display clock divide ratio / oscillator frequency
+    0xD9, 0x22,     // Pre-charge period
+    0xDA,           // COM pins hardware configuration
+#if (SSD1306_HEIGHT == 32)
+    0x02,
+#else
+    0x12,
+#endif
+    0xDB, 0x20,     // VCOMH 0.77 x Vcc
+    0x8D, 0x14      // DC-DC enable
+};
+
 //--------------------------------------------------------------------------------
 
 /* Static function declarations */
-static void ssd1306_write_cmd(uint8_t byte);
-static void ssd1306_write_data(uint8_t* buffer, size_t buff_size);
+static void ssd1306_clock_changed(enum sys_clock_event evt);
+static void ssd1306_write_cmds(const uint8_t *cmds, size_t len);
+static void ssd1306_set_byte(uint16_t index, uint8_t byte);
+static void ssd1306_mark_dirty(uint8_t page, uint8_t x0, uint8_t x1);
+static void ssd1306_fill_span(uint8_t page, uint8_t x0, uint8_t x1, uint8_t mask, enum ssd1306_color color);
+static void ssd1306_fill_area(int x, int y, int w, int h, enum ssd1306_color color);
+static uint8_t ssd1306_bitmap_rows(const struct ssd1306_bitmap *bmp, int page);
+static void ssd1306_blit(int x, int y, const struct ssd1306_bitmap *bmp, enum ssd1306_blit mode, bool invert);
+static void ssd1306_flush_next(void);
 
 static void ssd1306_write_line(int x_start, int y_start, int x_end, int y_end, enum ssd1306_color color);
-static void ssd1306_write_fast_vline(int x_start, int y_start, int h, enum ssd1306_color color);
-static void ssd1306_write_fast_hline(int x_start, int y_start, int w, enum ssd1306_color color);
 
 //--------------------------------------------------------------------------------
 
 /* Static functions */
-static void ssd1306_write_cmd(uint8_t byte) {
+//  FREQ, CCR and TRISE follow PCLK1, transfers only run in the full profile.
+//  The scheduler is suspended, a running flush is waited for by polling.
+static void ssd1306_clock_changed(enum sys_clock_event evt)
+{
+    if (evt == SYS_CLOCK_PRE_SWITCH)
+    {
+        while (ctx.flush.state != FLUSH_IDLE)
+        {
+        }
+    }
+    else
+    {
+        HAL_I2C_Init(&ctx.handle);
+        __HAL_I2C_ENABLE(&ctx.handle);
+    }
+}
 
-	HAL_I2C_Mem_Write(&ctx.handle, SSD1306_I2C_ADDR, 0x00, 1, &byte, 1, HAL_MAX_DELAY);
+//  Control byte 0x00 with Co clear, every following byte is a command
+static void ssd1306_write_cmds(const uint8_t *cmds, size_t len)
+{
+    HAL_I2C_Mem_Write(&ctx.handle, SSD1306_I2C_ADDR, 0x00, 1, (uint8_t *)cmds, len, HAL_MAX_DELAY);
+    ctx.stats.bytes += 2 + len;
+    metrics_add(METRICS_OLED_BYTES, 2 + len);
 }
 
-static void ssd1306_write_data(uint8_t* buffer, size_t buff_size)
+//  Starts the next transfer of the flush chain, task or I2C interrupt context
+static void ssd1306_flush_next(void)
 {
-	HAL_I2C_Mem_Write(&ctx.handle, SSD1306_I2C_ADDR, 0x40, 1, buffer, buff_size, HAL_MAX_DELAY);
+    BaseType_t woken = pdFALSE;
+    struct ssd1306_dirty *d;
+
+    if (ctx.flush.state == FLUSH_WINDOW)
+    {
+        //  Window set, the span follows behind its data control byte
+        d = &ctx.flush.span[ctx.flush.page];
+        uint8_t *data = &ctx.front[1 + SSD1306_WIDTH * ctx.flush.page + d->x0];
+
+        ctx.flush.saved = data[-1];
+        data[-1] = 0x40;
+        ctx.flush.state = FLUSH_DATA;
+
+        if (HAL_I2C_Master_Transmit_DMA(&ctx.handle, SSD1306_I2C_ADDR, &data[-1], d->x1 - d->x0 + 2) == HAL_OK)
+        {
+            return;
+        }
+
+        data[-1] = ctx.flush.saved;
+        ctx.flush.failed = true;
+    }
+    else
+    {
+        while ((ctx.flush.page < SSD1306_PAGES) && (ctx.flush.span[ctx.flush.page].x0 == SSD1306_CLEAN))
+        {
+            ctx.flush.page++;
+        }
+
+        if (ctx.flush.page < SSD1306_PAGES)
+        {
+            d = &ctx.flush.span[ctx.flush.page];
+
+            ctx.flush.window[0] = 0x00;                 // Command stream
+            ctx.flush.window[1] = 0x21;                 // Column address window
+            ctx.flush.window[2] = d->x0;
+            ctx.flush.window[3] = d->x1;
+            ctx.flush.window[4] = 0x22;                 // Page address window
+            ctx.flush.window[5] = ctx.flush.page;
+            ctx.flush.window[6] = ctx.flush.page;
+            ctx.flush.state = FLUSH_WINDOW;
+
+            if (HAL_I2C_Master_Transmit_DMA(&ctx.handle, SSD1306_I2C_ADDR, ctx.flush.window, sizeof(ctx.flush.window)) == HAL_OK)
+            {
+                return;
+            }
+
+            ctx.flush.failed = true;
+        }
+    }
+
+    //  Done or failed, a failed flush is sent again with the next one
+    ctx.flush.state = FLUSH_IDLE;
+    TRACE_SPAN_END(TRACE_SPAN_SSD1306_I2C);
+    metrics_hist_add(METRICS_OLED_FLUSH_US, sys_stats_timer_get() - ctx.flush.start_us);
+
+    if (__get_IPSR() != 0)
+    {
+        xSemaphoreGiveFromISR(ctx.flush.done, &woken);
+        portYIELD_FROM_ISR(woken);
+    }
+    else
+    {
+        xSemaphoreGive(ctx.flush.done);
+    }
+}
+
+//  Blocks until the panel holds the last flushed frame
+void ssd1306_wait_flush(void)
+{
+    while (ctx.flush.state != FLUSH_IDLE)
+    {
+        xSemaphoreTake(ctx.flush.done, portMAX_DELAY);
+    }
+}
+
+//  Framebuffer write, only bytes that change extend the page dirty span
+RAMFUNC static void ssd1306_set_byte(uint16_t index, uint8_t byte)
+{
+    if (ctx.buffer[index] == byte)
+    {
+        return;
+    }
+
+    uint8_t x = index % SSD1306_WIDTH;
+
+    ctx.buffer[index] = byte;
+    ssd1306_mark_dirty(index / SSD1306_WIDTH, x, x);
+}
+
+RAMFUNC static void ssd1306_mark_dirty(uint8_t page, uint8_t x0, uint8_t x1)
+{
+    struct ssd1306_dirty *d = &ctx.dirty[page];
+
+    if ((d->x0 == SSD1306_CLEAN) || (x0 < d->x0))
+    {
+        d->x0 = x0;
+    }
+    if (x1 > d->x1)
+    {
+        d->x1 = x1;
+    }
+}
+
+//  Sets or clears the mask bits in columns x0..x1 of a page, already clipped
+RAMFUNC static void ssd1306_fill_span(uint8_t page, uint8_t x0, uint8_t x1, uint8_t mask, enum ssd1306_color color)
+{
+    uint8_t *row = &ctx.buffer[page * SSD1306_WIDTH];
+    uint8_t set = (color == COLOR_WHITE) ? mask : 0x00;
+
+    if (mask == 0xFF)
+    {
+        //  Whole bytes, trim the ends that already match and memset the rest
+        while ((x0 <= x1) && (row[x0] == set))
+        {
+            x0++;
+        }
+
+        if (x0 > x1)
+        {
+            return;
+        }
+
+        while (row[x1] == set)
+        {
+            x1--;
+        }
+
+        memset(&row[x0], set, x1 - x0 + 1);
+        ssd1306_mark_dirty(page, x0, x1);
+        return;
+    }
+
+    uint8_t keep = ~mask;
+    uint8_t first = SSD1306_CLEAN;
+    uint8_t last = 0;
+
+    for (uint8_t x = x0; x <= x1; x++)
+    {
+        uint8_t b = (row[x] & keep) | set;
+
+        if (b != row[x])
+        {
+            row[x] = b;
+
+            if (first == SSD1306_CLEAN)
+            {
+                first = x;
+            }
+            last = x;
+        }
+    }
+
+    if (first != SSD1306_CLEAN)
+    {
+        ssd1306_mark_dirty(page, first, last);
+    }
+}
+
+//  Clipped once, then one span per covered page with the edge rows masked
+RAMFUNC static void ssd1306_fill_area(int x, int y, int w, int h, enum ssd1306_color color)
+{
+    int x1 = x + w - 1;
+    int y1 = y + h - 1;
+
+    if (x < 0)
+    {
+        x = 0;
+    }
+    if (y < 0)
+    {
+        y = 0;
+    }
+    if (x1 >= SSD1306_WIDTH)
+    {
+        x1 = SSD1306_WIDTH - 1;
+    }
+    if (y1 >= SSD1306_HEIGHT)
+    {
+        y1 = SSD1306_HEIGHT - 1;
+    }
+
+    if ((x > x1) || (y > y1))
+    {
+        return;
+    }
+
+    if (ctx.ssd1306.inverted)
+    {
+        color = (enum ssd1306_color)!color;
+    }
+
+    for (int page = y / 8; page <= y1 / 8; page++)
+    {
+        uint8_t mask = 0xFF;
+
+        if (page == y / 8)
+        {
+            mask &= 0xFF << (y % 8);
+        }
+        if (page == y1 / 8)
+        {
+            mask &= 0xFF >> (7 - (y1 % 8));
+        }
+
+        ssd1306_fill_span(page, x, x1, mask, color);
+    }
+}
+
+//  Row mask of a bitmap page, zero outside of the bitmap
+static uint8_t ssd1306_bitmap_rows(const struct ssd1306_bitmap *bmp, int page)
+{
+    int rows = bmp->h - page * 8;
+
+    if ((page < 0) || (rows <= 0))
+    {
+        return 0x00;
+    }
+
+    return (rows >= 8) ? 0xFF : (0xFF >> (8 - rows));
 }
 
 static void ssd1306_write_line(int x_start, int y_start, int x_end, int y_end, enum ssd1306_color color)
@@ -126,14 +493,93 @@ static void ssd1306_write_line(int x_start, int y_start, int x_end, int y_end, e
     }
 }
 
-static void ssd1306_write_fast_vline(int x_start, int y_start, int h, enum ssd1306_color color)
+//  Set bitmap bits are drawn white, or black with invert
+RAMFUNC static void ssd1306_blit(int x, int y, const struct ssd1306_bitmap *bmp, enum ssd1306_blit mode, bool invert)
 {
-    ssd1306_write_line(x_start, y_start, x_start, y_start+h-1, color);
-}
+    int c0 = (x < 0) ? -x : 0;
+    int c1 = (x + bmp->w > SSD1306_WIDTH) ? (SSD1306_WIDTH - x) : bmp->w;
+    int y1 = y + bmp->h - 1;
+    int pages = (bmp->h + 7) / 8;
 
-static void ssd1306_write_fast_hline(int x_start, int y_start, int w, enum ssd1306_color color)
-{
-    ssd1306_write_line(x_start, y_start, x_start+w-1, y_start, color);
+    if (y1 >= SSD1306_HEIGHT)
+    {
+        y1 = SSD1306_HEIGHT - 1;
+    }
+
+    if ((c0 >= c1) || (y1 < 0) || (y >= SSD1306_HEIGHT))
+    {
+        return;
+    }
+
+    for (int page = (y < 0) ? 0 : (y / 8); page <= y1 / 8; page++)
+    {
+        //  Bitmap row at the top of this page, split in source page and shift,
+        //  a bitmap starting inside the page has its first one at sp = -1
+        int off = page * 8 - y;
+        int sp = (off >= 0) ? (off / 8) : -1;
+        uint8_t sh = off - sp * 8;
+        const uint8_t *lo = (sp >= 0) ? &bmp->data[sp * bmp->w] : NULL;
+        const uint8_t *hi = (sp + 1 < pages) ? &bmp->data[(sp + 1) * bmp->w] : NULL;
+        uint8_t mask = (ssd1306_bitmap_rows(bmp, sp) >> sh);
+        uint8_t *row = &ctx.buffer[page * SSD1306_WIDTH];
+        uint8_t first_x = SSD1306_CLEAN;
+        uint8_t last_x = 0;
+
+        if (sh != 0)
+        {
+            mask |= ssd1306_bitmap_rows(bmp, sp + 1) << (8 - sh);
+        }
+
+        for (int c = c0; c < c1; c++)
+        {
+            uint8_t src = 0;
+            uint8_t b;
+
+            if (lo != NULL)
+            {
+                src = lo[c] >> sh;
+            }
+            if ((hi != NULL) && (sh != 0))
+            {
+                src |= hi[c] << (8 - sh);
+            }
+
+            if (invert && (mode != SSD1306_BLIT_XOR))
+            {
+                src = ~src;
+            }
+            src &= mask;
+
+            switch (mode)
+            {
+            case SSD1306_BLIT_COPY:
+                b = (row[x + c] & ~mask) | src;
+                break;
+            case SSD1306_BLIT_OR:
+                b = invert ? (row[x + c] & ~(mask & ~src)) : (row[x + c] | src);
+                break;
+            default:
+                b = row[x + c] ^ src;
+                break;
+            }
+
+            if (b != row[x + c])
+            {
+                row[x + c] = b;
+
+                if (first_x == SSD1306_CLEAN)
+                {
+                    first_x = x + c;
+                }
+                last_x = x + c;
+            }
+        }
+
+        if (first_x != SSD1306_CLEAN)
+        {
+            ssd1306_mark_dirty(page, first_x, last_x);
+        }
+    }
 }
 
 //--------------------------------------------------------------------------------
@@ -168,140 +614,233 @@ void ssd1306_i2c_init(void)
 
     HAL_I2C_Init(&ctx.handle);
     __HAL_I2C_ENABLE(&ctx.handle);
+
+    /* TX DMA for the framebuffer flush */
+    __HAL_RCC_DMA1_CLK_ENABLE();
+
+    ctx.dma_tx.Instance = SSD1306_DMA_TX;
+    ctx.dma_tx.Init.Direction = DMA_MEMORY_TO_PERIPH;
+    ctx.dma_tx.Init.PeriphInc = DMA_PINC_DISABLE;
+    ctx.dma_tx.Init.MemInc = DMA_MINC_ENABLE;
+    ctx.dma_tx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+    ctx.dma_tx.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+    ctx.dma_tx.Init.Mode = DMA_NORMAL;
+    ctx.dma_tx.Init.Priority = DMA_PRIORITY_LOW;
+
+    HAL_DMA_Init(&ctx.dma_tx);
+    __HAL_LINKDMA(&ctx.handle, hdmatx, ctx.dma_tx);
+
+    HAL_NVIC_SetPriority(DMA1_Channel6_IRQn, SSD1306_IRQ_PRIO, 0);
+    HAL_NVIC_EnableIRQ(DMA1_Channel6_IRQn);
+    HAL_NVIC_SetPriority(I2C1_EV_IRQn, SSD1306_IRQ_PRIO, 0);
+    HAL_NVIC_EnableIRQ(I2C1_EV_IRQn);
+    HAL_NVIC_SetPriority(I2C1_ER_IRQn, SSD1306_IRQ_PRIO, 0);
+    HAL_NVIC_EnableIRQ(I2C1_ER_IRQn);
+
+    ctx.flush.done = xSemaphoreCreateBinary();
+    ctx.buffer = &ctx.fb[0][1];
+    ctx.front = ctx.fb[1];
+
+    sys_clock_register_callback(ssd1306_clock_changed);
 }
 
 void ssd1306_init(void)
 {
     LOG("OLED initialization...\n\r");
-    ssd1306_write_cmd(0xAE); //display off
 
-    ssd1306_write_cmd(0x20); //Set Memory Addressing Mode
-    ssd1306_write_cmd(0x00); // 00b,Horizontal Addressing Mode; 01b,Vertical Addressing Mode;
-                                // 10b,Page Addressing Mode (RESET); 11b,Invalid
+    ssd1306_write_cmds(ssd1306_init_seq, sizeof(ssd1306_init_seq));
 
-    ssd1306_write_cmd(0xB0); //Set Page Start Address for Page Addressing Mode,0-7
+    // The panel RAM content is unknown, the first flush writes all of it
+    // while the panel is still off
+    ssd1306_fill(COLOR_BLACK);
+    ssd1306_invalidate();
 
-#ifdef SSD1306_MIRROR_VERT
-    ssd1306_write_cmd(0xC0); // Mirror vertically
-#else
-    ssd1306_write_cmd(0xC8); //Set COM Output Scan Direction
-#endif
+    // Set default values for screen object
+    ctx.ssd1306.current_x = 0;
+    ctx.ssd1306.current_y = 0;
 
-    ssd1306_write_cmd(0x00); //---set low column address
-    ssd1306_write_cmd(0x10); //---set high column address
+    ctx.ssd1306.initialized = 1;
+    LOG("OLED initialization finished!\n\r");
+}
 
-    ssd1306_write_cmd(0x40); //--set start line address - CHECK
+// The panel stays dark after ssd1306_init until switched on. The charge pump
+// is stopped with it, the framebuffer and the panel RAM are kept.
+void ssd1306_set_display_on(bool on)
+{
+    const uint8_t on_seq[] = { 0x8D, 0x14, 0xAF };     // Charge pump on, display on
+    const uint8_t off_seq[] = { 0xAE, 0x8D, 0x10 };    // Display off, charge pump off
 
-    ssd1306_write_cmd(0x81); //--set contrast control register - CHECK
-    ssd1306_write_cmd(0xFF);
+    ssd1306_wait_flush();
+    ssd1306_write_cmds(on ? on_seq : off_seq, 3);
+}
 
-#ifdef SSD1306_MIRROR_HORIZ
-    ssd1306_write_cmd(0xA0); // Mirror horizontally
-#else
-    ssd1306_write_cmd(0xA1); //--set segment re-map 0 to 127 - CHECK
-#endif
+void ssd1306_set_contrast(uint8_t contrast)
+{
+    const uint8_t seq[] = { 0x81, contrast };
 
-#ifdef SSD1306_INVERSE_COLOR
-    ssd1306_write_cmd(0xA7); //--set inverse color
-#else
-    ssd1306_write_cmd(0xA6); //--set normal color
-#endif
+    ssd1306_wait_flush();
+    ssd1306_write_cmds(seq, sizeof(seq));
+}
 
-// Set multiplex ratio.
-#if (SSD1306_HEIGHT == 128)
-    // Found in the Luma Python lib for SH1106.
-    ssd1306_write_cmd(0xFF);
-#else
-    ssd1306_write_cmd(0xA8); //--set multiplex ratio(1 to 64) - CHECK
-#endif
+// Fill the whole screen with the given color
+RAMFUNC void ssd1306_fill(enum ssd1306_color color)
+{
+    for (uint8_t page = 0; page < SSD1306_PAGES; page++)
+    {
+        ssd1306_fill_span(page, 0, SSD1306_WIDTH - 1, 0xFF, color);
+    }
+}
 
-#if (SSD1306_HEIGHT == 32)
-    ssd1306_write_cmd(0x1F); //
-#elif (SSD1306_HEIGHT == 64)
-    ssd1306_write_cmd(0x3F); //
-#elif (SSD1306_HEIGHT == 128)
-    ssd1306_write_cmd(0x3F); // Seems to work for 128px high displays too.
-#else
-#error "Only 32, 64, or 128 lines of height are supported!"
-#endif
+// Mark the whole framebuffer for the next flush
+void ssd1306_invalidate(void)
+{
+    for (uint8_t i = 0; i < SSD1306_PAGES; i++)
+    {
+        ctx.dirty[i].x0 = 0;
+        ctx.dirty[i].x1 = SSD1306_WIDTH - 1;
+    }
+}
 
-    ssd1306_write_cmd(0xA4); //0xa4,Output follows RAM content;0xa5,Output ignores RAM content
+void ssd1306_get_stats(struct ssd1306_stats *stats)
+{
+    *stats = ctx.stats;
+}
 
-    ssd1306_write_cmd(0xD3); //-set display offset - CHECK
-    ssd1306_write_cmd(0x00); //-not offset
+// Back buffer, what the panel shows after the next flush. Drawing task only.
+const uint8_t *ssd1306_get_buffer(void)
+{
+    return ctx.buffer;
+}
 
-    ssd1306_write_cmd(0xD5); //--set display clock divide ratio/oscillator frequency
-    ssd1306_write_cmd(0xF0); //--set divide ratio
+// Send the changed columns of each page to the screen. Returns once the
+// transfer is started, drawing can go on in the other buffer meanwhile.
+void ssd1306_update_screen(void)
+{
+    bool flushed = false;
+    uint8_t *back;
 
-    ssd1306_write_cmd(0xD9); //--set pre-charge period
-    ssd1306_write_cmd(0x22); //
+    ssd1306_wait_flush();
 
-    ssd1306_write_cmd(0xDA); //--set com pins hardware configuration - CHECK
-#if (SSD1306_HEIGHT == 32)
-    ssd1306_write_cmd(0x02);
-#elif (SSD1306_HEIGHT == 64)
-    ssd1306_write_cmd(0x12);
-#elif (SSD1306_HEIGHT == 128)
-    ssd1306_write_cmd(0x12);
-#else
-#error "Only 32, 64, or 128 lines of height are supported!"
-#endif
+    for (uint8_t i = 0; i < SSD1306_PAGES; i++)
+    {
+        struct ssd1306_dirty *d = &ctx.dirty[i];
+        struct ssd1306_dirty *s = &ctx.flush.span[i];
 
-    ssd1306_write_cmd(0xDB); //--set vcomh
-    ssd1306_write_cmd(0x20); //0x20,0.77xVcc
+        //  Spans of a failed flush may not have reached the panel
+        if (ctx.flush.failed && (s->x0 != SSD1306_CLEAN))
+        {
+            d->x0 = ((d->x0 == SSD1306_CLEAN) || (s->x0 < d->x0)) ? s->x0 : d->x0;
+            d->x1 = (s->x1 > d->x1) ? s->x1 : d->x1;
+        }
 
-    ssd1306_write_cmd(0x8D); //--set DC-DC enable
-    ssd1306_write_cmd(0x14); //
-    ssd1306_write_cmd(0xAF); //--turn on SSD1306 panel
+        *s = *d;
+        d->x0 = SSD1306_CLEAN;
+        d->x1 = 0;
 
-    // Clear screen
-    ssd1306_fill(COLOR_BLACK);
-    
-    // Flush buffer to screen
-    ssd1306_update_screen();
-    
-    // Set default values for screen object
-    ctx.ssd1306.current_x = 0;
-    ctx.ssd1306.current_y = 0;
-    
-    ctx.ssd1306.initialized = 1;
-    LOG("OLED initialization finished!\n\r");
+        if (s->x0 != SSD1306_CLEAN)
+        {
+            ctx.stats.bytes += 8 + (s->x1 - s->x0 + 2);     // Window and data transfers
+            metrics_add(METRICS_OLED_BYTES, 8 + (s->x1 - s->x0 + 2));
+            flushed = true;
+        }
+    }
+
+    ctx.flush.failed = false;
+
+    if (!flushed)
+    {
+        return;
+    }
+
+    //  Swap, then bring the new back buffer up to the frame being sent
+    back = ctx.front + 1;
+    ctx.front = ctx.buffer - 1;
+    ctx.buffer = back;
+
+    for (uint8_t i = 0; i < SSD1306_PAGES; i++)
+    {
+        struct ssd1306_dirty *s = &ctx.flush.span[i];
+
+        if (s->x0 != SSD1306_CLEAN)
+        {
+            uint16_t idx = SSD1306_WIDTH * i + s->x0;
+
+            memcpy(&ctx.buffer[idx], &ctx.front[1 + idx], s->x1 - s->x0 + 1);
+        }
+    }
+
+    ctx.stats.flushes++;
+    metrics_inc(METRICS_OLED_FLUSHES);
+
+    TRACE_SPAN_BEGIN(TRACE_SPAN_SSD1306_I2C);
+    ctx.flush.start_us = sys_stats_timer_get();
+    ctx.flush.page = 0;
+    ctx.flush.state = FLUSH_IDLE;
+    ssd1306_flush_next();
 }
 
-// Fill the whole screen with the given color
-void ssd1306_fill(enum ssd1306_color color)
+void ssd1306_i2c_ev_irq_handler(void)
+{
+    HAL_I2C_EV_IRQHandler(&ctx.handle);
+}
+
+void ssd1306_i2c_er_irq_handler(void)
 {
-    /* Set memory */
-    uint32_t i;
+    HAL_I2C_ER_IRQHandler(&ctx.handle);
+}
 
-    for(i = 0; i < sizeof(ctx.buffer); i++) {
-        ctx.buffer[i] = (color == COLOR_BLACK) ? 0x00 : 0xFF;
+void ssd1306_dma_irq_handler(void)
+{
+    HAL_DMA_IRQHandler(&ctx.dma_tx);
+}
+
+//  Window or data transfer done, stop condition sent
+void HAL_I2C_MasterTxCpltCallback(I2C_HandleTypeDef *hi2c)
+{
+    if (hi2c != &ctx.handle)
+    {
+        return;
     }
+
+    if (ctx.flush.state == FLUSH_DATA)
+    {
+        struct ssd1306_dirty *d = &ctx.flush.span[ctx.flush.page];
+
+        ctx.front[SSD1306_WIDTH * ctx.flush.page + d->x0] = ctx.flush.saved;
+        ctx.flush.page++;
+    }
+
+    ssd1306_flush_next();
 }
 
-// Write the screenbuffer with changed to the screen
-void ssd1306_update_screen(void)
+//  NACK or bus error, the rest of the frame is dropped and sent with the next flush
+void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c)
 {
-    // Write data to each page of RAM. Number of pages
-    // depends on the screen height:
-    //
-    //  * 32px   ==  4 pages
-    //  * 64px   ==  8 pages
-    //  * 128px  ==  16 pages
-    for(uint8_t i = 0; i < SSD1306_HEIGHT/8; i++)
+    if (hi2c != &ctx.handle)
+    {
+        return;
+    }
+
+    if (ctx.flush.state == FLUSH_DATA)
     {
-        ssd1306_write_cmd(0xB0 + i); // Set the current RAM page address.
-        ssd1306_write_cmd(0x00);
-        ssd1306_write_cmd(0x10);
-        ssd1306_write_data(&ctx.buffer[SSD1306_WIDTH*i], SSD1306_WIDTH);
+        struct ssd1306_dirty *d = &ctx.flush.span[ctx.flush.page];
+
+        ctx.front[SSD1306_WIDTH * ctx.flush.page + d->x0] = ctx.flush.saved;
     }
+
+    metrics_inc(METRICS_OLED_I2C_ERRORS);
+
+    ctx.flush.failed = true;
+    ctx.flush.page = SSD1306_PAGES;
+    ctx.flush.state = FLUSH_IDLE;
+    ssd1306_flush_next();
 }
 
 //    Draw one pixel in the screenbuffer
 //    X => X Coordinate
 //    Y => Y Coordinate
 //    color => Pixel color
-void ssd1306_draw_pixel(uint8_t x, uint8_t y, enum ssd1306_color color)
+RAMFUNC void ssd1306_draw_pixel(uint8_t x, uint8_t y, enum ssd1306_color color)
 {
     if(x >= SSD1306_WIDTH || y >= SSD1306_HEIGHT)
     {
@@ -316,13 +855,15 @@ void ssd1306_draw_pixel(uint8_t x, uint8_t y, enum ssd1306_color color)
     }
     
     // Draw in the right color
+    uint16_t index = x + (y / 8) * SSD1306_WIDTH;
+
     if(color == COLOR_WHITE)
     {
-        ctx.buffer[x + (y / 8) * SSD1306_WIDTH] |= 1 << (y % 8);
+        ssd1306_set_byte(index, ctx.buffer[index] | (1 << (y % 8)));
     }
     else
     {
-        ctx.buffer[x + (y / 8) * SSD1306_WIDTH] &= ~(1 << (y % 8));
+        ssd1306_set_byte(index, ctx.buffer[index] & ~(1 << (y % 8)));
     }
 }
 
@@ -330,7 +871,7 @@ void ssd1306_draw_pixel(uint8_t x, uint8_t y, enum ssd1306_color color)
 // ch       => char om weg te schrijven
 // Font     => Font waarmee we gaan schrijven
 // color    => Black or White
-char ssd1306_write_char(char ch, FontDef Font, enum ssd1306_color color) {
+RAMFUNC char ssd1306_write_char(char ch, FontDef Font, enum ssd1306_color color) {
     uint32_t i, b, j;
     
     // Check if character is valid
@@ -407,7 +948,7 @@ void ssd1306_draw_line(int x_start, int y_start, int x_end, int y_end, enum ssd1
             SWAP_INT(y_start, y_end);
         }
 
-        ssd1306_write_fast_vline(x_start, y_start, y_end - y_start + 1, color);
+        ssd1306_fill_area(x_start, y_start, 1, y_end - y_start + 1, color);
     }
     else if (y_start == y_end)
     {
@@ -416,7 +957,7 @@ void ssd1306_draw_line(int x_start, int y_start, int x_end, int y_end, enum ssd1
             SWAP_INT(x_start, x_end);
         }
 
-        ssd1306_write_fast_hline(x_start, y_start, x_end - x_start + 1, color);
+        ssd1306_fill_area(x_start, y_start, x_end - x_start + 1, 1, color);
     }
     else
     {
@@ -426,19 +967,64 @@ void ssd1306_draw_line(int x_start, int y_start, int x_end, int y_end, enum ssd1
 
 void ssd1306_draw_rectangle(int x, int y, uint16_t w, uint16_t h, enum ssd1306_color color)
 {
+    ssd1306_fill_area(x, y, w, 1, color);
+    ssd1306_fill_area(x, y + h - 1, w, 1, color);
+    ssd1306_fill_area(x, y, 1, h, color);
+    ssd1306_fill_area(x + w - 1, y, 1, h, color);
+}
 
-    ssd1306_write_fast_hline(x, y, w, color);
-    ssd1306_write_fast_hline(x, y+h-1, w, color);
-    ssd1306_write_fast_vline(x, y, h, color);
-    ssd1306_write_fast_vline(x+w-1, y, h, color);
+void ssd1306_draw_fill_rectangle(int x, int y, uint16_t w, uint16_t h, enum ssd1306_color color)
+{
+    ssd1306_fill_area(x, y, w, h, color);
+}
 
+//  Set bitmap bits are drawn white, black on an inverted screen
+void ssd1306_draw_bitmap(int x, int y, const struct ssd1306_bitmap *bmp, enum ssd1306_blit mode)
+{
+    ssd1306_blit(x, y, bmp, mode, ctx.ssd1306.inverted);
 }
 
-void ssd1306_draw_fill_rectangle(int x, int y, uint16_t w, uint16_t h, enum ssd1306_color color)
+//  Glyph at the cursor with its background, returns 0 if it is not in the subset or does not fit
+RAMFUNC char ssd1306_write_packed(char ch, const struct ssd1306_font *font, enum ssd1306_color color)
+{
+    uint8_t i = (uint8_t)ch - font->first;
+
+    if (((uint8_t)ch < font->first) || (i >= font->count) || (font->index[i] == 0xFF))
+    {
+        return 0;
+    }
+
+    if ((ctx.ssd1306.current_x + font->w) > SSD1306_WIDTH ||
+        (ctx.ssd1306.current_y + font->h) > SSD1306_HEIGHT)
+    {
+        return 0;
+    }
+
+    struct ssd1306_bitmap glyph =
+    {
+        font->w,
+        font->h,
+        &font->glyphs[font->index[i] * font->w * ((font->h + 7) / 8)]
+    };
+
+    ssd1306_blit(ctx.ssd1306.current_x, ctx.ssd1306.current_y, &glyph, SSD1306_BLIT_COPY,
+            ctx.ssd1306.inverted ^ (color == COLOR_BLACK));
+    ctx.ssd1306.current_x += font->w;
+
+    return ch;
+}
+
+char ssd1306_write_string_packed(const char *str, const struct ssd1306_font *font, enum ssd1306_color color)
 {
-    for (int i=x; i<x+w; i++)
+    while (*str)
     {
-        ssd1306_write_fast_vline(i, y, h, color);
+        if (ssd1306_write_packed(*str, font, color) != *str)
+        {
+            return *str;
+        }
+
+        str++;
     }
 
+    return *str;
 }
@@ -16,6 +16,7 @@ extern "C" {
 
 /* Includes */
 #include <stddef.h>
+#include <stdbool.h>
 
 #include "stm32l1xx_hal.h"
 
@@ -35,6 +36,34 @@ enum ssd1306_color{
     COLOR_WHITE = 0x01  /**< Pixel is set. Color depends on OLED */
 };
 
+enum ssd1306_blit {
+    SSD1306_BLIT_COPY,      /**< Bitmap replaces the area, clear bits included */
+    SSD1306_BLIT_OR,        /**< Only set bits are drawn */
+    SSD1306_BLIT_XOR        /**< Set bits toggle the pixels, drawing twice restores */
+};
+
+/* 1bpp, page-major like the framebuffer: w bytes per 8 rows, LSB on top */
+struct ssd1306_bitmap {
+    uint8_t w;
+    uint8_t h;
+    const uint8_t *data;
+};
+
+/* Glyph subset generated by tools/fontgen.py, glyphs laid out as bitmaps */
+struct ssd1306_font {
+    uint8_t w;
+    uint8_t h;
+    uint8_t first;          /**< Char of index[0] */
+    uint8_t count;          /**< Index entries */
+    const uint8_t *index;   /**< Glyph number per char, 0xFF if left out */
+    const uint8_t *glyphs;  /**< w * pages bytes per glyph */
+};
+
+struct ssd1306_stats {
+    uint32_t flushes;       /* Updates that sent anything */
+    uint32_t bytes;         /* I2C bytes including address and control */
+};
+
 struct ssd1306_transformations {
     uint16_t current_x;
     uint16_t current_y;
@@ -47,15 +76,27 @@ struct ssd1306_transformations {
 /* Global functions */
 void ssd1306_i2c_init(void);
 void ssd1306_init(void);
+void ssd1306_set_display_on(bool on);
+void ssd1306_set_contrast(uint8_t contrast);
 void ssd1306_fill(enum ssd1306_color color);
 void ssd1306_update_screen(void);
+void ssd1306_wait_flush(void);
+void ssd1306_invalidate(void);
+void ssd1306_get_stats(struct ssd1306_stats *stats);
+const uint8_t *ssd1306_get_buffer(void);
 void ssd1306_draw_pixel(uint8_t x, uint8_t y, enum ssd1306_color color);
 char ssd1306_write_char(char ch, FontDef Font, enum ssd1306_color color);
 char ssd1306_write_string(char* str, FontDef Font, enum ssd1306_color color);
+char ssd1306_write_packed(char ch, const struct ssd1306_font *font, enum ssd1306_color color);
+char ssd1306_write_string_packed(const char *str, const struct ssd1306_font *font, enum ssd1306_color color);
 void ssd1306_set_cursor(uint8_t x, uint8_t y);
 void ssd1306_draw_line(int x_start, int y_start, int x_end, int y_end, enum ssd1306_color color);
 void ssd1306_draw_rectangle(int x, int y, uint16_t w, uint16_t h, enum ssd1306_color color);
 void ssd1306_draw_fill_rectangle(int x, int y, uint16_t w, uint16_t h, enum ssd1306_color color);
+void ssd1306_draw_bitmap(int x, int y, const struct ssd1306_bitmap *bmp, enum ssd1306_blit mode);
+void ssd1306_i2c_ev_irq_handler(void);
+void ssd1306_i2c_er_irq_handler(void);
+void ssd1306_dma_irq_handler(void);
 
 //--------------------------------------------------------------------------------
 
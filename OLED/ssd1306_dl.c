@@ -0,0 +1,67 @@
+/**
+ *  @file   ssd1306_dl.c
+ *  @brief  Display lists, screens recorded as draw commands.
+ *
+ *  A screen is an array of draw commands instead of a sequence of calls, so
+ *  its content is data: fixed screens are const tables in flash, screens with
+ *  values are filled in on the stack right before the replay. Replaying goes
+ *  through the regular primitives, the output is the same as drawing the
+ *  commands by hand, and the renderer behind them can change without
+ *  touching the screens.
+ */
+
+//--------------------------------------------------------------------------------
+
+/* Includes */
+#include <stdint.h>
+#include <stddef.h>
+
+#include "ssd1306.h"
+#include "ssd1306_dl.h"
+
+//--------------------------------------------------------------------------------
+
+/* Global functions */
+void ssd1306_dl_replay(const struct ssd1306_dl_cmd *cmds, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        const struct ssd1306_dl_cmd *c = &cmds[i];
+
+        switch (c->op)
+        {
+        case SSD1306_DL_OP_FILL:
+            ssd1306_fill((enum ssd1306_color)c->color);
+            break;
+
+        case SSD1306_DL_OP_RECT:
+            ssd1306_draw_rectangle(c->x, c->y, c->w, c->h, (enum ssd1306_color)c->color);
+            break;
+
+        case SSD1306_DL_OP_FILL_RECT:
+            ssd1306_draw_fill_rectangle(c->x, c->y, c->w, c->h, (enum ssd1306_color)c->color);
+            break;
+
+        case SSD1306_DL_OP_LINE:
+            ssd1306_draw_line(c->x, c->y, c->w, c->h, (enum ssd1306_color)c->color);
+            break;
+
+        case SSD1306_DL_OP_TEXT:
+            ssd1306_set_cursor(c->x, c->y);
+            ssd1306_write_string((char *)c->data, *(const FontDef *)c->font, (enum ssd1306_color)c->color);
+            break;
+
+        case SSD1306_DL_OP_TEXT_PACKED:
+            ssd1306_set_cursor(c->x, c->y);
+            ssd1306_write_string_packed(c->data, c->font, (enum ssd1306_color)c->color);
+            break;
+
+        case SSD1306_DL_OP_BITMAP:
+            ssd1306_draw_bitmap(c->x, c->y, c->data, (enum ssd1306_blit)c->color);
+            break;
+
+        default:
+            break;
+        }
+    }
+}
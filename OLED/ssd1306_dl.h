@@ -0,0 +1,80 @@
+/**
+ *  @file   ssd1306_dl.h
+ *  @brief  Display lists, screens recorded as draw commands.
+ */
+
+//--------------------------------------------------------------------------------
+
+#ifndef _SSD1306_DL_H_
+#define _SSD1306_DL_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//--------------------------------------------------------------------------------
+
+/* Includes */
+#include <stdint.h>
+#include <stddef.h>
+
+#include "ssd1306.h"
+#include "ssd1306_fonts.h"
+
+//--------------------------------------------------------------------------------
+
+/* Defines */
+#define SSD1306_DL_FILL(_color) \
+    { SSD1306_DL_OP_FILL, (_color), 0, 0, 0, 0, NULL, NULL }
+#define SSD1306_DL_RECT(_x, _y, _w, _h, _color) \
+    { SSD1306_DL_OP_RECT, (_color), (_x), (_y), (_w), (_h), NULL, NULL }
+#define SSD1306_DL_FILL_RECT(_x, _y, _w, _h, _color) \
+    { SSD1306_DL_OP_FILL_RECT, (_color), (_x), (_y), (_w), (_h), NULL, NULL }
+#define SSD1306_DL_LINE(_x0, _y0, _x1, _y1, _color) \
+    { SSD1306_DL_OP_LINE, (_color), (_x0), (_y0), (_x1), (_y1), NULL, NULL }
+#define SSD1306_DL_TEXT(_x, _y, _str, _font, _color) \
+    { SSD1306_DL_OP_TEXT, (_color), (_x), (_y), 0, 0, (_str), &(_font) }
+#define SSD1306_DL_TEXT_PACKED(_x, _y, _str, _font, _color) \
+    { SSD1306_DL_OP_TEXT_PACKED, (_color), (_x), (_y), 0, 0, (_str), &(_font) }
+#define SSD1306_DL_BITMAP(_x, _y, _bmp, _mode) \
+    { SSD1306_DL_OP_BITMAP, (_mode), (_x), (_y), 0, 0, &(_bmp), NULL }
+
+#define SSD1306_DL_LEN(_list)   (sizeof(_list) / sizeof((_list)[0]))
+
+//--------------------------------------------------------------------------------
+
+/* Types */
+enum ssd1306_dl_op
+{
+    SSD1306_DL_OP_FILL,
+    SSD1306_DL_OP_RECT,
+    SSD1306_DL_OP_FILL_RECT,
+    SSD1306_DL_OP_LINE,
+    SSD1306_DL_OP_TEXT,
+    SSD1306_DL_OP_TEXT_PACKED,
+    SSD1306_DL_OP_BITMAP
+};
+
+struct ssd1306_dl_cmd
+{
+    uint8_t op;
+    uint8_t color;          /* enum ssd1306_blit for bitmaps */
+    int16_t x;
+    int16_t y;
+    int16_t w;              /* End x for lines */
+    int16_t h;              /* End y for lines */
+    const void *data;       /* Text or bitmap, has to outlive the replay */
+    const void *font;       /* FontDef, struct ssd1306_font for packed text */
+};
+
+//--------------------------------------------------------------------------------
+
+void ssd1306_dl_replay(const struct ssd1306_dl_cmd *cmds, size_t n);
+
+//--------------------------------------------------------------------------------
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SSD1306_DL_H_ */
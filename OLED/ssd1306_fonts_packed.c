@@ -0,0 +1,256 @@
+/**
+ *  @file   ssd1306_fonts_packed.c
+ *  @brief  Generated by tools/fontgen.py, do not edit.
+ *  --font "16x26:0123456789:" --font "11x18: !0123456789:?ABGHMNPSWabcdefghilnorstwy"
+ */
+
+//--------------------------------------------------------------------------------
+
+/* Includes */
+#include <stdint.h>
+
+#include "ssd1306_fonts_packed.h"
+
+//--------------------------------------------------------------------------------
+
+static const uint8_t Font_16x26_packed_index[] =
+{
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A,
+};
+
+static const uint8_t Font_16x26_packed_glyphs[] =
+{
+    // 0
+    0x00, 0xE0, 0xF8, 0xFC, 0xFE, 0x7F, 0x0F, 0x07, 0x03, 0x07, 0x0F, 0x7F, 0xFE, 0xFC, 0xF8, 0xE0,
+    0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xC0, 0x00, 0x00, 0x00, 0x00, 0x00, 0xC0, 0xFF, 0xFF, 0xFF, 0xFF,
+    0x00, 0x00, 0x03, 0x07, 0x0F, 0x1F, 0x1E, 0x1C, 0x18, 0x1C, 0x1E, 0x1F, 0x0F, 0x07, 0x03, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // 1
+    0x00, 0x00, 0x0C, 0x0C, 0x0C, 0x0E, 0x0E, 0xFE, 0xFF, 0xFF, 0xFF, 0xFF, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x18, 0x18, 0x18, 0x18, 0x18, 0x1F, 0x1F, 0x1F, 0x1F, 0x1F, 0x18, 0x18, 0x18, 0x18,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // 2
+    0x00, 0x00, 0x06, 0x06, 0x07, 0x07, 0x03, 0x03, 0x03, 0x07, 0xFF, 0xFE, 0xFE, 0xFC, 0x70, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x80, 0xE0, 0xF0, 0xF8, 0x7C, 0x3E, 0x1F, 0x0F, 0x07, 0x03, 0x00, 0x00,
+    0x00, 0x00, 0x1E, 0x1F, 0x1F, 0x1F, 0x1B, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // 3
+    0x00, 0x00, 0x00, 0x06, 0x07, 0x07, 0x03, 0x03, 0x03, 0x07, 0xFF, 0xFF, 0xFE, 0xFC, 0x38, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x06, 0x06, 0x06, 0x06, 0x07, 0x0F, 0x1F, 0xFF, 0xFD, 0xF8, 0xF0, 0x00,
+    0x00, 0x00, 0x00, 0x1C, 0x1C, 0x1C, 0x18, 0x18, 0x18, 0x1C, 0x1E, 0x0F, 0x0F, 0x07, 0x03, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // 4
+    0x00, 0x00, 0x00, 0x00, 0x80, 0xE0, 0xF0, 0xF8, 0x7E, 0xFF, 0xFF, 0xFF, 0xFF, 0x00, 0x00, 0x00,
+    0x60, 0x78, 0x7C, 0x7F, 0x7F, 0x67, 0x63, 0x60, 0x60, 0xFF, 0xFF, 0xFF, 0xFF, 0x60, 0x60, 0x60,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1F, 0x1F, 0x1F, 0x1F, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // 5
+    0x00, 0x00, 0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x03, 0x03, 0x03, 0x03, 0x03, 0x07, 0x0F, 0xBF, 0xFE, 0xFE, 0xFC, 0xF0, 0x00,
+    0x00, 0x00, 0x00, 0x1C, 0x1C, 0x1C, 0x18, 0x18, 0x18, 0x1C, 0x1F, 0x0F, 0x0F, 0x07, 0x01, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // 6
+    0x00, 0x00, 0xE0, 0xF8, 0xFC, 0xFE, 0x3E, 0x0F, 0x07, 0x03, 0x03, 0x03, 0x07, 0x07, 0x06, 0x00,
+    0x00, 0x0C, 0xFF, 0xFF, 0xFF, 0xFF, 0x0E, 0x07, 0x03, 0x03, 0x07, 0x0F, 0xFF, 0xFE, 0xFC, 0xF8,
+    0x00, 0x00, 0x01, 0x07, 0x0F, 0x0F, 0x1F, 0x1C, 0x18, 0x18, 0x1C, 0x1E, 0x0F, 0x0F, 0x07, 0x03,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // 7
+    0x00, 0x00, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0xC7, 0xF7, 0xFF, 0x7F, 0x3F, 0x0F,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x80, 0xE0, 0xF8, 0xFE, 0x7F, 0x1F, 0x07, 0x01, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x18, 0x1F, 0x1F, 0x1F, 0x1F, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // 8
+    0x00, 0x00, 0x30, 0xFC, 0xFE, 0xFF, 0xFF, 0x87, 0x03, 0x03, 0x87, 0xFF, 0xFF, 0xFE, 0x7C, 0x00,
+    0x00, 0xC0, 0xF0, 0xF8, 0xFD, 0xFF, 0x1F, 0x07, 0x0F, 0x0F, 0x1F, 0x7F, 0xFD, 0xF8, 0xF0, 0xE0,
+    0x00, 0x01, 0x07, 0x0F, 0x0F, 0x1F, 0x1C, 0x1C, 0x18, 0x18, 0x1C, 0x1E, 0x0F, 0x0F, 0x07, 0x03,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // 9
+    0x00, 0xE0, 0xF8, 0xFC, 0xFE, 0xFF, 0x07, 0x03, 0x03, 0x07, 0x0F, 0xFF, 0xFE, 0xFC, 0xF8, 0xE0,
+    0x00, 0x01, 0x07, 0x0F, 0x0F, 0x1F, 0x1C, 0x18, 0x18, 0x18, 0x1C, 0xEF, 0xFF, 0xFF, 0xFF, 0x3F,
+    0x00, 0x00, 0x0C, 0x1C, 0x1C, 0x18, 0x18, 0x18, 0x1C, 0x1C, 0x1F, 0x0F, 0x07, 0x03, 0x01, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // :
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xC0, 0xC0, 0xC0, 0xC0, 0xC0, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x03, 0x03, 0x03, 0x03, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1E, 0x1E, 0x1E, 0x1E, 0x1E, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+
+const struct ssd1306_font Font_16x26_packed = { 16, 26, 48, 11, Font_16x26_packed_index, Font_16x26_packed_glyphs };
+
+static const uint8_t Font_11x18_packed_index[] =
+{
+    0x00, 0x01, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0xFF, 0xFF, 0xFF, 0xFF, 0x0D,
+    0xFF, 0x0E, 0x0F, 0xFF, 0xFF, 0xFF, 0xFF, 0x10, 0x11, 0xFF, 0xFF, 0xFF, 0xFF, 0x12, 0x13, 0xFF,
+    0x14, 0xFF, 0xFF, 0x15, 0xFF, 0xFF, 0xFF, 0x16, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0x17, 0x18, 0x19, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F, 0xFF, 0xFF, 0x20, 0xFF, 0x21, 0x22,
+    0xFF, 0xFF, 0x23, 0x24, 0x25, 0xFF, 0xFF, 0x26, 0xFF, 0x27,
+};
+
+static const uint8_t Font_11x18_packed_glyphs[] =
+{
+    //  
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // !
+    0x00, 0x00, 0x00, 0x00, 0xFE, 0xFE, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x6F, 0x6F, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // 0
+    0x00, 0xF0, 0xFC, 0x0E, 0x86, 0x86, 0x0E, 0xFC, 0xF0, 0x00, 0x00,
+    0x00, 0x0F, 0x3F, 0x70, 0x61, 0x61, 0x70, 0x3F, 0x0F, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // 1
+    0x00, 0x00, 0x30, 0x18, 0x0C, 0xFE, 0xFE, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x7F, 0x7F, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // 2
+    0x00, 0x38, 0x3C, 0x0E, 0x06, 0x06, 0x8E, 0xFC, 0x78, 0x00, 0x00,
+    0x00, 0x70, 0x78, 0x6C, 0x66, 0x63, 0x61, 0x60, 0x60, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // 3
+    0x00, 0x18, 0x1C, 0x06, 0xC6, 0xC6, 0xFC, 0x38, 0x00, 0x00, 0x00,
+    0x00, 0x18, 0x38, 0x70, 0x60, 0x60, 0x71, 0x3F, 0x1E, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // 4
+    0x00, 0x00, 0x80, 0xF0, 0x3C, 0xFE, 0xFE, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x0E, 0x0F, 0x0D, 0x0C, 0x7F, 0x7F, 0x0C, 0x0C, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // 5
+    0x00, 0xFE, 0xFE, 0x86, 0xC6, 0xC6, 0xC6, 0x86, 0x00, 0x00, 0x00,
+    0x00, 0x19, 0x39, 0x70, 0x60, 0x60, 0x71, 0x3F, 0x1F, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // 6
+    0x00, 0xF0, 0xFC, 0x8E, 0xC6, 0xC6, 0xCE, 0x9C, 0x18, 0x00, 0x00,
+    0x00, 0x0F, 0x3F, 0x71, 0x60, 0x60, 0x71, 0x3F, 0x1F, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // 7
+    0x00, 0x06, 0x06, 0x06, 0x06, 0xC6, 0xF6, 0x3E, 0x0E, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x70, 0x7F, 0x07, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // 8
+    0x00, 0x38, 0x7C, 0x86, 0x86, 0x86, 0x8E, 0x7C, 0x38, 0x00, 0x00,
+    0x00, 0x1E, 0x3F, 0x61, 0x61, 0x61, 0x61, 0x3F, 0x1E, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // 9
+    0x00, 0xF8, 0xFC, 0x8E, 0x06, 0x06, 0x8E, 0xFC, 0xF0, 0x00, 0x00,
+    0x00, 0x18, 0x39, 0x73, 0x63, 0x63, 0x71, 0x3F, 0x0F, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // :
+    0x00, 0x00, 0x00, 0x00, 0x60, 0x60, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x60, 0x60, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // ?
+    0x00, 0x18, 0x1C, 0x0E, 0x06, 0x06, 0x86, 0xCE, 0xFC, 0x78, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x6E, 0x6F, 0x03, 0x01, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // A
+    0x00, 0x00, 0x80, 0xF8, 0x7E, 0x06, 0x7E, 0xF8, 0x80, 0x00, 0x00,
+    0x00, 0x70, 0x7F, 0x0F, 0x06, 0x06, 0x06, 0x0F, 0x7F, 0x70, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // B
+    0x00, 0xFE, 0xFE, 0x86, 0x86, 0x86, 0xFC, 0x78, 0x00, 0x00, 0x00,
+    0x00, 0x7F, 0x7F, 0x61, 0x61, 0x61, 0x73, 0x3E, 0x1C, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // G
+    0x00, 0xF0, 0xFC, 0x0E, 0x06, 0x06, 0x06, 0x1C, 0x18, 0x00, 0x00,
+    0x00, 0x0F, 0x3F, 0x70, 0x60, 0x60, 0x63, 0x3F, 0x3F, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // H
+    0x00, 0xFE, 0xFE, 0x80, 0x80, 0x80, 0x80, 0xFE, 0xFE, 0x00, 0x00,
+    0x00, 0x7F, 0x7F, 0x01, 0x01, 0x01, 0x01, 0x7F, 0x7F, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // M
+    0x00, 0xFE, 0xFE, 0x1E, 0xF8, 0x80, 0xF8, 0x0E, 0xFE, 0xFE, 0x00,
+    0x00, 0x7F, 0x7F, 0x00, 0x00, 0x01, 0x00, 0x00, 0x7F, 0x7F, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // N
+    0x00, 0xFE, 0xFE, 0x3E, 0xF8, 0xC0, 0x00, 0xFE, 0xFE, 0x00, 0x00,
+    0x00, 0x7F, 0x7F, 0x00, 0x01, 0x1F, 0x7C, 0x7F, 0x7F, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // P
+    0x00, 0xFE, 0xFE, 0x06, 0x06, 0x06, 0x8E, 0xFC, 0xF8, 0x00, 0x00,
+    0x00, 0x7F, 0x7F, 0x03, 0x03, 0x03, 0x03, 0x01, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // S
+    0x00, 0x00, 0x78, 0xFC, 0xC6, 0x86, 0x86, 0x1C, 0x18, 0x00, 0x00,
+    0x00, 0x0C, 0x3C, 0x70, 0x60, 0x61, 0x63, 0x3F, 0x1E, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // W
+    0x7E, 0xFE, 0x00, 0x00, 0xC0, 0xC0, 0x00, 0x00, 0xFE, 0x7E, 0x00,
+    0x00, 0x7F, 0x70, 0x1E, 0x03, 0x03, 0x1E, 0x70, 0x7F, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // a
+    0x00, 0x80, 0xC0, 0x60, 0x60, 0x60, 0x60, 0xE0, 0xC0, 0x00, 0x00,
+    0x00, 0x38, 0x7C, 0x66, 0x66, 0x26, 0x36, 0x3F, 0x7F, 0x40, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // b
+    0x00, 0xFE, 0xFE, 0xC0, 0x60, 0x60, 0xE0, 0xC0, 0x80, 0x00, 0x00,
+    0x00, 0x7F, 0x7F, 0x30, 0x60, 0x60, 0x70, 0x3F, 0x1F, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // c
+    0x00, 0x80, 0xC0, 0xE0, 0x60, 0x60, 0xE0, 0xC0, 0x80, 0x00, 0x00,
+    0x00, 0x1F, 0x3F, 0x70, 0x60, 0x60, 0x70, 0x39, 0x19, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // d
+    0x00, 0x80, 0xC0, 0xE0, 0x60, 0x60, 0xC0, 0xFE, 0xFE, 0x00, 0x00,
+    0x00, 0x1F, 0x3F, 0x70, 0x60, 0x60, 0x30, 0x7F, 0x7F, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // e
+    0x00, 0x80, 0xC0, 0xE0, 0x60, 0x60, 0xE0, 0xC0, 0x00, 0x00, 0x00,
+    0x00, 0x1F, 0x3F, 0x76, 0x66, 0x66, 0x66, 0x37, 0x17, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // f
+    0x00, 0x60, 0x60, 0x60, 0xFC, 0xFE, 0x66, 0x66, 0x66, 0x06, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x7F, 0x7F, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // g
+    0x00, 0xC0, 0xE0, 0x70, 0x30, 0x30, 0x60, 0xF0, 0xF0, 0x00, 0x00,
+    0x00, 0x8F, 0x9F, 0x38, 0x30, 0x30, 0x98, 0xFF, 0xFF, 0x00, 0x00,
+    0x00, 0x01, 0x03, 0x03, 0x03, 0x03, 0x03, 0x01, 0x00, 0x00, 0x00,
+    // h
+    0x00, 0xFE, 0xFE, 0xC0, 0x60, 0x60, 0x60, 0xE0, 0xC0, 0x00, 0x00,
+    0x00, 0x7F, 0x7F, 0x00, 0x00, 0x00, 0x00, 0x7F, 0x7F, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // i
+    0x00, 0x00, 0x60, 0x60, 0x60, 0xE6, 0xE6, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x7F, 0x7F, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // l
+    0x00, 0x00, 0x06, 0x06, 0x06, 0xFE, 0xFE, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x7F, 0x7F, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // n
+    0x00, 0xE0, 0xE0, 0xC0, 0x60, 0x60, 0x60, 0xE0, 0xC0, 0x00, 0x00,
+    0x00, 0x7F, 0x7F, 0x00, 0x00, 0x00, 0x00, 0x7F, 0x7F, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // o
+    0x00, 0x80, 0xC0, 0xE0, 0x60, 0x60, 0xE0, 0xC0, 0x80, 0x00, 0x00,
+    0x00, 0x1F, 0x3F, 0x70, 0x60, 0x60, 0x70, 0x3F, 0x1F, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // r
+    0x00, 0x20, 0xE0, 0xC0, 0xC0, 0x60, 0x60, 0xE0, 0x40, 0x00, 0x00,
+    0x00, 0x00, 0x7F, 0x7F, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // s
+    0x00, 0x80, 0xC0, 0x60, 0x60, 0x60, 0x60, 0xC0, 0xC0, 0x00, 0x00,
+    0x00, 0x33, 0x37, 0x66, 0x66, 0x66, 0x66, 0x3E, 0x1C, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // t
+    0x00, 0x60, 0x60, 0xF8, 0xFC, 0x60, 0x60, 0x60, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x3F, 0x7F, 0x60, 0x60, 0x60, 0x60, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // w
+    0xE0, 0xE0, 0x00, 0xE0, 0xE0, 0xE0, 0x00, 0xE0, 0xE0, 0x00, 0x00,
+    0x00, 0x1F, 0x78, 0x1F, 0x00, 0x1F, 0x78, 0x1F, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // y
+    0x00, 0x30, 0xF0, 0xC0, 0x00, 0x00, 0x80, 0xF0, 0x70, 0x00, 0x00,
+    0x00, 0x00, 0x01, 0x8F, 0xFE, 0xF0, 0x7F, 0x0F, 0x00, 0x00, 0x00,
+    0x00, 0x03, 0x03, 0x03, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+
+const struct ssd1306_font Font_11x18_packed = { 11, 18, 32, 90, Font_11x18_packed_index, Font_11x18_packed_glyphs };
@@ -0,0 +1,32 @@
+/**
+ *  @file   ssd1306_fonts_packed.h
+ *  @brief  Generated by tools/fontgen.py, do not edit.
+ *  --font "16x26:0123456789:" --font "11x18: !0123456789:?ABGHMNPSWabcdefghilnorstwy"
+ */
+
+//--------------------------------------------------------------------------------
+
+#ifndef _SSD1306_FONTS_PACKED_H_
+#define _SSD1306_FONTS_PACKED_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//--------------------------------------------------------------------------------
+
+/* Includes */
+#include "ssd1306.h"
+
+//--------------------------------------------------------------------------------
+
+extern const struct ssd1306_font Font_16x26_packed;  /* 11 glyphs, 715 bytes, 4940 in the full table */
+extern const struct ssd1306_font Font_11x18_packed;  /* 40 glyphs, 1410 bytes, 3420 in the full table */
+
+//--------------------------------------------------------------------------------
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SSD1306_FONTS_PACKED_H_ */
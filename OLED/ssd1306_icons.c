@@ -0,0 +1,29 @@
+/**
+ *  @file   ssd1306_icons.c
+ *  @brief  Bitmaps generated by tools/pbm2c.py from heart_big.pbm heart_small.pbm, do not edit.
+ */
+
+//--------------------------------------------------------------------------------
+
+/* Includes */
+#include <stdint.h>
+
+#include "ssd1306_icons.h"
+
+//--------------------------------------------------------------------------------
+
+static const uint8_t icon_heart_big_data[] =
+{
+    0x1E, 0x3F, 0x7F, 0xFF, 0xFE, 0xFC, 0xFE, 0xFF, 0x7F, 0x3F, 0x1E,
+    0x00, 0x00, 0x00, 0x00, 0x01, 0x03, 0x01, 0x00, 0x00, 0x00, 0x00,
+};
+
+const struct ssd1306_bitmap icon_heart_big = { 11, 10, icon_heart_big_data };
+
+static const uint8_t icon_heart_small_data[] =
+{
+    0x00, 0x00, 0x18, 0x3C, 0x7C, 0xF8, 0x7C, 0x3C, 0x18, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+
+const struct ssd1306_bitmap icon_heart_small = { 11, 10, icon_heart_small_data };
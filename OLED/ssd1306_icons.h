@@ -0,0 +1,31 @@
+/**
+ *  @file   ssd1306_icons.h
+ *  @brief  Bitmaps generated by tools/pbm2c.py from heart_big.pbm heart_small.pbm, do not edit.
+ */
+
+//--------------------------------------------------------------------------------
+
+#ifndef _SSD1306_ICONS_H_
+#define _SSD1306_ICONS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//--------------------------------------------------------------------------------
+
+/* Includes */
+#include "ssd1306.h"
+
+//--------------------------------------------------------------------------------
+
+extern const struct ssd1306_bitmap icon_heart_big;  /* 11x10 */
+extern const struct ssd1306_bitmap icon_heart_small;  /* 11x10 */
+
+//--------------------------------------------------------------------------------
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SSD1306_ICONS_H_ */
@@ -15,6 +15,10 @@
 
 #include "max30100.h"
 #include "debug_log.h"
+#include "trace_rec.h"
+#include "sys_clock.h"
+#include "sys_stats.h"
+#include "metrics.h"
 
 //--------------------------------------------------------------------------------
 
@@ -49,6 +53,12 @@
 
 #define MAX30100_I2C_ADDR       0xAE
 
+#define MAX30100_FIFO_DEPTH     16
+
+#ifndef CFG_MAX30100_I2C_SPEED
+#define CFG_MAX30100_I2C_SPEED  400000  /* Fast mode, keeps up with 1000 sps bursts */
+#endif
+
 #define MAX30100_I2C_PORT       GPIOB
 #define MAX30100_I2C_PIN_SCL    GPIO_PIN_10
 #define MAX30100_I2C_PIN_SDA    GPIO_PIN_11
@@ -67,22 +77,37 @@ static struct max30100_context ctx;
 //--------------------------------------------------------------------------------
 
 /* Static function declarations */
+static void max30100_clock_changed(enum sys_clock_event evt);
 static uint8_t max30100_read(uint8_t device_register);
 static void max30100_write(uint8_t device_register, uint8_t reg_data);
 
 //--------------------------------------------------------------------------------
 
 /* Static functions */
+//  FREQ, CCR and TRISE follow PCLK1, transfers only run in the full profile
+static void max30100_clock_changed(enum sys_clock_event evt)
+{
+    if (evt == SYS_CLOCK_POST_SWITCH)
+    {
+        HAL_I2C_Init(&ctx.handle);
+        __HAL_I2C_ENABLE(&ctx.handle);
+    }
+}
+
 static uint8_t max30100_read(uint8_t device_register)
 {
    uint8_t read_data;
+   TRACE_SPAN_BEGIN(TRACE_SPAN_MAX30100_I2C);
    HAL_I2C_Mem_Read(&ctx.handle, MAX30100_I2C_ADDR, device_register, I2C_MEMADD_SIZE_8BIT, &read_data, 1, 250);
+   TRACE_SPAN_END(TRACE_SPAN_MAX30100_I2C);
    return read_data;
 }
 
 static void max30100_write(uint8_t device_register, uint8_t reg_data)
 {
+    TRACE_SPAN_BEGIN(TRACE_SPAN_MAX30100_I2C);
     HAL_I2C_Mem_Write(&ctx.handle, MAX30100_I2C_ADDR, device_register, I2C_MEMADD_SIZE_8BIT, &reg_data, 1, 250);
+    TRACE_SPAN_END(TRACE_SPAN_MAX30100_I2C);
 }
 
 //--------------------------------------------------------------------------------
@@ -106,7 +131,7 @@ void max30100_i2c_init(void)
 
     ctx.handle.Instance = MAX30100_I2Cx;
 
-    ctx.handle.Init.ClockSpeed = 100000;
+    ctx.handle.Init.ClockSpeed = CFG_MAX30100_I2C_SPEED;
     ctx.handle.Init.DutyCycle = I2C_DUTYCYCLE_2;
     ctx.handle.Init.OwnAddress1 = 0;
     ctx.handle.Init.AddressingMode = I2C_ADDRESSINGMODE_7BIT;
@@ -117,6 +142,8 @@ void max30100_i2c_init(void)
 
     HAL_I2C_Init(&ctx.handle);
     __HAL_I2C_ENABLE(&ctx.handle);
+
+    sys_clock_register_callback(max30100_clock_changed);
 }
 
 void max30100_startup(void)
@@ -190,12 +217,82 @@ uint8_t max30100_get_sample_number(void)
     return (abs(16 + wr - rd) % 16);
 }
 
+void max30100_clear_fifo(void)
+{
+    max30100_write(MAX30100_FIFO_WR_PTR, 0);
+    max30100_write(MAX30100_OVRFLOW_CTR, 0);
+    max30100_write(MAX30100_FIFO_RD_PTR, 0);
+}
+
 void max30100_read_sensor(uint16_t *ir, uint16_t *red)
 {
   uint8_t temp[4] = {0};  // Temporary buffer for read values
 
+  TRACE_SPAN_BEGIN(TRACE_SPAN_MAX30100_I2C);
   HAL_I2C_Mem_Read(&ctx.handle, MAX30100_I2C_ADDR, MAX30100_FIFO_DATA, I2C_MEMADD_SIZE_8BIT, &temp[0], 4, 250);
+  TRACE_SPAN_END(TRACE_SPAN_MAX30100_I2C);
 
   *ir = (temp[0]<<8) | temp[1];    // Combine values to get the actual number
   *red = (temp[2]<<8) | temp[3];   // Combine values to get the actual number
 }
+
+//  Drains up to max samples from the FIFO in one burst, returns the sample count.
+//  lost is set to the number of samples dropped by the sensor since the last read.
+uint8_t max30100_read_fifo(uint16_t ir[], uint16_t red[], uint8_t max, uint8_t *lost)
+{
+    uint8_t ptr[3];     // WR_PTR, OVRFLOW_CTR, RD_PTR are consecutive
+    uint8_t temp[MAX30100_FIFO_DEPTH * 4];
+    uint8_t n;
+    HAL_StatusTypeDef status;
+    uint32_t start = sys_stats_timer_get();
+
+    TRACE_SPAN_BEGIN(TRACE_SPAN_MAX30100_I2C);
+    status = HAL_I2C_Mem_Read(&ctx.handle, MAX30100_I2C_ADDR, MAX30100_FIFO_WR_PTR, I2C_MEMADD_SIZE_8BIT, ptr, 3, 250);
+    TRACE_SPAN_END(TRACE_SPAN_MAX30100_I2C);
+
+    if (status != HAL_OK)
+    {
+        metrics_inc(METRICS_SENSOR_I2C_ERRORS);
+        *lost = 0;
+        return 0;
+    }
+
+    *lost = ptr[1];
+
+    //  Equal pointers with lost samples means a full FIFO, not an empty one
+    n = (ptr[1] != 0) ? MAX30100_FIFO_DEPTH : ((ptr[0] - ptr[2]) & (MAX30100_FIFO_DEPTH - 1));
+
+    metrics_add(METRICS_SENSOR_LOST, ptr[1]);
+    metrics_gauge_set(METRICS_SENSOR_FIFO, n);
+
+    if (n > max)
+    {
+        n = max;
+    }
+
+    if (n == 0)
+    {
+        return 0;
+    }
+
+    TRACE_SPAN_BEGIN(TRACE_SPAN_MAX30100_I2C);
+    status = HAL_I2C_Mem_Read(&ctx.handle, MAX30100_I2C_ADDR, MAX30100_FIFO_DATA, I2C_MEMADD_SIZE_8BIT, temp, n * 4, 250);
+    TRACE_SPAN_END(TRACE_SPAN_MAX30100_I2C);
+
+    if (status != HAL_OK)
+    {
+        metrics_inc(METRICS_SENSOR_I2C_ERRORS);
+        return 0;
+    }
+
+    for (uint8_t i = 0; i < n; i++)
+    {
+        ir[i] = (temp[i * 4] << 8) | temp[i * 4 + 1];
+        red[i] = (temp[i * 4 + 2] << 8) | temp[i * 4 + 3];
+    }
+
+    metrics_add(METRICS_SENSOR_SAMPLES, n);
+    metrics_hist_add(METRICS_SENSOR_READ_US, sys_stats_timer_get() - start);
+
+    return n;
+}
@@ -81,7 +81,9 @@ void max30100_set_mode(enum max30100_mode mode);
 void max30100_set_sample_rate(enum max30100_sample_rate sr);
 void max30100_set_highres(bool enabled);
 uint8_t max30100_get_sample_number(void);
+void max30100_clear_fifo(void);
 void max30100_read_sensor(uint16_t *ir, uint16_t *red);
+uint8_t max30100_read_fifo(uint16_t ir[], uint16_t red[], uint8_t max, uint8_t *lost);
 
 //--------------------------------------------------------------------------------
 
@@ -0,0 +1,176 @@
+#!/usr/bin/env python3
+"""Generates packed glyph subsets of the OLED fonts for ssd1306_write_packed.
+
+Usage:
+    fontgen.py OUT --font WxH:CHARS [--font WxH:CHARS ...] [--check]
+
+Reads the row tables of OLED/ssd1306_fonts.c (one uint16_t per glyph row,
+leftmost pixel in the MSB) and writes OUT.c and OUT.h with one
+`const struct ssd1306_font Font_WxH_packed` per --font, holding only CHARS.
+Glyphs are stored page-major like the framebuffer, w bytes per 8 rows with the
+top row in the LSB, so the driver blits them as bitmaps. A per-font index maps
+the char range first..last to glyph numbers, 0xFF for chars left out.
+
+Every glyph is decoded back and compared against its source rows before
+anything is written. --check writes nothing: it regenerates, runs the same
+round trip and fails if OUT.c or OUT.h differ, e.g. after a font or subset
+change without a rerun.
+
+    fontgen.py OLED/ssd1306_fonts_packed --font "16x26:0123456789:" \\
+        --font "11x18: !0123456789:?ABGHMNPSWabcdefghilnorstwy"
+"""
+
+import argparse
+import os
+import re
+import sys
+
+FONTS_C = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "OLED", "ssd1306_fonts.c")
+FIRST_CHAR = 32
+
+
+def read_fonts(path):
+    with open(path) as f:
+        src = f.read()
+
+    tables = {}
+    for m in re.finditer(r"static const uint16_t (\w+)\s*\[\]\s*=\s*\{(.*?)\};", src, re.S):
+        body = re.sub(r"//[^\n]*", "", m.group(2))
+        tables[m.group(1)] = [int(v, 16) for v in re.findall(r"0x[0-9A-Fa-f]+", body)]
+
+    fonts = {}
+    for m in re.finditer(r"FontDef\s+Font_(\d+)x(\d+)\s*=\s*\{\s*(\d+)\s*,\s*(\d+)\s*,\s*(\w+)\s*\}", src):
+        w, h = int(m.group(3)), int(m.group(4))
+        fonts["%dx%d" % (w, h)] = (w, h, tables[m.group(5)])
+    return fonts
+
+
+def glyph_rows(font, ch):
+    w, h, table = font
+    base = (ord(ch) - FIRST_CHAR) * h
+    return [[(table[base + y] << x) & 0x8000 != 0 for x in range(w)] for y in range(h)]
+
+
+def pack(w, h, rows):
+    out = []
+    for page in range((h + 7) // 8):
+        for x in range(w):
+            b = 0
+            for bit in range(8):
+                y = page * 8 + bit
+                if y < h and rows[y][x]:
+                    b |= 1 << bit
+            out.append(b)
+    return out
+
+
+def unpack(w, h, data):
+    return [[(data[(y // 8) * w + x] >> (y % 8)) & 1 != 0 for x in range(w)] for y in range(h)]
+
+
+def build(fonts, specs):
+    hdr_decl = []
+    src_body = []
+
+    for spec in specs:
+        size, _, chars = spec.partition(":")
+        if size not in fonts:
+            sys.exit("no %s font in %s" % (size, FONTS_C))
+        chars = "".join(sorted(set(chars)))
+        bad = [c for c in chars if not FIRST_CHAR <= ord(c) <= 126]
+        if not chars or bad:
+            sys.exit("%s: chars must be printable ASCII" % size)
+
+        font = fonts[size]
+        w, h = font[0], font[1]
+        name = "Font_%s_packed" % size
+        first, last = ord(chars[0]), ord(chars[-1])
+        index = [0xFF] * (last - first + 1)
+        glyphs = []
+
+        for n, ch in enumerate(chars):
+            rows = glyph_rows(font, ch)
+            data = pack(w, h, rows)
+            if unpack(w, h, data) != rows:
+                sys.exit("%s '%s': round trip mismatch" % (name, ch))
+            index[ord(ch) - first] = n
+            glyphs.append((ch, data))
+
+        size_old = len(font[2]) * 2
+        size_new = len(index) + sum(len(d) for _, d in glyphs)
+        hdr_decl.append("extern const struct ssd1306_font %s;  /* %d glyphs, %d bytes, %d in the full table */"
+                        % (name, len(glyphs), size_new, size_old))
+
+        src_body.append("static const uint8_t %s_index[] =" % name)
+        src_body.append("{")
+        for i in range(0, len(index), 16):
+            src_body.append("    " + ", ".join("0x%02X" % v for v in index[i:i + 16]) + ",")
+        src_body.append("};")
+        src_body.append("")
+        src_body.append("static const uint8_t %s_glyphs[] =" % name)
+        src_body.append("{")
+        for ch, data in glyphs:
+            src_body.append("    // %s" % ch)
+            for i in range(0, len(data), w):
+                src_body.append("    " + ", ".join("0x%02X" % v for v in data[i:i + w]) + ",")
+        src_body.append("};")
+        src_body.append("")
+        src_body.append("const struct ssd1306_font %s = { %d, %d, %d, %d, %s_index, %s_glyphs };"
+                        % (name, w, h, first, len(index), name, name))
+        src_body.append("")
+
+    return hdr_decl, src_body
+
+
+def render(out, specs, hdr_decl, src_body):
+    base = os.path.basename(out)
+    guard = "_%s_H_" % re.sub(r"\W", "_", base).upper()
+    brief = " *  @brief  Generated by tools/fontgen.py, do not edit."
+    args = " *  " + " ".join('--font "%s"' % s for s in specs)
+    sep = "//" + "-" * 80
+
+    hdr = ["/**", " *  @file   %s.h" % base, brief, args, " */", "", sep, "",
+           "#ifndef %s" % guard, "#define %s" % guard, "",
+           "#ifdef __cplusplus", 'extern "C" {', "#endif", "", sep, "",
+           "/* Includes */", '#include "ssd1306.h"', "", sep, ""]
+    hdr += hdr_decl
+    hdr += ["", sep, "", "#ifdef __cplusplus", "}", "#endif", "", "#endif /* %s */" % guard, ""]
+
+    src = ["/**", " *  @file   %s.c" % base, brief, args, " */", "", sep, "",
+           "/* Includes */", "#include <stdint.h>", "", '#include "%s.h"' % base, "", sep, ""]
+    src += src_body
+
+    return "\n".join(hdr), "\n".join(src)
+
+
+def main():
+    p = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    p.add_argument("out", help="output path without extension")
+    p.add_argument("--font", action="append", required=True, metavar="WxH:CHARS")
+    p.add_argument("--check", action="store_true", help="only verify that OUT is up to date")
+    args = p.parse_args()
+
+    hdr_decl, src_body = build(read_fonts(FONTS_C), args.font)
+    hdr, src = render(args.out, args.font, hdr_decl, src_body)
+
+    if args.check:
+        stale = []
+        for ext, text in ((".h", hdr), (".c", src)):
+            try:
+                with open(args.out + ext) as f:
+                    if f.read() != text:
+                        stale.append(args.out + ext)
+            except FileNotFoundError:
+                stale.append(args.out + ext)
+        if stale:
+            sys.exit("out of date: %s" % ", ".join(stale))
+        print("%s up to date, round trip ok" % args.out)
+        return
+
+    for ext, text in ((".h", hdr), (".c", src)):
+        with open(args.out + ext, "w", newline="\n") as f:
+            f.write(text)
+
+
+if __name__ == "__main__":
+    main()
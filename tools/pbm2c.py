@@ -0,0 +1,163 @@
+#!/usr/bin/env python3
+"""Converts PBM images to page-major 1bpp bitmaps for ssd1306_draw_bitmap.
+
+Usage:
+    pbm2c.py OUT IN.pbm [IN.pbm ...]
+
+Writes OUT.c and OUT.h with one `const struct ssd1306_bitmap icon_<name>` per
+input, named after the file. Plain (P1) and raw (P4) PBM are accepted, a 1
+(black in a viewer) is a lit pixel.
+
+The framebuffer layout is kept: every 8 rows form a page of w bytes, one byte
+per column with the top row in the LSB. Rows past the height are zero.
+
+    pbm2c.py OLED/ssd1306_icons tools/icons/*.pbm
+"""
+
+import argparse
+import os
+import re
+import sys
+
+
+def read_pbm(path):
+    with open(path, "rb") as f:
+        data = f.read()
+
+    # Header tokens, comments run to the end of the line
+    pos = 0
+    tokens = []
+    while len(tokens) < 3:
+        m = re.compile(rb"\s*(#[^\n]*\n\s*)*(\S+)").match(data, pos)
+        if m is None:
+            raise ValueError("%s: truncated header" % path)
+        tokens.append(m.group(2))
+        pos = m.end()
+
+    magic, w, h = tokens[0], int(tokens[1]), int(tokens[2])
+    if w < 1 or h < 1 or w > 255 or h > 255:
+        raise ValueError("%s: size %dx%d out of range" % (path, w, h))
+
+    if magic == b"P1":
+        bits = [int(c) for c in re.sub(rb"#[^\n]*", b"", data[pos:]).decode() if c in "01"]
+        if len(bits) < w * h:
+            raise ValueError("%s: %d pixels, expected %d" % (path, len(bits), w * h))
+        rows = [bits[y * w:(y + 1) * w] for y in range(h)]
+    elif magic == b"P4":
+        stride = (w + 7) // 8
+        raw = data[pos + 1:]
+        if len(raw) < stride * h:
+            raise ValueError("%s: truncated raster" % path)
+        rows = [[(raw[y * stride + x // 8] >> (7 - x % 8)) & 1 for x in range(w)] for y in range(h)]
+    else:
+        raise ValueError("%s: not a PBM file" % path)
+
+    return w, h, rows
+
+
+def to_pages(w, h, rows):
+    out = []
+    for page in range((h + 7) // 8):
+        for x in range(w):
+            b = 0
+            for bit in range(8):
+                y = page * 8 + bit
+                if y < h and rows[y][x]:
+                    b |= 1 << bit
+            out.append(b)
+    return out
+
+
+def c_name(path):
+    name = re.sub(r"\W", "_", os.path.splitext(os.path.basename(path))[0])
+    return "icon_" + name.lower()
+
+
+def main():
+    p = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    p.add_argument("out", help="output path without extension")
+    p.add_argument("inputs", nargs="+")
+    args = p.parse_args()
+
+    base = os.path.basename(args.out)
+    guard = "_%s_H_" % re.sub(r"\W", "_", base).upper()
+    srcs = " ".join(sorted(os.path.basename(i) for i in args.inputs))
+    icons = []
+
+    for path in args.inputs:
+        try:
+            w, h, rows = read_pbm(path)
+        except ValueError as e:
+            sys.exit(str(e))
+        icons.append((c_name(path), w, h, to_pages(w, h, rows)))
+
+    hdr = [
+        "/**",
+        " *  @file   %s.h" % base,
+        " *  @brief  Bitmaps generated by tools/pbm2c.py from %s, do not edit." % srcs,
+        " */",
+        "",
+        "//" + "-" * 80,
+        "",
+        "#ifndef %s" % guard,
+        "#define %s" % guard,
+        "",
+        "#ifdef __cplusplus",
+        'extern "C" {',
+        "#endif",
+        "",
+        "//" + "-" * 80,
+        "",
+        "/* Includes */",
+        '#include "ssd1306.h"',
+        "",
+        "//" + "-" * 80,
+        "",
+    ]
+    hdr += ["extern const struct ssd1306_bitmap %s;  /* %dx%d */" % (n, w, h) for n, w, h, _ in icons]
+    hdr += [
+        "",
+        "//" + "-" * 80,
+        "",
+        "#ifdef __cplusplus",
+        "}",
+        "#endif",
+        "",
+        "#endif /* %s */" % guard,
+        "",
+    ]
+
+    src = [
+        "/**",
+        " *  @file   %s.c" % base,
+        " *  @brief  Bitmaps generated by tools/pbm2c.py from %s, do not edit." % srcs,
+        " */",
+        "",
+        "//" + "-" * 80,
+        "",
+        "/* Includes */",
+        "#include <stdint.h>",
+        "",
+        '#include "%s.h"' % base,
+        "",
+        "//" + "-" * 80,
+        "",
+    ]
+    for n, w, h, data in icons:
+        src.append("static const uint8_t %s_data[] =" % n)
+        src.append("{")
+        for i in range(0, len(data), w):
+            src.append("    " + ", ".join("0x%02X" % b for b in data[i:i + w]) + ",")
+        src.append("};")
+        src.append("")
+        src.append("const struct ssd1306_bitmap %s = { %d, %d, %s_data };" % (n, w, h, n))
+        src.append("")
+
+    with open(args.out + ".h", "w", newline="\n") as f:
+        f.write("\n".join(hdr))
+    with open(args.out + ".c", "w", newline="\n") as f:
+        f.write("\n".join(src))
+
+
+if __name__ == "__main__":
+    main()
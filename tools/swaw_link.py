@@ -0,0 +1,599 @@
+#!/usr/bin/env python3
+"""Host side of the watch binary command link (see Core/Src/cmd_link.c).
+
+Frames share the debug UART with text logs, they are COBS encoded and
+delimited by zero bytes:  0x00 | COBS(type | payload | CRC16 LE) | 0x00
+
+Usage:
+    swaw_link.py PORT ping
+    swaw_link.py PORT info
+    swaw_link.py PORT history OUT.csv [--start N]
+    swaw_link.py PORT stream OUT.csv [--seconds S]
+    swaw_link.py PORT stats
+    swaw_link.py PORT trace OUT.json
+    swaw_link.py PORT oled [--interval S]
+    swaw_link.py PORT time [--set]
+    swaw_link.py PORT boot
+    swaw_link.py PORT screen OUT.pbm [--golden GOLDEN.pbm]
+    swaw_link.py PORT metrics [--reset]
+
+The history pull is resumable: with an existing OUT.csv the transfer continues
+after the last index already stored in it.
+
+A raw stream capture is a trace corpus file: CSV with a "seq,ir,red" header
+and one row per sensor sample at the rate reported by the device. seq is the
+sensor sample number, samples dropped by the sensor FIFO show up as gaps.
+
+A trace dump is converted to Chrome trace JSON, open it in Perfetto
+(ui.perfetto.dev) or chrome://tracing.
+
+A screen capture is the framebuffer the next flush puts on the panel, saved as
+a 128x64 PBM. With --golden it is compared against a reference capture and the
+exit status is non-zero if any pixel differs, a diff image is written next to
+OUT.pbm.
+
+Metrics are counted since boot or the last --reset. Histogram buckets are log2
+microseconds, percentiles are reported as the upper bound of their bucket.
+"""
+
+import argparse
+import csv
+import os
+import struct
+import sys
+import time
+
+PING = 0x01
+HISTORY_INFO = 0x02
+HISTORY_READ = 0x03
+SET_TIME = 0x05
+STREAM_START = 0x10
+STREAM_STOP = 0x11
+SYS_STATS = 0x20
+TRACE_DUMP = 0x21
+OLED_STATS = 0x24
+BOOT_TIMES = 0x25
+OLED_FRAME = 0x26
+METRICS = 0x27
+RSP = 0x80
+RSP_HISTORY_DATA = 0x83
+RSP_HISTORY_END = 0x84
+RSP_STREAM_DATA = 0x92
+RSP_TRACE_DATA = 0xA2
+RSP_TRACE_END = 0xA3
+RSP_ERROR = 0xFF
+
+QUALITY = {1: "poor", 2: "fair", 3: "good"}
+
+# enum oled_state in Core/Inc/oled_app.h
+OLED_STATES = {1: "startup", 2: "measurement", 3: "heart rate", 4: "shutdown", 5: "no finger",
+               6: "motion", 7: "clock tick", 9: "wave", 10: "beat", 99: "watch"}
+
+OLED_W = 128
+OLED_H = 64
+
+# enum metrics_counter / metrics_gauge / metrics_hist in Core/Inc/metrics.h
+METRIC_COUNTERS = ["sensor samples", "sensor lost", "sensor i2c errors", "hr beats", "oled drops",
+                   "oled flushes", "oled bytes", "oled i2c errors", "log lines", "log drops"]
+METRIC_GAUGES = ["sensor fifo", "oled queue"]
+METRIC_HISTS = ["sensor read", "hr dsp", "oled render", "oled flush"]
+
+# enum sys_clock_profile in Core/Inc/sys_clock.h
+CLOCK_PROFILES = {0: "low (MSI 4.2 MHz)", 1: "full (PLL 32 MHz)"}
+
+# enum sys_stats_boot in Core/Inc/sys_stats.h
+BOOT_PHASES = ["rtc", "scheduler", "panel", "first frame"]
+
+# enum trace_rec_event_type / enum trace_rec_span in Core/Inc/trace_rec.h
+EV_TASK_SWITCH = 1
+EV_QUEUE = {2: "send", 3: "send failed", 4: "receive", 5: "block send", 6: "block receive"}
+EV_ISR_ENTER = 7
+EV_ISR_EXIT = 8
+EV_SPAN_BEGIN = 9
+EV_SPAN_END = 10
+SPANS = {1: "max30100 i2c", 2: "ssd1306 i2c", 3: "hr dsp", 4: "oled draw"}
+ISR_NAMES = {16 + 9: "EXTI3 (button)", 16 + 3: "RTC wakeup", 16 + 38: "USART2", 16 + 17: "DMA1 ch7",
+             16 + 16: "DMA1 ch6", 16 + 31: "I2C1 event", 16 + 32: "I2C1 error"}
+
+PID_TASKS, PID_ISR, PID_QUEUES, PID_SPANS = 1, 2, 3, 4
+
+
+def crc16(data):
+    crc = 0xFFFF
+    for b in data:
+        crc ^= b << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else (crc << 1)
+            crc &= 0xFFFF
+    return crc
+
+
+def cobs_encode(data):
+    out = bytearray([0])
+    code_pos = 0
+    code = 1
+    for b in data:
+        if b == 0:
+            out[code_pos] = code
+            code_pos = len(out)
+            out.append(0)
+            code = 1
+            continue
+        out.append(b)
+        code += 1
+        if code == 0xFF:
+            out[code_pos] = code
+            code_pos = len(out)
+            out.append(0)
+            code = 1
+    out[code_pos] = code
+    return bytes(out)
+
+
+def cobs_decode(data):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        code = data[i]
+        i += 1
+        if code == 0 or i + code - 1 > len(data):
+            return None
+        out += data[i:i + code - 1]
+        i += code - 1
+        if code != 0xFF and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+def encode_frame(ftype, payload=b""):
+    raw = bytes([ftype]) + payload
+    raw += struct.pack("<H", crc16(raw))
+    return b"\x00" + cobs_encode(raw) + b"\x00"
+
+
+def decode_frame(data):
+    raw = cobs_decode(data)
+    if raw is None or len(raw) < 3:
+        return None
+    if crc16(raw[:-2]) != struct.unpack("<H", raw[-2:])[0]:
+        return None
+    return raw[0], raw[1:-2]
+
+
+class Link:
+    def __init__(self, port, baudrate=115200, timeout=1.0):
+        import serial
+        self.ser = serial.Serial(port, baudrate, timeout=0.05)
+        self.timeout = timeout
+        self.buf = bytearray()
+
+    def send(self, ftype, payload=b""):
+        self.ser.write(encode_frame(ftype, payload))
+
+    def recv(self):
+        """Returns the next valid frame or None on timeout. Text between frames
+        (log lines) decodes to garbage and is dropped by the CRC check."""
+        deadline = time.monotonic() + self.timeout
+        while time.monotonic() < deadline:
+            while b"\x00" in self.buf:
+                chunk, _, rest = bytes(self.buf).partition(b"\x00")
+                self.buf = bytearray(rest)
+                if chunk:
+                    frame = decode_frame(chunk)
+                    if frame is not None:
+                        return frame
+            self.buf += self.ser.read(256)
+        return None
+
+    def request(self, ftype, payload=b"", retries=3):
+        for _ in range(retries):
+            self.send(ftype, payload)
+            frame = self.recv()
+            if frame is not None:
+                return frame
+        raise TimeoutError("no response to 0x%02x" % ftype)
+
+
+def cmd_ping(link, args):
+    ftype, payload = link.request(PING)
+    print("protocol version %d" % payload[0])
+
+
+def cmd_info(link, args):
+    ftype, payload = link.request(HISTORY_INFO)
+    first, nxt, writes = struct.unpack("<III", payload)
+    print("records %d..%d (%d), eeprom writes %d" % (first, nxt - 1, nxt - first, writes))
+
+
+def last_stored_index(path):
+    if not os.path.exists(path):
+        return None
+    last = None
+    with open(path, newline="") as f:
+        for row in csv.DictReader(f):
+            last = int(row["index"])
+    return last
+
+
+def cmd_history(link, args):
+    last = last_stored_index(args.out)
+    start = args.start if last is None else last + 1
+    new_file = last is None
+
+    with open(args.out, "a", newline="") as f:
+        writer = csv.writer(f)
+        if new_file:
+            writer.writerow(["index", "timestamp", "bpm", "spo2", "quality"])
+
+        for attempt in range(args.retries):
+            link.send(HISTORY_READ, struct.pack("<II", start, args.count))
+            done = False
+            while True:
+                frame = link.recv()
+                if frame is None:
+                    break
+                ftype, payload = frame
+                if ftype == RSP_HISTORY_DATA:
+                    index, n = struct.unpack_from("<IB", payload)
+                    for i in range(n):
+                        ts, bpm, spo2, q = struct.unpack_from("<IBBB", payload, 5 + 7 * i)
+                        writer.writerow([index + i, ts, bpm, spo2, QUALITY.get(q, q)])
+                    start = index + n
+                    f.flush()
+                elif ftype == RSP_HISTORY_END:
+                    done = True
+                    break
+                elif ftype == RSP_ERROR:
+                    sys.exit("device error for 0x%02x" % payload[0])
+            if done:
+                print("history up to index %d stored in %s" % (start - 1, args.out))
+                return
+            print("timeout, resuming from index %d" % start, file=sys.stderr)
+
+    sys.exit("giving up after %d attempts" % args.retries)
+
+
+def cmd_stream(link, args):
+    ftype, payload = link.request(STREAM_START)
+    if ftype != STREAM_START | RSP:
+        sys.exit("unexpected response 0x%02x" % ftype)
+    rate = struct.unpack("<H", payload)[0]
+    print("streaming at %d Hz for %d s" % (rate, args.seconds))
+
+    samples = 0
+    lost = 0
+    stats = None
+    deadline = time.monotonic() + args.seconds
+
+    with open(args.out, "w", newline="") as f:
+        writer = csv.writer(f)
+        writer.writerow(["seq", "ir", "red"])
+        stopping = False
+
+        while True:
+            if not stopping and time.monotonic() >= deadline:
+                link.send(STREAM_STOP)
+                stopping = True
+            frame = link.recv()
+            if frame is None:
+                if stopping:
+                    break
+                continue
+            ftype, payload = frame
+            if ftype == RSP_STREAM_DATA:
+                seq, gap, n = struct.unpack_from("<IBB", payload)
+                for i in range(n):
+                    ir, red = struct.unpack_from("<HH", payload, 6 + 4 * i)
+                    writer.writerow([seq + i, ir, red])
+                samples += n
+                lost += gap
+            elif ftype == STREAM_STOP | RSP:
+                stats = struct.unpack("<II", payload)
+                break
+
+    print("%d samples, %d lost by the sensor" % (samples, lost))
+    if stats is None:
+        sys.exit("no stop acknowledge, capture may be truncated")
+    if stats[0] != samples:
+        sys.exit("device sent %d samples, %d received" % (stats[0], samples))
+
+
+def cmd_stats(link, args):
+    ftype, payload = link.request(SYS_STATS)
+    period, load, n = struct.unpack_from("<HHB", payload)
+    print("CPU load %.1f %% over %d ms" % (load / 10, period))
+    print("%3s  %-8s %7s %11s" % ("#", "task", "cpu %", "stack free"))
+    for i in range(n):
+        number, cpu, stack, name = struct.unpack_from("<BHH8s", payload, 5 + 13 * i)
+        name = name.split(b"\x00")[0].decode(errors="replace")
+        print("%3d  %-8s %7.1f %11d" % (number, name, cpu / 10, stack))
+    pos = 5 + 13 * n
+    if len(payload) >= pos + 13:
+        profile, switches, last_us, max_us = struct.unpack_from("<BIII", payload, pos)
+        print("clock %s, %d profile switches, last %d us, max %d us"
+              % (CLOCK_PROFILES.get(profile, "profile %d" % profile), switches, last_us, max_us))
+
+
+def parse_names(payload, pos):
+    n = payload[pos]
+    pos += 1
+    names = {}
+    for _ in range(n):
+        number, name = struct.unpack_from("<B8s", payload, pos)
+        names[number] = name.split(b"\x00")[0].decode(errors="replace")
+        pos += 9
+    return names, pos
+
+
+def trace_to_chrome(hz, tasks, queues, events):
+    out = []
+
+    def meta(pid, name, tid=None, tname=None):
+        out.append({"ph": "M", "pid": pid, "name": "process_name", "args": {"name": name}})
+        if tid is not None:
+            out.append({"ph": "M", "pid": pid, "tid": tid, "name": "thread_name", "args": {"name": tname}})
+
+    meta(PID_TASKS, "tasks")
+    meta(PID_ISR, "interrupts")
+    meta(PID_QUEUES, "queues")
+    meta(PID_SPANS, "drivers")
+    for number, name in tasks.items():
+        meta(PID_TASKS, "tasks", number, name)
+    for number, name in queues.items():
+        meta(PID_QUEUES, "queues", number, name)
+
+    # Unwrap the 32-bit timer and convert to microseconds
+    base = None
+    wraps = 0
+    prev = None
+    running = None
+    for t, etype, eid, arg in events:
+        if prev is not None and t < prev:
+            wraps += 1
+        prev = t
+        ts = (wraps * (1 << 32) + t) * 1e6 / hz
+        if base is None:
+            base = ts
+        ts -= base
+
+        if etype == EV_TASK_SWITCH:
+            if running is not None:
+                out.append({"ph": "X", "pid": PID_TASKS, "tid": running[0], "ts": running[1],
+                            "dur": ts - running[1], "name": tasks.get(running[0], "task %d" % running[0])})
+            running = (eid, ts)
+        elif etype in EV_QUEUE:
+            out.append({"ph": "i", "s": "t", "pid": PID_QUEUES, "tid": eid, "ts": ts,
+                        "name": EV_QUEUE[etype], "args": {"items": arg}})
+            if etype in (2, 4):
+                out.append({"ph": "C", "pid": PID_QUEUES, "ts": ts,
+                            "name": queues.get(eid, "queue %d" % eid),
+                            "args": {"items": arg + 1 if etype == 2 else arg - 1}})
+        elif etype in (EV_ISR_ENTER, EV_ISR_EXIT):
+            name = ISR_NAMES.get(eid, "exception %d" % eid)
+            out.append({"ph": "B" if etype == EV_ISR_ENTER else "E", "pid": PID_ISR, "tid": eid,
+                        "ts": ts, "name": name})
+        elif etype in (EV_SPAN_BEGIN, EV_SPAN_END):
+            out.append({"ph": "B" if etype == EV_SPAN_BEGIN else "E", "pid": PID_SPANS, "tid": eid,
+                        "ts": ts, "name": SPANS.get(eid, "span %d" % eid)})
+
+    for tid, name in list(ISR_NAMES.items()):
+        out.append({"ph": "M", "pid": PID_ISR, "tid": tid, "name": "thread_name", "args": {"name": name}})
+    for tid, name in SPANS.items():
+        out.append({"ph": "M", "pid": PID_SPANS, "tid": tid, "name": "thread_name", "args": {"name": name}})
+
+    return {"traceEvents": out, "displayTimeUnit": "ms"}
+
+
+def cmd_trace(link, args):
+    import json
+
+    ftype, payload = link.request(TRACE_DUMP)
+    if ftype != TRACE_DUMP | RSP:
+        sys.exit("unexpected response 0x%02x" % ftype)
+    hz, count, overwritten = struct.unpack_from("<IHI", payload)
+    tasks, pos = parse_names(payload, 10)
+    queues, pos = parse_names(payload, pos)
+
+    events = []
+    while True:
+        frame = link.recv()
+        if frame is None:
+            sys.exit("trace dump timed out after %d of %d events" % (len(events), count))
+        ftype, payload = frame
+        if ftype == RSP_TRACE_DATA:
+            for i in range(payload[0]):
+                events.append(struct.unpack_from("<IBBH", payload, 1 + 8 * i))
+        elif ftype == RSP_TRACE_END:
+            break
+
+    with open(args.out, "w") as f:
+        json.dump(trace_to_chrome(hz, tasks, queues, events), f)
+    print("%d events (%d overwritten) written to %s" % (len(events), overwritten, args.out))
+
+
+def cmd_oled(link, args):
+    def read():
+        ftype, payload = link.request(OLED_STATS)
+        return struct.unpack_from("<IIII", payload), payload[16:]
+
+    (flushes, nbytes, uptime, lit), render = read()
+    minutes = max(uptime, 1) / 60000
+    print("since boot: %d flushes, %d bytes (%.1f flushes/min, %.0f bytes/min), panel lit %.0f %%"
+          % (flushes, nbytes, flushes / minutes, nbytes / minutes, 100 * lit / max(uptime, 1)))
+
+    if render:
+        print("%-12s %8s %10s %10s" % ("render", "count", "mean us", "max us"))
+    for pos in range(0, len(render) - 8, 9):
+        state, count, mean, peak = struct.unpack_from("<BIHH", render, pos)
+        if count:
+            print("%-12s %8d %10d %10d" % (OLED_STATES.get(state, "state %d" % state), count, mean, peak))
+
+    if args.interval:
+        time.sleep(args.interval)
+        (flushes2, nbytes2, uptime2, lit2), _ = read()
+        minutes = max(uptime2 - uptime, 1) / 60000
+        print("last %.0f s: %.1f flushes/min, %.0f bytes/min, panel lit %.0f %%"
+              % ((uptime2 - uptime) / 1000, (flushes2 - flushes) / minutes, (nbytes2 - nbytes) / minutes,
+                 100 * (lit2 - lit) / max(uptime2 - uptime, 1)))
+
+
+def read_pbm(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    header = data.split(None, 3)
+    if header[0] != b"P4" or int(header[1]) != OLED_W or int(header[2]) != OLED_H:
+        sys.exit("%s: not a %dx%d raw PBM" % (path, OLED_W, OLED_H))
+    return data[len(data) - OLED_W * OLED_H // 8:]
+
+
+def write_pbm(path, rows):
+    with open(path, "wb") as f:
+        f.write(b"P4\n%d %d\n" % (OLED_W, OLED_H) + bytes(rows))
+
+
+def cmd_screen(link, args):
+    chunks = {}
+    link.send(OLED_FRAME)
+    while len(chunks) < 16:
+        frame = link.recv()
+        if frame is None:
+            sys.exit("capture timed out after %d of 16 chunks" % len(chunks))
+        ftype, payload = frame
+        if ftype == RSP_ERROR:
+            sys.exit("capture refused, display queue full")
+        if ftype == OLED_FRAME | RSP:
+            chunks[payload[0]] = payload[1:]
+    fb = b"".join(chunks[i] for i in range(16))
+
+    # Page-major framebuffer (LSB on top) to PBM rows (MSB on the left)
+    rows = bytearray(OLED_W * OLED_H // 8)
+    for y in range(OLED_H):
+        for x in range(OLED_W):
+            if fb[(y // 8) * OLED_W + x] >> (y % 8) & 1:
+                rows[y * OLED_W // 8 + x // 8] |= 0x80 >> (x % 8)
+    write_pbm(args.out, rows)
+    print("screen written to %s" % args.out)
+
+    if args.golden:
+        golden = read_pbm(args.golden)
+        diff = bytes(a ^ b for a, b in zip(rows, golden))
+        count = sum(bin(b).count("1") for b in diff)
+        if count:
+            path = os.path.splitext(args.out)[0] + "_diff.pbm"
+            write_pbm(path, diff)
+            sys.exit("%d pixels differ from %s, see %s" % (count, args.golden, path))
+        print("matches %s" % args.golden)
+
+
+def bucket_limit(b):
+    """Upper bound in us of log2 bucket b, the last bucket is open."""
+    return (1 << b) - 1
+
+
+def cmd_metrics(link, args):
+    ftype, payload = link.request(METRICS, bytes([1 if args.reset else 0]))
+    ncounters, ngauges, nhists, nbuckets = payload[:4]
+    values = struct.unpack_from("<%dI%di" % (ncounters, ngauges * 2), payload, 4)
+
+    for i, val in enumerate(values[:ncounters]):
+        name = METRIC_COUNTERS[i] if i < len(METRIC_COUNTERS) else "counter %d" % i
+        print("%-18s %10d" % (name, val))
+
+    print("%-18s %10s %10s" % ("gauge", "last", "peak"))
+    for i in range(ngauges):
+        name = METRIC_GAUGES[i] if i < len(METRIC_GAUGES) else "gauge %d" % i
+        print("%-18s %10d %10d" % (name, values[ncounters + i * 2], values[ncounters + i * 2 + 1]))
+
+    hists = {}
+    while len(hists) < nhists:
+        frame = link.recv()
+        if frame is None:
+            sys.exit("metrics timed out after %d of %d histograms" % (len(hists), nhists))
+        ftype, payload = frame
+        if ftype == METRICS | RSP:
+            hists[payload[0]] = struct.unpack_from("<%dI" % nbuckets, payload, 1)
+
+    print("%-18s %10s %8s %8s %8s" % ("latency", "count", "p50 us", "p90 us", "p99 us"))
+    for i in range(nhists):
+        buckets = hists[i]
+        total = sum(buckets)
+        name = METRIC_HISTS[i] if i < len(METRIC_HISTS) else "hist %d" % i
+        if not total:
+            print("%-18s %10d" % (name, 0))
+            continue
+        pct = []
+        for q in (0.5, 0.9, 0.99):
+            seen = 0
+            for b, n in enumerate(buckets):
+                seen += n
+                if seen >= q * total:
+                    break
+            pct.append("<=%d" % bucket_limit(b) if b < nbuckets - 1 else ">%d" % bucket_limit(b - 1))
+        print("%-18s %10d %8s %8s %8s" % ((name, total) + tuple(pct)))
+
+
+def cmd_time(link, args):
+    payload = struct.pack("<I", int(time.time())) if args.set else b""
+    ftype, payload = link.request(SET_TIME, payload)
+    device = struct.unpack("<I", payload)[0]
+    print("device time %s UTC, host offset %+d s"
+          % (time.strftime("%Y-%m-%d %H:%M:%S", time.gmtime(device)), device - int(time.time())))
+
+
+def cmd_boot(link, args):
+    ftype, payload = link.request(BOOT_TIMES)
+    n = payload[0]
+    prev = 0
+    print("%-12s %10s %10s" % ("phase", "at ms", "+ms"))
+    for i, us in enumerate(struct.unpack_from("<%dI" % n, payload, 1)):
+        name = BOOT_PHASES[i] if i < len(BOOT_PHASES) else "phase %d" % i
+        if us == 0xFFFFFFFF:
+            print("%-12s %10s" % (name, "-"))
+            continue
+        print("%-12s %10.1f %10.1f" % (name, us / 1000, (us - prev) / 1000))
+        prev = us
+
+
+def main():
+    p = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    p.add_argument("port")
+    p.add_argument("--baudrate", type=int, default=115200)
+    sub = p.add_subparsers(dest="cmd", required=True)
+    sub.add_parser("ping").set_defaults(func=cmd_ping)
+    sub.add_parser("info").set_defaults(func=cmd_info)
+    h = sub.add_parser("history")
+    h.add_argument("out")
+    h.add_argument("--start", type=int, default=0)
+    h.add_argument("--count", type=int, default=0xFFFFFFFF)
+    h.add_argument("--retries", type=int, default=5)
+    h.set_defaults(func=cmd_history)
+    s = sub.add_parser("stream")
+    s.add_argument("out")
+    s.add_argument("--seconds", type=float, default=10)
+    s.set_defaults(func=cmd_stream)
+    sub.add_parser("stats").set_defaults(func=cmd_stats)
+    t = sub.add_parser("trace")
+    t.add_argument("out")
+    t.set_defaults(func=cmd_trace)
+    o = sub.add_parser("oled")
+    o.add_argument("--interval", type=float, default=60)
+    o.set_defaults(func=cmd_oled)
+    c = sub.add_parser("time")
+    c.add_argument("--set", action="store_true", help="set the device clock to the host UTC time")
+    c.set_defaults(func=cmd_time)
+    sub.add_parser("boot").set_defaults(func=cmd_boot)
+    g = sub.add_parser("screen")
+    g.add_argument("out")
+    g.add_argument("--golden", help="reference capture to compare against")
+    g.set_defaults(func=cmd_screen)
+    m = sub.add_parser("metrics")
+    m.add_argument("--reset", action="store_true", help="clear the metrics once they are read")
+    m.set_defaults(func=cmd_metrics)
+    args = p.parse_args()
+
+    link = Link(args.port, args.baudrate)
+    args.func(link, args)
+
+
+if __name__ == "__main__":
+    main()